@@ -5,15 +5,26 @@
 
 #include <cstdlib>
 #define main main
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <deque>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <map>
+#include <mutex>
 #include <optional>
+#include <queue>
 #include <stack>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "microui-header.h"
@@ -21,7 +32,19 @@
 #include "sdl/include/SDL_keycode.h"
 #include "string.h"
 // #include <format>
+#include <dirent.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
 #include <time.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include <tree_sitter/api.h>
 
 // TODO: move this into a struct.
@@ -36,6 +59,736 @@ const clock_t TARGET_CLOCKS_PER_FRAME =
 // Useful for having god objects, where you hand different views of the god
 // objct to different people.
 
+// ===PIECE TABLE===
+// The editor text is a piece table: a read-only `orig` buffer (the file as it
+// was loaded), an append-only `add` buffer that holds every string ever
+// inserted, and a sequence of pieces that stitch spans of the two together.
+// Memory scales with the file size plus the total size of the edits.
+//
+// The pieces are kept in a treap ordered by position in the text. Every node
+// caches the byte length and newline count of its subtree, so finding a byte
+// offset or the start of a line, and splitting or joining lines, are
+// O(log #pieces) no matter how many lines the file has. Large spans are cut
+// into pieces of at most PIECE_MAX_LEN bytes, so that the scan for a newline
+// inside of a single piece is bounded too.
+//
+// Nodes are reference counted and copied on write: an operation that needs to
+// modify a node that is shared first takes its own copy (`piece_node_own`).
+// Holding on to an old root is thus an O(1) snapshot of the text, and an
+// edit only copies the O(log #pieces) nodes on the paths it touches. Tree
+// functions consume the references they are passed and return owned ones.
+
+int count_newlines(const char *s, int len) {
+  int n = 0;
+  const char *end = s + len;
+  while ((s = (const char *)memchr(s, '\n', end - s))) {
+    n++;
+    s++;
+  }
+  return n;
+}
+
+static const int PIECE_MAX_LEN = 4096;
+
+struct Piece {
+  bool add = false; // span lives in `add` if true, in `orig` otherwise.
+  int start = 0;    // offset of the span in its buffer.
+  int len = 0;
+  int nlines = 0; // number of '\n' in the span.
+  // offset of the span in the file on disk, or -1 if it isn't on disk yet.
+  // `orig` starts out as the file, `editor_save` marks everything as saved.
+  int disk = -1;
+};
+
+struct PieceNode {
+  int refs = 1;
+  Piece piece;
+  unsigned prio = 0; // max-heap priority of the treap.
+  PieceNode *l = nullptr;
+  PieceNode *r = nullptr;
+  int len = 0;    // total bytes in this subtree.
+  int nlines = 0; // total '\n' in this subtree.
+  // if the subtree is one contiguous span of the file on disk, where that
+  // span begins. -1 otherwise. Lets saving skip unmodified subtrees.
+  int disk = -1;
+};
+
+struct PieceTable {
+  const char *orig = nullptr;
+  int origlen = 0;
+  std::string add;
+  PieceNode *root = nullptr;
+  int len = 0;    // total number of bytes.
+  int nlines = 0; // total number of '\n'.
+  int version = 0; // bumped by every change to the text.
+};
+
+const char *piece_table_span(const PieceTable *pt, const Piece &p) {
+  return p.add ? pt->add.data() + p.start : pt->orig + p.start;
+}
+
+int piece_node_len(const PieceNode *n) { return n ? n->len : 0; }
+int piece_node_nlines(const PieceNode *n) { return n ? n->nlines : 0; }
+
+void piece_node_update(PieceNode *n) {
+  n->len = piece_node_len(n->l) + n->piece.len + piece_node_len(n->r);
+  n->nlines =
+      piece_node_nlines(n->l) + n->piece.nlines + piece_node_nlines(n->r);
+
+  // the subtree is contiguous on disk if its left subtree ends where the
+  // piece begins, and the piece ends where its right subtree begins.
+  const Piece &p = n->piece;
+  const bool lok =
+      !n->l || (n->l->disk != -1 && n->l->disk + n->l->len == p.disk);
+  const bool rok = !n->r || n->r->disk == p.disk + p.len;
+  n->disk = p.disk != -1 && lok && rok ? (n->l ? n->l->disk : p.disk) : -1;
+}
+
+unsigned piece_node_random_prio() {
+  // xorshift32, per thread since the indexer builds ropes on its own.
+  static thread_local unsigned state = 2463534242u;
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+PieceNode *piece_node_new(Piece p, unsigned prio) {
+  PieceNode *n = new PieceNode;
+  n->piece = p;
+  n->prio = prio;
+  piece_node_update(n);
+  return n;
+}
+
+PieceNode *piece_tree_incref(PieceNode *n) {
+  if (n) {
+    n->refs++;
+  }
+  return n;
+}
+
+void piece_tree_decref(PieceNode *n) {
+  if (!n || --n->refs > 0) {
+    return;
+  }
+  piece_tree_decref(n->l);
+  piece_tree_decref(n->r);
+  delete n;
+}
+
+// the nodes of the tree at `n` that no other tree shares. A node that is
+// also in another tree has a reference from each, and so does all below it.
+int piece_tree_own_nodes(const PieceNode *n) {
+  if (!n || n->refs > 1) {
+    return 0;
+  }
+  return 1 + piece_tree_own_nodes(n->l) + piece_tree_own_nodes(n->r);
+}
+
+// a copy of `n` that may be modified, taking over the reference to `n`.
+PieceNode *piece_node_own(PieceNode *n) {
+  assert(n && n->refs >= 1);
+  if (n->refs == 1) {
+    return n;
+  }
+  PieceNode *c = new PieceNode;
+  c->piece = n->piece;
+  c->prio = n->prio;
+  c->l = piece_tree_incref(n->l);
+  c->r = piece_tree_incref(n->r);
+  piece_node_update(c);
+  n->refs--;
+  return c;
+}
+
+// all of `a` comes before all of `b`.
+PieceNode *piece_tree_merge(PieceNode *a, PieceNode *b) {
+  if (!a) {
+    return b;
+  }
+  if (!b) {
+    return a;
+  }
+  if (a->prio >= b->prio) {
+    a = piece_node_own(a);
+    a->r = piece_tree_merge(a->r, b);
+    piece_node_update(a);
+    return a;
+  }
+  b = piece_node_own(b);
+  b->l = piece_tree_merge(a, b->l);
+  piece_node_update(b);
+  return b;
+}
+
+// split `n` into the bytes [0, ix) and [ix, len), cutting a piece in two if
+// `ix` falls inside of it.
+void piece_tree_split(const PieceTable *pt, PieceNode *n, int ix,
+                      PieceNode **l, PieceNode **r) {
+  if (!n) {
+    assert(ix == 0);
+    *l = *r = nullptr;
+    return;
+  }
+  n = piece_node_own(n);
+  const int llen = piece_node_len(n->l);
+  if (ix <= llen) {
+    piece_tree_split(pt, n->l, ix, l, &n->l);
+    piece_node_update(n);
+    *r = n;
+    return;
+  }
+  if (ix >= llen + n->piece.len) {
+    piece_tree_split(pt, n->r, ix - llen - n->piece.len, &n->r, r);
+    piece_node_update(n);
+    *l = n;
+    return;
+  }
+
+  // `ix` is strictly inside the piece at `n`.
+  const Piece p = n->piece;
+  const int k = ix - llen;
+  Piece lp = p, rp = p;
+  lp.len = k;
+  rp.start += k;
+  rp.len -= k;
+  rp.disk = p.disk == -1 ? -1 : p.disk + k;
+  // count newlines on the smaller side.
+  if (k <= p.len - k) {
+    lp.nlines = count_newlines(piece_table_span(pt, lp), lp.len);
+    rp.nlines = p.nlines - lp.nlines;
+  } else {
+    rp.nlines = count_newlines(piece_table_span(pt, rp), rp.len);
+    lp.nlines = p.nlines - rp.nlines;
+  }
+  // `rn` inherits the priority of `n`, which dominates everything in `n->r`.
+  PieceNode *rn = piece_node_new(rp, n->prio);
+  rn->r = n->r;
+  piece_node_update(rn);
+  n->piece = lp;
+  n->r = nullptr;
+  piece_node_update(n);
+  *l = n;
+  *r = rn;
+}
+
+// the last piece of `n` was created by an insert that ended at the tail of
+// the add buffer; grow it by `len` more bytes.
+PieceNode *piece_tree_extend_last(PieceNode *n, int len, int nlines) {
+  n = piece_node_own(n);
+  if (n->r) {
+    n->r = piece_tree_extend_last(n->r, len, nlines);
+  } else {
+    n->piece.len += len;
+    n->piece.nlines += nlines;
+  }
+  n->len += len;
+  n->nlines += nlines;
+  return n;
+}
+
+const Piece *piece_tree_last(const PieceNode *n) {
+  if (!n) {
+    return nullptr;
+  }
+  while (n->r) {
+    n = n->r;
+  }
+  return &n->piece;
+}
+
+// build a tree for the span [start, start + len) of a buffer, cut into pieces
+// of at most PIECE_MAX_LEN bytes.
+PieceNode *piece_tree_from_span(const PieceTable *pt, bool add, int start,
+                                int len) {
+  PieceNode *root = nullptr;
+  for (int i = 0; i < len; i += PIECE_MAX_LEN) {
+    Piece p{add, start + i, std::min<int>(PIECE_MAX_LEN, len - i), 0};
+    p.disk = add ? -1 : p.start;
+    p.nlines = count_newlines(piece_table_span(pt, p), p.len);
+    root = piece_tree_merge(root, piece_node_new(p, piece_node_random_prio()));
+  }
+  return root;
+}
+
+void piece_table_init(PieceTable *pt, const char *orig, int origlen) {
+  assert(origlen >= 0);
+  piece_tree_decref(pt->root);
+  pt->orig = orig;
+  pt->origlen = origlen;
+  pt->add.clear();
+  pt->root = piece_tree_from_span(pt, false, 0, origlen);
+  pt->version++;
+  pt->len = origlen;
+  pt->nlines = piece_node_nlines(pt->root);
+}
+
+void piece_table_insert(PieceTable *pt, int ix, const char *s, int len) {
+  assert(ix >= 0 && ix <= pt->len);
+  assert(len >= 0);
+  if (len == 0) {
+    return;
+  }
+  const int addstart = pt->add.size();
+  pt->add.append(s, len);
+  const int nlines = count_newlines(s, len);
+  pt->version++;
+  pt->len += len;
+  pt->nlines += nlines;
+
+  PieceNode *l, *r;
+  piece_tree_split(pt, pt->root, ix, &l, &r);
+  // typing appends to the piece that was created by the previous insert.
+  const Piece *prev = piece_tree_last(l);
+  if (prev && prev->add && prev->disk == -1 &&
+      prev->start + prev->len == addstart &&
+      prev->len + len <= PIECE_MAX_LEN) {
+    l = piece_tree_extend_last(l, len, nlines);
+  } else {
+    l = piece_tree_merge(l, piece_tree_from_span(pt, true, addstart, len));
+  }
+  pt->root = piece_tree_merge(l, r);
+}
+
+void piece_table_delete(PieceTable *pt, int ix, int len) {
+  assert(ix >= 0 && len >= 0 && ix + len <= pt->len);
+  if (len == 0) {
+    return;
+  }
+  PieceNode *l, *mid, *r;
+  piece_tree_split(pt, pt->root, ix, &l, &r);
+  piece_tree_split(pt, r, len, &mid, &r);
+  pt->version++;
+  pt->nlines -= piece_node_nlines(mid);
+  pt->len -= len;
+  piece_tree_decref(mid);
+  pt->root = piece_tree_merge(l, r);
+}
+
+// copy the bytes [ix, ix + len) of the subtree `n` into `out`.
+void piece_tree_copy(const PieceTable *pt, const PieceNode *n, int ix, int len,
+                     char *out) {
+  if (!n || len <= 0) {
+    return;
+  }
+  const int llen = piece_node_len(n->l);
+  if (ix < llen) {
+    const int k = std::min<int>(len, llen - ix);
+    piece_tree_copy(pt, n->l, ix, k, out);
+    out += k;
+    ix += k;
+    len -= k;
+  }
+  ix -= llen;
+  if (len > 0 && ix < n->piece.len) {
+    const int k = std::min<int>(len, n->piece.len - ix);
+    memcpy(out, piece_table_span(pt, n->piece) + ix, k);
+    out += k;
+    ix += k;
+    len -= k;
+  }
+  piece_tree_copy(pt, n->r, ix - n->piece.len, len, out);
+}
+
+// set the text to `root`, taking over the reference.
+void piece_table_set_root(PieceTable *pt, PieceNode *root) {
+  piece_tree_decref(pt->root);
+  pt->root = root;
+  pt->version++;
+  pt->len = piece_node_len(root);
+  pt->nlines = piece_node_nlines(root);
+}
+
+// add the next `len` bytes of `orig` to the end of the text. Used to load a
+// file in chunks: `origlen` counts the bytes of `orig` loaded so far.
+void piece_table_append_orig(PieceTable *pt, int len) {
+  assert(len >= 0);
+  PieceNode *n = piece_tree_from_span(pt, false, pt->origlen, len);
+  pt->origlen += len;
+  pt->version++;
+  pt->len += len;
+  pt->nlines += piece_node_nlines(n);
+  pt->root = piece_tree_merge(pt->root, n);
+}
+
+// copy bytes [ix, ix + len) into `out`.
+void piece_table_copy(const PieceTable *pt, int ix, int len, char *out) {
+  assert(ix >= 0 && len >= 0 && ix + len <= pt->len);
+  piece_tree_copy(pt, pt->root, ix, len, out);
+}
+
+// offset of the first byte of `line`. We must have 0 <= line <= pt->nlines.
+int piece_table_line_begin(const PieceTable *pt, int line) {
+  assert(line >= 0 && line <= pt->nlines);
+  if (line == 0) {
+    return 0;
+  }
+  int begin = 0;
+  const PieceNode *n = pt->root;
+  while (n) {
+    const int lnlines = piece_node_nlines(n->l);
+    if (line <= lnlines) {
+      n = n->l;
+      continue;
+    }
+    line -= lnlines;
+    begin += piece_node_len(n->l);
+    if (line <= n->piece.nlines) {
+      // the line-th newline lives in this piece.
+      const char *s = piece_table_span(pt, n->piece);
+      const char *end = s + n->piece.len;
+      for (const char *c = s; (c = (const char *)memchr(c, '\n', end - c));
+           ++c) {
+        if (--line == 0) {
+          return begin + (c - s) + 1;
+        }
+      }
+      assert(false && "piece newline count is stale");
+    }
+    line -= n->piece.nlines;
+    begin += n->piece.len;
+    n = n->r;
+  }
+  assert(false && "line out of bounds");
+  return pt->len;
+}
+
+// length of `line`, not counting the trailing newline.
+int piece_table_line_len(const PieceTable *pt, int line) {
+  const int begin = piece_table_line_begin(pt, line);
+  const int end =
+      line == pt->nlines ? pt->len : piece_table_line_begin(pt, line + 1) - 1;
+  return end - begin;
+}
+
+// the line that byte `ix` of the subtree `n` is on.
+int piece_tree_line_of(const PieceTable *pt, const PieceNode *n, int ix) {
+  assert(ix >= 0 && ix <= piece_node_len(n));
+  int line = 0;
+  while (n) {
+    const int llen = piece_node_len(n->l);
+    if (ix < llen) {
+      n = n->l;
+      continue;
+    }
+    ix -= llen;
+    line += piece_node_nlines(n->l);
+    if (ix < n->piece.len) {
+      return line + count_newlines(piece_table_span(pt, n->piece), ix);
+    }
+    ix -= n->piece.len;
+    line += n->piece.nlines;
+    n = n->r;
+  }
+  return line;
+}
+
+// the line that byte `ix` is on, ie. the number of '\n' in [0, ix).
+int piece_table_line_of(const PieceTable *pt, int ix) {
+  return piece_tree_line_of(pt, pt->root, ix);
+}
+
+// append the pieces of `n` to `out`, in order.
+void piece_tree_pieces(const PieceNode *n, std::vector<Piece> *out) {
+  if (!n) {
+    return;
+  }
+  piece_tree_pieces(n->l, out);
+  out->push_back(n->piece);
+  piece_tree_pieces(n->r, out);
+}
+
+// the number of bytes at the start and at the end that the texts `a` and `b`
+// have in common, as far as their pieces tell: runs of the same bytes of the
+// same buffer, however they are cut into pieces. `pre + suf` is at most the
+// length of either.
+void piece_tree_common(const PieceNode *a, const PieceNode *b, int *pre,
+                       int *suf) {
+  std::vector<Piece> pa, pb;
+  piece_tree_pieces(a, &pa);
+  piece_tree_pieces(b, &pb);
+  // bytes in common walking from the front, or from the back.
+  auto common = [&](bool back) {
+    const int na = pa.size(), nb = pb.size();
+    int n = 0;
+    // the next piece of each, and how far into it we are.
+    int i = 0, j = 0, io = 0, jo = 0;
+    while (i < na && j < nb) {
+      const Piece &x = pa[back ? na - 1 - i : i];
+      const Piece &y = pb[back ? nb - 1 - j : j];
+      const int xpos = back ? x.start + x.len - io : x.start + io;
+      const int ypos = back ? y.start + y.len - jo : y.start + jo;
+      if (x.add != y.add || xpos != ypos) {
+        break;
+      }
+      const int k = std::min<int>(x.len - io, y.len - jo);
+      n += k;
+      io += k;
+      jo += k;
+      if (io == x.len) {
+        i++;
+        io = 0;
+      }
+      if (jo == y.len) {
+        j++;
+        jo = 0;
+      }
+    }
+    return n;
+  };
+  *pre = common(false);
+  *suf = std::min<int>(common(true),
+                       std::min<int>(piece_node_len(a), piece_node_len(b)) -
+                           *pre);
+}
+
+// ===UTF-8===
+// Text is UTF-8. Columns on screen are counted in characters, a character
+// being a code point followed by any zero width ones (combining marks, joiners,
+// variation selectors), and East Asian wide characters take two columns.
+// Bytes that are not valid UTF-8 decode to U+FFFD, one column per byte.
+// Lines that are used on screen keep a `LineColumns`, which records the
+// column of one character per UTF8_CHUNK_LEN bytes, so a byte <-> column
+// lookup decodes at most one chunk. ASCII lines, found a vector at a time,
+// need no table at all.
+
+static const int UTF8_REPLACEMENT = 0xfffd;
+static const int UTF8_CHUNK_LEN = 64;
+
+// length of the longest prefix of `s` that is ASCII.
+int utf8_ascii_prefix(const char *s, int len) {
+  int i = 0;
+#ifdef __SSE2__
+  for (; i + 16 <= len; i += 16) {
+    const __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+    const int mask = _mm_movemask_epi8(v);
+    if (mask) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+#endif
+  while (i < len && !(s[i] & 0x80)) {
+    i++;
+  }
+  return i;
+}
+
+// decode the code point at the start of `s` into `cp`, and return its length
+// in bytes. A byte that does not begin a valid sequence decodes to
+// UTF8_REPLACEMENT, with length 1.
+int utf8_decode(const char *s, int len, int *cp) {
+  assert(len > 0);
+  const unsigned char c = s[0];
+  if (c < 0x80) {
+    *cp = c;
+    return 1;
+  }
+  int n, min, v;
+  if ((c & 0xe0) == 0xc0) {
+    n = 2, min = 0x80, v = c & 0x1f;
+  } else if ((c & 0xf0) == 0xe0) {
+    n = 3, min = 0x800, v = c & 0x0f;
+  } else if ((c & 0xf8) == 0xf0) {
+    n = 4, min = 0x10000, v = c & 0x07;
+  } else {
+    *cp = UTF8_REPLACEMENT;
+    return 1;
+  }
+  if (n > len) {
+    *cp = UTF8_REPLACEMENT;
+    return 1;
+  }
+  for (int i = 1; i < n; ++i) {
+    if ((s[i] & 0xc0) != 0x80) {
+      *cp = UTF8_REPLACEMENT;
+      return 1;
+    }
+    v = (v << 6) | (s[i] & 0x3f);
+  }
+  // overlong encodings, surrogates, and beyond the last code point.
+  if (v < min || (v >= 0xd800 && v <= 0xdfff) || v > 0x10ffff) {
+    *cp = UTF8_REPLACEMENT;
+    return 1;
+  }
+  *cp = v;
+  return n;
+}
+
+bool utf8_valid(const char *s, int len) {
+  int i = 0;
+  while ((i += utf8_ascii_prefix(s + i, len - i)) < len) {
+    int cp;
+    const int n = utf8_decode(s + i, len - i, &cp);
+    if (cp == UTF8_REPLACEMENT && n == 1) {
+      return false;
+    }
+    i += n;
+  }
+  return true;
+}
+
+// columns taken by `cp`: 0 for marks that combine with the character before
+// them, 2 for wide characters, 1 otherwise. A rough wcwidth.
+int utf8_width(int cp) {
+  if (cp < 0x300) {
+    return 1;
+  }
+  if ((cp >= 0x300 && cp <= 0x36f) || (cp >= 0x1ab0 && cp <= 0x1aff) ||
+      (cp >= 0x1dc0 && cp <= 0x1dff) || (cp >= 0x200b && cp <= 0x200d) ||
+      (cp >= 0x20d0 && cp <= 0x20ff) || (cp >= 0xfe00 && cp <= 0xfe0f) ||
+      (cp >= 0xfe20 && cp <= 0xfe2f) || (cp >= 0xe0100 && cp <= 0xe01ef)) {
+    return 0;
+  }
+  if ((cp >= 0x1100 && cp <= 0x115f) || (cp >= 0x2e80 && cp <= 0xa4cf) ||
+      (cp >= 0xac00 && cp <= 0xd7a3) || (cp >= 0xf900 && cp <= 0xfaff) ||
+      (cp >= 0xfe30 && cp <= 0xfe4f) || (cp >= 0xff00 && cp <= 0xff60) ||
+      (cp >= 0xffe0 && cp <= 0xffe6) || (cp >= 0x1f300 && cp <= 0x1f64f) ||
+      (cp >= 0x1f900 && cp <= 0x1f9ff) || (cp >= 0x20000 && cp <= 0x3fffd)) {
+    return 2;
+  }
+  return 1;
+}
+
+// length in bytes of the character at the start of `s`, and its columns.
+int utf8_char(const char *s, int len, int *width) {
+  int cp;
+  int n = utf8_decode(s, len, &cp);
+  // a mark with nothing to combine with stands on its own.
+  *width = std::max<int>(1, utf8_width(cp));
+  while (n < len && (s[n] & 0x80)) {
+    const int k = utf8_decode(s + n, len - n, &cp);
+    if (utf8_width(cp) != 0) {
+      break;
+    }
+    n += k;
+  }
+  return n;
+}
+
+// the columns of a line.
+struct LineColumns {
+  std::string text;
+  int gen = -1; // `GapBuffer::gen` if this is the active line, -1 otherwise.
+  bool ascii = true; // every byte is a column, and the chunks are empty.
+  int ncols = 0;
+  // chunk_byte[k] is the first character at or after byte k * UTF8_CHUNK_LEN,
+  // chunk_col[k] is its column.
+  std::vector<int> chunk_byte;
+  std::vector<int> chunk_col;
+};
+
+void line_columns_build(LineColumns *lc, std::string text) {
+  lc->text = std::move(text);
+  lc->chunk_byte.clear();
+  lc->chunk_col.clear();
+  const char *s = lc->text.data();
+  const int len = lc->text.size();
+  lc->ascii = utf8_ascii_prefix(s, len) == len;
+  if (lc->ascii) {
+    lc->ncols = len;
+    return;
+  }
+  int col = 0;
+  for (int ix = 0; ix < len;) {
+    while ((int)lc->chunk_byte.size() * UTF8_CHUNK_LEN <= ix) {
+      lc->chunk_byte.push_back(ix);
+      lc->chunk_col.push_back(col);
+    }
+    int w;
+    ix += utf8_char(s + ix, len - ix, &w);
+    col += w;
+  }
+  lc->ncols = col;
+}
+
+// the chunk to start decoding from to reach byte `ix`.
+int line_columns_chunk(const LineColumns *lc, int ix) {
+  int k = std::min<int>(ix / UTF8_CHUNK_LEN, lc->chunk_byte.size() - 1);
+  while (k > 0 && lc->chunk_byte[k] > ix) {
+    k--;
+  }
+  return k;
+}
+
+// the column of the character that byte `ix` is in. `ix` may be the length
+// of the line.
+int line_columns_col(const LineColumns *lc, int ix) {
+  const int len = lc->text.size();
+  assert(ix >= 0 && ix <= len);
+  if (lc->ascii) {
+    return ix;
+  }
+  if (ix == len) {
+    return lc->ncols;
+  }
+  const int k = line_columns_chunk(lc, ix);
+  int b = lc->chunk_byte[k];
+  int col = lc->chunk_col[k];
+  while (true) {
+    int w;
+    const int n = utf8_char(lc->text.data() + b, len - b, &w);
+    if (ix < b + n) {
+      return col;
+    }
+    b += n;
+    col += w;
+  }
+}
+
+// the first byte of the character at column `col`, or of the one after it if
+// `col` is in the middle of a wide character. Columns past the end of the
+// line give its length.
+int line_columns_ix(const LineColumns *lc, int col) {
+  const int len = lc->text.size();
+  if (col >= lc->ncols) {
+    return len;
+  }
+  if (lc->ascii) {
+    return std::max<int>(0, col);
+  }
+  const int k = std::upper_bound(lc->chunk_col.begin(), lc->chunk_col.end(),
+                                 col) -
+                lc->chunk_col.begin() - 1;
+  int b = lc->chunk_byte[std::max<int>(0, k)];
+  int c = lc->chunk_col[std::max<int>(0, k)];
+  while (b < len && c < col) {
+    int w;
+    b += utf8_char(lc->text.data() + b, len - b, &w);
+    c += w;
+  }
+  return b;
+}
+
+// the byte after the character at `ix`.
+int line_columns_next(const LineColumns *lc, int ix) {
+  const int len = lc->text.size();
+  assert(ix >= 0 && ix < len);
+  if (lc->ascii) {
+    return ix + 1;
+  }
+  int w;
+  return ix + utf8_char(lc->text.data() + ix, len - ix, &w);
+}
+
+// the first byte of the character before `ix`.
+int line_columns_prev(const LineColumns *lc, int ix) {
+  const int len = lc->text.size();
+  assert(ix > 0 && ix <= len);
+  if (lc->ascii) {
+    return ix - 1;
+  }
+  int b = lc->chunk_byte[line_columns_chunk(lc, ix - 1)];
+  while (true) {
+    int w;
+    const int next = b + utf8_char(lc->text.data() + b, len - b, &w);
+    if (next >= ix) {
+      return b;
+    }
+    b = next;
+  }
+}
+
 // https://15721.courses.cs.cmu.edu/spring2018/papers/09-oltpindexes2/leis-icde2013.pdf
 // Ukkonen
 
@@ -43,9 +796,171 @@ struct File {
   std::string path;
   char *buf = nullptr;
   int len = 0;
+  // `buf` viewed as a rope: a piece table with no edits, whose nodes carry
+  // byte and newline counts. Built by `file_build_rope` once `buf` is filled.
+  PieceTable rope;
+  bool mapped = false; // `buf` is an mmap of `path`, see `file_map`.
+  bool owned = false;  // `buf` was read by `file_own`, and goes with `f`.
+  // open on `path` while an owned `buf` is still being read, see `file_fill`.
+  int fd = -1;
+  int filled = 0; // bytes of `buf` read so far by `file_fill`.
+  struct timespec mtime = {}; // modification time of `path` when mapped.
   File(std::string path, int len) : path(path), len(len){};
 };
 
+void file_build_rope(File *f) {
+  assert(f->buf || f->len == 0);
+  piece_table_init(&f->rope, f->buf, f->len);
+}
+
+// map the file at `path` into memory, without building its rope. The mapping
+// is private and writable: the pages are shared with the page cache until
+// they are written to, at which point the kernel copies them, so edits to
+// `buf` form a copy-on-write overlay that never reaches the disk. Returns
+// nullptr if it can't be mapped.
+File *file_map(const std::string &path) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size > INT_MAX) {
+    close(fd);
+    return nullptr;
+  }
+
+  File *f = new File(path, st.st_size);
+  f->mtime = st.st_mtim;
+  if (f->len > 0) {
+    void *p =
+        mmap(nullptr, f->len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      close(fd);
+      delete f;
+      return nullptr;
+    }
+    f->buf = (char *)p;
+    f->mapped = true;
+    // a freshly mapped file is read front to back, by the rope and indexer.
+    madvise(f->buf, f->len, MADV_SEQUENTIAL);
+  }
+  close(fd);
+  return f;
+}
+
+void file_advise(File *f, int advice) {
+  if (f->mapped) {
+    madvise(f->buf, f->len, advice);
+  }
+}
+
+// read the text of `f` into a buffer of its own, in place of its mapping,
+// before its rope is built. This holds if the file is truncated, which drops
+// even the copied pages of a private mapping. The text is as long as the file
+// is now.
+void file_own(File *f) {
+  assert(!f->rope.root);
+  if (!f->mapped) {
+    return;
+  }
+  char *buf = new char[f->len];
+  int n = 0;
+  const int fd = open(f->path.c_str(), O_RDONLY);
+  if (fd >= 0) {
+    ssize_t r;
+    while (n < f->len && (r = pread(fd, buf + n, f->len - n, n)) > 0) {
+      n += r;
+    }
+    close(fd);
+  }
+  munmap(f->buf, f->len);
+  f->buf = buf;
+  f->len = n;
+  f->mapped = false;
+  f->owned = true;
+}
+
+// like `file_own`, but the text is read as it is needed by `file_fill`,
+// rather than all at once; the buffer is not touched until it is filled. The
+// file stays open until it is read to the end, so a file renamed over `path`
+// meanwhile is not mixed in.
+void file_own_lazily(File *f) {
+  assert(!f->rope.root);
+  if (!f->mapped) {
+    return;
+  }
+  munmap(f->buf, f->len);
+  f->buf = new char[f->len];
+  f->mapped = false;
+  f->owned = true;
+  f->filled = 0;
+  f->fd = open(f->path.c_str(), O_RDONLY);
+  if (f->fd < 0) {
+    f->len = 0;
+  }
+}
+
+// read the text of a lazily owned `f` up to byte `end`. If the file was
+// truncated since, the text ends where the file does now.
+void file_fill(File *f, int end) {
+  if (f->fd < 0) {
+    return;
+  }
+  end = std::min(end, f->len);
+  ssize_t r = 1;
+  while (f->filled < end &&
+         (r = pread(f->fd, f->buf + f->filled, end - f->filled, f->filled)) >
+             0) {
+    f->filled += r;
+  }
+  if (r <= 0) {
+    f->len = f->filled;
+  }
+  if (f->filled == f->len) {
+    close(f->fd);
+    f->fd = -1;
+  }
+}
+
+void file_unmap(File *f) {
+  piece_tree_decref(f->rope.root);
+  if (f->fd >= 0) {
+    close(f->fd);
+  }
+  if (f->mapped) {
+    munmap(f->buf, f->len);
+  } else if (f->owned) {
+    delete[] f->buf;
+  }
+  delete f;
+}
+
+// give back the text of `f`, which changed on disk, but keep `f` itself:
+// the index may still point to it, see `task_manager_retire`.
+void file_release(File *f) {
+  piece_tree_decref(f->rope.root);
+  f->rope = PieceTable();
+  if (f->fd >= 0) {
+    close(f->fd);
+    f->fd = -1;
+  }
+  if (f->mapped) {
+    munmap(f->buf, f->len);
+  } else if (f->owned) {
+    delete[] f->buf;
+  }
+  f->buf = nullptr;
+  f->len = 0;
+  f->mapped = false;
+  f->owned = false;
+}
+
+// whether `f` looks like a binary rather than text: as git has it, there is
+// a NUL among its first 8000 bytes.
+bool file_is_binary(const File *f) {
+  return f->len > 0 && memchr(f->buf, 0, std::min(f->len, 8000)) != nullptr;
+}
+
 using hash = long long;
 
 bool is_newline(char c) { return c == '\r' || c == '\n'; }
@@ -58,7 +973,7 @@ struct Loc {
   File *file = nullptr;
   int ix = -1; // Loc points at file->buf[ix]
   int line = -1;
-  int col = -1;
+  int col = -1; // in bytes. Columns on screen come from `LineColumns`.
 
   Loc() {}
   // TODO: don't store the string.
@@ -122,6 +1037,19 @@ struct Loc {
     }
   }
 
+  // Loc at byte `ix` of `file`, with line and column found through the rope.
+  static Loc at(File *file, int ix) {
+    assert(ix >= 0 && ix <= file->len);
+    const int line = piece_table_line_of(&file->rope, ix);
+    const int col = ix - piece_table_line_begin(&file->rope, line);
+    return Loc(file, ix, line, col);
+  }
+
+  // Loc at the beginning of `line`. We must have 0 <= line <= #newlines.
+  static Loc at_line(File *file, int line) {
+    return Loc(file, piece_table_line_begin(&file->rope, line), line, 0);
+  }
+
   // vv NOTE: retreat() checks its correctness in terms of advance()
   // because advance() is the much simpler primitive.
   Loc retreat() const {
@@ -133,19 +1061,12 @@ struct Loc {
 
     // we need to move up a line
     if (l.col == 0) {
-      const char c = l.file->buf[l.ix - 1];
-      const char b = (l.ix - 2 >= 0) ? l.file->buf[l.ix - 2] : 0;
-      assert(c == '\n');
-      l.ix -= (b == '\r') ? 2 : 1;
+      assert(l.file->buf[l.ix - 1] == '\n');
+      l.ix -= 1;
       l.line -= 1;
-
-      // we now need to fnd our new column.
-      // col tells us how far back you need to go, to find a newline.
-      l.col = 0;
-      while (l.ix - l.col > 0 && !is_newline(l.file->buf[l.ix - l.col - 1])) {
-        l.col++;
-      }
-
+      // we now need to fnd our new column. The rope knows where the
+      // previous line began.
+      l.col = l.ix - piece_table_line_begin(&l.file->rope, l.line);
       assert(l.advance() == *this);
       assert(l.valid());
       return l;
@@ -169,20 +1090,29 @@ struct Loc {
 
   Loc start_of_next_line() const {
     assert(valid());
-    Loc l = *this;
-    while (!l.eof() && this->line == l.line) {
-      l = l.advance();
+    if (line == file->rope.nlines) {
+      // last line, the next line begins at EOF.
+      Loc l = Loc(file, file->len, line, col + (file->len - ix));
+      assert(l.valid());
+      return l;
     }
+    Loc l = Loc::at_line(file, line + 1);
     assert(l.valid());
     return l;
   }
 
+  // the newline (or "\r\n") that ends the current line, or EOF.
   Loc end_of_cur_line() const {
     assert(valid());
-    Loc l = *this;
-    while (!l.eof() && !is_newline(l.get())) {
-      l = l.advance();
+    Loc l = start_of_next_line();
+    int end = l.ix;
+    if (l.line != line) {
+      end--; // step back over '\n'.
+      if (end > ix && file->buf[end - 1] == '\r') {
+        end--;
+      }
     }
+    l = Loc(file, end, line, col + (end - ix));
     assert(l.valid());
     return l;
   }
@@ -199,8 +1129,7 @@ struct Loc {
   // TODO: ask @codelegend for refactoring.
   Loc down() const {
     assert(valid());
-    Loc l = this->end_of_cur_line();
-    l = l.advance();
+    Loc l = this->start_of_next_line();
     assert(l.valid());
     return l;
   }
@@ -255,7 +1184,7 @@ void index_add(TrieNode *index, File *f, int ix, int totlen, Loc data) {
 
   int matchlen = 0;
   while (matchlen < totlen && matchlen < e.len &&
-         f->buf[ix] == e.f->buf[e.ix + matchlen]) {
+         f->buf[ix + matchlen] == e.f->buf[e.ix + matchlen]) {
     matchlen++;
   }
 
@@ -272,7 +1201,6 @@ void index_add(TrieNode *index, File *f, int ix, int totlen, Loc data) {
   // we need to split.
   assert(matchlen < e.len);
   TrieNode *leaf = new TrieNode();
-  leaf->data.push_back(data);
 
   // [OLD] index ---ctip:e ---> rest
   // [NEW] index --ctip:e--> cur_leaf --crest:erest --> rest
@@ -287,7 +1215,9 @@ void index_add(TrieNode *index, File *f, int ix, int totlen, Loc data) {
   // (1) index ---ctip:e ---> leaf
   index->adj[ctip].len = matchlen;
   index->adj[ctip].node = leaf;
-  return;
+
+  // (3) the rest of the key hangs off of cur_leaf.
+  return index_add(leaf, f, ix + matchlen, totlen - matchlen, data);
 };
 
 const TrieNode *index_lookup(const TrieNode *index, const char *key, int len) {
@@ -312,6 +1242,11 @@ const TrieNode *index_lookup(const TrieNode *index, const char *key, int len) {
     i++;
   }
 
+  if (i == len) {
+    // the key ends on this edge, so everything below it matches.
+    return e.node;
+  }
+
   if (i < e.len) {
     // we haven't reached a node. quit.
     return nullptr;
@@ -324,842 +1259,6288 @@ const TrieNode *index_lookup(const TrieNode *index, const char *key, int len) {
   return index_lookup(e.node, key, len);
 }
 
-enum {
-  KEY_SHIFT = (1 << 0),
-  KEY_CTRL = (1 << 1),
-  KEY_ALT = (1 << 2),
-  KEY_BACKSPACE = (1 << 3),
-  KEY_RETURN = (1 << 4),
-  KEY_LEFTARROW = (1 << 5),
-  KEY_RIGHTARROW = (1 << 6),
-  KEY_UPARROW = (1 << 7),
-  KEY_DOWNARROW = (1 << 8),
-  KEY_COMMAND_PALETTE = (1 << 9),
-  KEY_TAB = (1 << 10),
-  KEY_D = (1 << 11),
-  KEY_U = (1 << 12),
-  KEY_H = (1 << 13),
-  KEY_J = (1 << 14),
-  KEY_K = (1 << 15),
-  KEY_L = (1 << 16),
-  KEY_C = (1 << 17),
-  KEY_A = (1 << 18),
-  KEY_E = (1 << 19),
-  KEY_I = (1 << 20),
+// how much of the workspace is indexed, and in how much memory.
+struct IndexPolicy {
+  // the longest suffix that is indexed, in bytes and in words.
+  int max_suffix_len = 80;
+  int max_ngrams = 3;
+  // bytes the index may take, see `index_policy_tier`.
+  long long budget = LLONG_MAX;
 };
 
-struct EventState {
-  int key_pressed;   // true if key was pressed this frame. reset each frame.
-  int key_held_down; // true if key was held down.
-  char input_text[32];
-
-  EventState() {
-    this->key_pressed = 0;
-    this->key_held_down = 0;
-    this->input_text[0] = 0;
+// the end of the chunk of text that is indexed from `begin` on: at most
+// `max_ngrams` words and `max_suffix_len` bytes, within the line. Every
+// suffix of the chunk goes into the index.
+Loc index_chunk_end(Loc begin, const IndexPolicy *p) {
+  Loc eol = begin;
+  int ngrams = 0;
+  while (!eol.eof() && !is_newline(eol.get()) && ngrams < p->max_ngrams &&
+         (eol.ix - begin.ix) <= p->max_suffix_len) {
+    if (is_whitespace(eol.get())) {
+      ngrams++;
+    }
+    eol = eol.advance();
   }
+  return eol;
+}
 
-  void start_frame() {
-    this->key_pressed = 0;
-    this->input_text[0] = 0;
+// call `add(loc, len)` on every suffix that the indexer adds for `f`.
+template <typename F>
+void index_for_each_suffix(File *f, const IndexPolicy *p, F add) {
+  Loc l(f, 0, 0, 0);
+  while (true) {
+    while (!l.eof() && is_whitespace(l.get())) {
+      l = l.advance();
+    }
+    if (l.eof()) {
+      return;
+    }
+    const Loc eol = index_chunk_end(l, p);
+    for (Loc suf = l; suf.ix < eol.ix; suf = suf.advance()) {
+      add(suf, eol.ix - suf.ix);
+    }
+    l = eol;
   }
+}
 
-  void set_keydown(int key) {
-    this->key_pressed |= key;
-    this->key_held_down |= key;
+// LEB128: 7 bits a byte, low bits first, the top bit set on all but the
+// last byte.
+void varint_push(std::vector<uint8_t> *out, uint32_t v) {
+  while (v >= 0x80) {
+    out->push_back(v | 0x80);
+    v >>= 7;
   }
+  out->push_back(v);
+}
 
-  void set_keyup(int key) { this->key_held_down &= ~key; }
+uint32_t varint_read(const uint8_t **p) {
+  uint32_t v = 0;
+  for (int shift = 0;; shift += 7) {
+    const uint8_t b = *(*p)++;
+    v |= (uint32_t)(b & 0x7f) << shift;
+    if (!(b & 0x80)) {
+      return v;
+    }
+  }
+}
 
-  void set_input_text(const char *text) {
-    printf("text: |%s|\n", text);
-    int len = strlen(input_text);
-    int size = strlen(text) + 1;
-    assert(len + size <= (int)sizeof(input_text));
-    memcpy(input_text + len, text, size);
+// like `varint_read`, for bytes that may be garbage: fails rather than read
+// from `end` on, or a value of more than 32 bits.
+bool varint_read_checked(const uint8_t **p, const uint8_t *end,
+                         uint32_t *out) {
+  uint64_t v = 0;
+  for (int shift = 0; shift < 35 && *p < end; shift += 7) {
+    const uint8_t b = *(*p)++;
+    v |= (uint64_t)(b & 0x7f) << shift;
+    if (!(b & 0x80)) {
+      *out = v;
+      return v <= UINT32_MAX;
+    }
   }
+  return false;
+}
+
+// ===ART===
+// An adaptive radix tree (Leis et al., linked above) over the same suffixes
+// as `TrieNode`. Edges are path compressed into spans of the indexed files,
+// as with `TrieEdge`, and each node has room for 4, 16, 48 or 256 children,
+// growing to the next size when it fills up. Nodes live in one vector per
+// size and refer to each other by 32 bit `ArtRef`s rather than pointers, and
+// the suffixes that end at a node are a linked list in another vector, so
+// the whole trie is a handful of allocations. A trie that is done growing
+// can be frozen by `art_freeze` into about half the memory.
+
+// the size of a node in the top 3 bits, its index in the vector of that size
+// in the rest. Leaves, which have no children, only occur in frozen tries.
+typedef uint32_t ArtRef;
+static const ArtRef ART_NULL = UINT32_MAX;
+enum ArtKind {
+  ART_NODE4 = 0,
+  ART_NODE16 = 1,
+  ART_NODE48 = 2,
+  ART_NODE256 = 3,
+  ART_LEAF = 4
 };
 
-// TODO: rename to viewer.
-static const int MAXLINELEN = 120;
-static const int MAXLINES = 1e6;
+ArtRef art_ref(ArtKind kind, int ix) { return ((ArtRef)kind << 29) | ix; }
+ArtKind art_kind(ArtRef r) { return (ArtKind)(r >> 29); }
+int art_ix(ArtRef r) { return r & ((1u << 29) - 1); }
 
-struct Cursor {
-  int line = 0;
-  int col = 0;
+struct ArtHeader {
+  // the edge into this node is [ix, ix + len) of `ArtTrie::files[file]`.
+  int file = -1;
+  int ix = 0;
+  int len = 0;
+  // head of the list of suffixes ending here, or -1. Once the trie is
+  // frozen, the offset of their block in `ArtTrie::postings` instead.
+  int suffixes = -1;
+  int nchildren = 0;
 };
 
-// editor mode
-enum EditMode { Insert, Normal, Visual };
+struct ArtNode4 {
+  ArtHeader h;
+  uint8_t keys[4];
+  ArtRef children[4];
+};
 
-// the state of the editor is a geodesic?
-struct EditorState {
-  EditMode mode = Normal;
-  char text[MAXLINES][MAXLINELEN];
-  int linelen[MAXLINES];
-  EditorState() {
-    for (int line = 0; line < MAXLINES; ++line) {
-      linelen[line] = 0;
-      for (int col = 0; col < MAXLINELEN; ++col) {
-        text[line][col] = 0;
-      }
-    }
-  }
+struct ArtNode16 {
+  ArtHeader h;
+  uint8_t keys[16];
+  ArtRef children[16];
 };
 
-Cursor cursor_up(EditorState *editor, Cursor cursor) {
-  cursor.line = std::max<int>(0, cursor.line - 1);
-  cursor.col = std::min<int>(editor->linelen[cursor.line], cursor.col);
-  return cursor;
+struct ArtNode48 {
+  ArtHeader h;
+  uint8_t slots[256]; // 1 + the slot in `children` of each key, or 0.
+  ArtRef children[48];
 };
 
-Cursor cursor_down(EditorState *editor, Cursor cursor) {
-  cursor.line = std::min<int>(MAXLINES - 1, cursor.line + 1);
-  cursor.col = std::min<int>(editor->linelen[cursor.line], cursor.col);
-  return cursor;
+struct ArtNode256 {
+  ArtHeader h;
+  ArtRef children[256]; // ART_NULL for no child.
 };
 
-Cursor cursor_dollar(EditorState *editor, Cursor cursor) {
-  cursor.col = editor->linelen[cursor.line];
-  return cursor;
-}
+struct ArtLeaf {
+  ArtHeader h;
+};
 
-Cursor cursor_hat(EditorState *editor, Cursor cursor) {
-  cursor.col = 0;
-  return cursor;
+// a suffix that starts at byte `ix` of `ArtTrie::files[file]`.
+struct ArtSuffix {
+  int file = -1;
+  int ix = 0;
+  int next = -1;
 };
 
-// insert code into editor at cursor, and move cursor by string length.
-// TODO: refactor in terms of editor commands
-Cursor cursor_insert_str(EditorState *editor, Cursor cursor, const char *buf,
-                         int len) {
-  int *linelen = &editor->linelen[cursor.line];
-  char *line = editor->text[cursor.line];
+struct ArtTrie {
+  std::vector<ArtNode4> n4;
+  std::vector<ArtNode16> n16;
+  std::vector<ArtNode48> n48;
+  std::vector<ArtNode256> n256;
+  std::vector<ArtLeaf> leaves;
+  // nodes that were grown out of, for reuse.
+  std::vector<int> free[4];
+  std::vector<ArtSuffix> suffixes;
+  std::vector<File *> files;
+  ArtRef root = ART_NULL;
+  int nsuffixes = 0;
+  // a frozen trie, see `art_freeze`, holds its suffixes in `postings`, and
+  // can no longer be added to.
+  bool frozen = false;
+  std::vector<uint8_t> postings;
+};
+
+ArtHeader *art_header(ArtTrie *t, ArtRef r) {
+  switch (art_kind(r)) {
+  case ART_NODE4:
+    return &t->n4[art_ix(r)].h;
+  case ART_NODE16:
+    return &t->n16[art_ix(r)].h;
+  case ART_NODE48:
+    return &t->n48[art_ix(r)].h;
+  case ART_NODE256:
+    return &t->n256[art_ix(r)].h;
+  case ART_LEAF:
+    return &t->leaves[art_ix(r)].h;
+  }
+  assert(false && "unknown node kind");
+  return nullptr;
+}
+
+const ArtHeader *art_header(const ArtTrie *t, ArtRef r) {
+  return art_header(const_cast<ArtTrie *>(t), r);
+}
+
+template <typename T>
+ArtRef art_alloc(std::vector<T> *nodes, std::vector<int> *free, ArtKind kind) {
+  int ix;
+  if (!free->empty()) {
+    ix = free->back();
+    free->pop_back();
+    (*nodes)[ix] = T();
+  } else {
+    ix = nodes->size();
+    nodes->push_back(T());
+  }
+  return art_ref(kind, ix);
+}
 
-  // printf("insert str %d:%d(%s)| old: %s:%d\n", editor->cursor.line,
-  // editor->cursor.col,
+// a new node of `kind`, with no children.
+ArtRef art_new(ArtTrie *t, ArtKind kind, const ArtHeader &h) {
+  ArtRef r = ART_NULL;
+  switch (kind) {
+  case ART_NODE4:
+    r = art_alloc(&t->n4, &t->free[kind], kind);
+    break;
+  case ART_NODE16:
+    r = art_alloc(&t->n16, &t->free[kind], kind);
+    break;
+  case ART_NODE48:
+    r = art_alloc(&t->n48, &t->free[kind], kind);
+    memset(t->n48[art_ix(r)].slots, 0, 256);
+    break;
+  case ART_NODE256:
+    r = art_alloc(&t->n256, &t->free[kind], kind);
+    std::fill_n(t->n256[art_ix(r)].children, 256, ART_NULL);
+    break;
+  case ART_LEAF:
+    assert(false && "leaves are only made by art_freeze");
+  }
+  ArtHeader *nh = art_header(t, r);
+  *nh = h;
+  nh->nchildren = 0;
+  return r;
+}
 
-  if (*linelen == MAXLINELEN) {
-    assert(false && "unhandled line break");
+// the child of `r` along `c`, or nullptr. Valid until the next allocation.
+ArtRef *art_child(ArtTrie *t, ArtRef r, uint8_t c) {
+  switch (art_kind(r)) {
+  case ART_NODE4: {
+    ArtNode4 *n = &t->n4[art_ix(r)];
+    for (int i = 0; i < n->h.nchildren; ++i) {
+      if (n->keys[i] == c) {
+        return &n->children[i];
+      }
+    }
+    return nullptr;
+  }
+  case ART_NODE16: {
+    ArtNode16 *n = &t->n16[art_ix(r)];
+#ifdef __SSE2__
+    const __m128i eq = _mm_cmpeq_epi8(
+        _mm_set1_epi8(c), _mm_loadu_si128((const __m128i *)n->keys));
+    const int mask = _mm_movemask_epi8(eq) & ((1 << n->h.nchildren) - 1);
+    return mask ? &n->children[__builtin_ctz(mask)] : nullptr;
+#else
+    for (int i = 0; i < n->h.nchildren; ++i) {
+      if (n->keys[i] == c) {
+        return &n->children[i];
+      }
+    }
+    return nullptr;
+#endif
   }
-  assert(*linelen < MAXLINELEN);
-  const int cur_begin = cursor.col;
-  const int new_begin = cur_begin + len;
-  const int movelen = *linelen - cur_begin;
-  for (int i = movelen - 1; i >= 0; i--) {
-    line[new_begin + i] = line[cur_begin + i];
+  case ART_NODE48: {
+    ArtNode48 *n = &t->n48[art_ix(r)];
+    return n->slots[c] ? &n->children[n->slots[c] - 1] : nullptr;
   }
-  for (int i = 0; i < len; ++i) {
-    line[cur_begin + i] = buf[i];
+  case ART_NODE256: {
+    ArtNode256 *n = &t->n256[art_ix(r)];
+    return n->children[c] != ART_NULL ? &n->children[c] : nullptr;
   }
-  *linelen += len;
-  cursor.col += len;
-  return cursor;
+  case ART_LEAF:
+    return nullptr;
+  }
+  return nullptr;
 }
 
-// TOOD: refactor in terms of editor commands.
-Cursor cursor_delete_till_end_of_line(EditorState *editor, Cursor cursor) {
-  // clear text.
-  for (int i = cursor.col; i < editor->linelen[cursor.line]; ++i) {
-    editor->text[cursor.line][i] = 0;
+const ArtRef *art_child(const ArtTrie *t, ArtRef r, uint8_t c) {
+  return art_child(const_cast<ArtTrie *>(t), r, c);
+}
+
+// call `f(key, child)` on every child of `r`.
+template <typename F> void art_for_each_child(const ArtTrie *t, ArtRef r, F f) {
+  switch (art_kind(r)) {
+  case ART_NODE4: {
+    const ArtNode4 &n = t->n4[art_ix(r)];
+    for (int i = 0; i < n.h.nchildren; ++i) {
+      f(n.keys[i], n.children[i]);
+    }
+    return;
+  }
+  case ART_NODE16: {
+    const ArtNode16 &n = t->n16[art_ix(r)];
+    for (int i = 0; i < n.h.nchildren; ++i) {
+      f(n.keys[i], n.children[i]);
+    }
+    return;
+  }
+  case ART_NODE48: {
+    const ArtNode48 &n = t->n48[art_ix(r)];
+    for (int c = 0; c < 256; ++c) {
+      if (n.slots[c]) {
+        f((uint8_t)c, n.children[n.slots[c] - 1]);
+      }
+    }
+    return;
+  }
+  case ART_NODE256: {
+    const ArtNode256 &n = t->n256[art_ix(r)];
+    for (int c = 0; c < 256; ++c) {
+      if (n.children[c] != ART_NULL) {
+        f((uint8_t)c, n.children[c]);
+      }
+    }
+    return;
+  }
+  case ART_LEAF:
+    return;
   }
-  // adjust line length
-  editor->linelen[cursor.line] = cursor.col;
-  return cursor;
 }
 
-// TODO: refactor in terms of editor commands
-Cursor cursor_delete_backward(EditorState *editor, Cursor cursor, int n) {
-  assert(n >= 0);
-  const int begin = std::max<int>(0, cursor.col - n);
-  for (int i = begin; i < editor->linelen[cursor.line] - n; ++i) {
-    editor->text[cursor.line][i] = editor->text[cursor.line][n + i];
+// add `child` along `c` to `r`, which must not have a child along `c`.
+// Returns `r`, or the larger node that replaces it if `r` was full.
+ArtRef art_add_child(ArtTrie *t, ArtRef r, uint8_t c, ArtRef child) {
+  static const int CAPACITY[4] = {4, 16, 48, 256};
+  const ArtKind kind = art_kind(r);
+  if (art_header(t, r)->nchildren == CAPACITY[kind]) {
+    assert(kind != ART_NODE256);
+    const ArtRef grown = art_new(t, (ArtKind)(kind + 1), *art_header(t, r));
+    art_for_each_child(t, r, [&](uint8_t k, ArtRef ch) {
+      art_add_child(t, grown, k, ch);
+    });
+    t->free[kind].push_back(art_ix(r));
+    r = grown;
+  }
+
+  ArtHeader *h = art_header(t, r);
+  switch (art_kind(r)) {
+  case ART_NODE4: {
+    ArtNode4 *n = &t->n4[art_ix(r)];
+    n->keys[h->nchildren] = c;
+    n->children[h->nchildren] = child;
+    break;
+  }
+  case ART_NODE16: {
+    ArtNode16 *n = &t->n16[art_ix(r)];
+    n->keys[h->nchildren] = c;
+    n->children[h->nchildren] = child;
+    break;
   }
-  for (int i = editor->linelen[cursor.line] - n;
-       i < editor->linelen[cursor.line]; ++i) {
-    editor->text[cursor.line][i] = 0;
+  case ART_NODE48: {
+    ArtNode48 *n = &t->n48[art_ix(r)];
+    n->children[h->nchildren] = child;
+    n->slots[c] = h->nchildren + 1;
+    break;
   }
+  case ART_NODE256:
+    t->n256[art_ix(r)].children[c] = child;
+    break;
+  case ART_LEAF:
+    assert(false && "frozen tries are not added to");
+  }
+  h->nchildren++;
+  return r;
+}
 
-  editor->linelen[cursor.line] -= n;
-  cursor.col -= n;
-  return cursor;
+// the id of `f` in `t`. Files are indexed one after another, so it is
+// usually the last one.
+int art_file_id(ArtTrie *t, File *f) {
+  if (t->files.empty() || t->files.back() != f) {
+    t->files.push_back(f);
+  }
+  return t->files.size() - 1;
 }
 
-// splice s of len `len` into line `l` beginning at col `col`. We must have
-// 0 <= col <= editor->lineline[line].
-void editor_splice_into_line(EditorState *editor, int line, int col, char *s,
-                             int len) {
-  assert(col >= 0);
-  assert(col <= editor->linelen[line]);
+// add the suffix [ix, ix + len) of `f`.
+void art_add(ArtTrie *t, File *f, int ix, int len) {
+  assert(!t->frozen);
+  assert(ix >= 0 && len >= 0 && ix + len <= f->len);
+  const int file = art_file_id(t, f);
+  const int begin = ix;
+  if (t->root == ART_NULL) {
+    t->root = art_new(t, ART_NODE4, ArtHeader());
+  }
+  // `parent` has `node` as its child along `pc`, or `node` is the root.
+  ArtRef parent = ART_NULL;
+  uint8_t pc = 0;
+  ArtRef node = t->root;
+  while (len > 0) {
+    const uint8_t c = f->buf[ix];
+    const ArtRef *slot = art_child(t, node, c);
+    if (!slot) {
+      ArtHeader h;
+      h.file = file;
+      h.ix = ix;
+      h.len = len;
+      const ArtRef leaf = art_new(t, ART_NODE4, h);
+      const ArtRef grown = art_add_child(t, node, c, leaf);
+      if (grown != node) {
+        if (parent == ART_NULL) {
+          t->root = grown;
+        } else {
+          *art_child(t, parent, pc) = grown;
+        }
+      }
+      node = leaf;
+      len = 0;
+      break;
+    }
 
-  if (s == nullptr) {
-    assert(len == 0);
+    const ArtRef child = *slot;
+    const ArtHeader e = *art_header(t, child);
+    const char *estr = t->files[e.file]->buf + e.ix;
+    int m = 0;
+    while (m < len && m < e.len && f->buf[ix + m] == estr[m]) {
+      m++;
+    }
+    if (m < e.len) {
+      // split the edge: node --c--> mid --estr[m]--> child.
+      ArtHeader h;
+      h.file = e.file;
+      h.ix = e.ix;
+      h.len = m;
+      const ArtRef mid = art_new(t, ART_NODE4, h);
+      ArtHeader *ch = art_header(t, child);
+      ch->ix += m;
+      ch->len -= m;
+      art_add_child(t, mid, estr[m], child);
+      *art_child(t, node, c) = mid;
+      parent = node;
+      pc = c;
+      node = mid;
+    } else {
+      parent = node;
+      pc = c;
+      node = child;
+    }
+    ix += m;
+    len -= m;
   }
 
-  int *linelen = &editor->linelen[line];
-  char *linestr = editor->text[col];
+  ArtSuffix suf;
+  suf.file = file;
+  suf.ix = begin;
+  suf.next = art_header(t, node)->suffixes;
+  art_header(t, node)->suffixes = t->suffixes.size();
+  t->suffixes.push_back(suf);
+  t->nsuffixes++;
+}
 
-  if (*linelen == MAXLINELEN) {
-    assert(false && "unhandled line break");
+// write the suffixes of the list at `head` of `t` as a block of
+// `out->postings`, and return its offset, or -1 for none. A block is the
+// number of suffixes, then for each in order of file and offset, the file id
+// less the last one, and the offset less the last one if the file is the
+// same, as varints: ~3 bytes a suffix rather than the 12 of an `ArtSuffix`.
+int art_freeze_suffixes(const ArtTrie *t, int head, ArtTrie *out) {
+  if (head == -1) {
+    return -1;
   }
-  assert(*linelen < MAXLINELEN);
-  const int cur_begin = col;
-  const int new_begin = cur_begin + len;
-  const int movelen = *linelen - cur_begin;
-  for (int i = movelen - 1; i >= 0; i--) {
-    linestr[new_begin + i] = linestr[cur_begin + i];
+  std::vector<std::pair<int, int>> sufs;
+  for (int i = head; i != -1; i = t->suffixes[i].next) {
+    sufs.push_back({t->suffixes[i].file, t->suffixes[i].ix});
   }
-  for (int i = 0; i < len; ++i) {
-    linestr[cur_begin + i] = s[i];
+  std::sort(sufs.begin(), sufs.end());
+  const int offset = out->postings.size();
+  varint_push(&out->postings, sufs.size());
+  int file = 0, ix = 0;
+  for (const auto &[f, i] : sufs) {
+    varint_push(&out->postings, f - file);
+    varint_push(&out->postings, f == file ? i - ix : i);
+    file = f;
+    ix = i;
   }
-  *linelen += len;
+  return offset;
 }
 
-// TODO: rewrite in terms of editor_splice_into_line.
-void editor_append_line(EditorState *editor, int line, char *s, int len) {
-  if (s == nullptr) {
-    assert(len == 0);
+// copy the node `r` of `t`, and everything below it, into `out`.
+ArtRef art_freeze_node(const ArtTrie *t, ArtRef r, ArtTrie *out) {
+  ArtHeader h = *art_header(t, r);
+  h.suffixes = art_freeze_suffixes(t, h.suffixes, out);
+  if (h.nchildren == 0) {
+    out->leaves.push_back({h});
+    return art_ref(ART_LEAF, out->leaves.size() - 1);
   }
+  // a node only grows once it is full, so the children fit the same kind.
+  const ArtRef copy = art_new(out, art_kind(r), h);
+  art_for_each_child(t, r, [&](uint8_t c, ArtRef child) {
+    const ArtRef frozen = art_freeze_node(t, child, out);
+    art_add_child(out, copy, c, frozen);
+  });
+  return copy;
+}
 
-  const int oldlen = editor->linelen[line];
-  editor->linelen[line] += len;
-  for (int i = 0; i < len; ++i) {
-    editor->text[line][oldlen + i] = s[i];
+// nothing more will be added to `t`: pack it into as little memory as it
+// takes to be read. The suffixes of each node become a block of `postings`,
+// nodes without children become `ArtLeaf`s, and the nodes that were grown
+// out of are dropped.
+void art_freeze(ArtTrie *t) {
+  assert(!t->frozen);
+  ArtTrie *out = new ArtTrie();
+  if (t->root != ART_NULL) {
+    out->root = art_freeze_node(t, t->root, out);
   }
+  out->files = std::move(t->files);
+  out->nsuffixes = t->nsuffixes;
+  out->frozen = true;
+  out->n4.shrink_to_fit();
+  out->n16.shrink_to_fit();
+  out->n48.shrink_to_fit();
+  out->n256.shrink_to_fit();
+  out->leaves.shrink_to_fit();
+  out->postings.shrink_to_fit();
+  *t = std::move(*out);
+  delete out;
 }
 
-void editor_set_line(EditorState *editor, int line, char *s, int len) {
-  if (s == nullptr) {
-    assert(len == 0);
+// call `f(file, ix)` on every suffix that ends at `r`.
+template <typename F>
+void art_for_each_suffix(const ArtTrie *t, ArtRef r, F f) {
+  const int head = art_header(t, r)->suffixes;
+  if (head == -1) {
+    return;
   }
-
-  const int oldlen = editor->linelen[line];
-  editor->linelen[line] = len;
-  for (int i = 0; i < len; ++i) {
-    editor->text[line][i] = s[i];
+  if (!t->frozen) {
+    for (int i = head; i != -1; i = t->suffixes[i].next) {
+      f(t->suffixes[i].file, t->suffixes[i].ix);
+    }
+    return;
   }
-  for (int i = editor->linelen[line]; i < oldlen; ++i) {
-    editor->text[line][i] = 0;
+  const uint8_t *p = t->postings.data() + head;
+  const int n = varint_read(&p);
+  int file = 0, ix = 0;
+  for (int i = 0; i < n; ++i) {
+    const int dfile = varint_read(&p);
+    const int d = varint_read(&p);
+    ix = dfile ? d : ix + d;
+    file += dfile;
+    f(file, ix);
   }
 }
 
-void editor_copy_line(EditorState *editor, int destix, int srcix) {
-  editor_set_line(editor, destix, editor->text[srcix], editor->linelen[srcix]);
+// the node below which every suffix begins with `key`, or ART_NULL.
+ArtRef art_lookup(const ArtTrie *t, const char *key, int len) {
+  ArtRef node = t->root;
+  while (node != ART_NULL && len > 0) {
+    const ArtRef *slot = art_child(t, node, key[0]);
+    if (!slot) {
+      return ART_NULL;
+    }
+    const ArtHeader *e = art_header(t, *slot);
+    const char *estr = t->files[e->file]->buf + e->ix;
+    int m = 0;
+    while (m < len && m < e->len && key[m] == estr[m]) {
+      m++;
+    }
+    if (m < len && m < e->len) {
+      return ART_NULL;
+    }
+    node = *slot;
+    key += m;
+    len -= m;
+  }
+  return node;
 }
 
-void editor_remove_line(EditorState *editor, int line) {
-  for (int l = line; l < MAXLINES - 1; ++l) {
-    editor_copy_line(editor, l, l + 1);
+// bytes held by `t`.
+long long art_memory(const ArtTrie *t) {
+  long long n = t->n4.capacity() * sizeof(ArtNode4) +
+                t->n16.capacity() * sizeof(ArtNode16) +
+                t->n48.capacity() * sizeof(ArtNode48) +
+                t->n256.capacity() * sizeof(ArtNode256) +
+                t->leaves.capacity() * sizeof(ArtLeaf) +
+                t->suffixes.capacity() * sizeof(ArtSuffix) +
+                t->postings.capacity();
+  for (int i = 0; i < 4; ++i) {
+    n += t->free[i].capacity() * sizeof(int);
   }
+  return n;
 }
 
-// create an empty line before line.
-void editor_create_line_before(EditorState *editor, int line) {
-  assert(line >= 0 && line < MAXLINES);
-  for (int l = MAXLINES - 1; l > line; l--) {
-    editor_copy_line(editor, l, l - 1);
-  }
+// ===LIVE INDEX===
+// The trie indexes files as they were read, and the editor changes them.
+// Rather than reindex a file on every edit, the index keeps a log of the
+// edits to it in whole lines, `LineEdit`s. The suffixes on the lines that an
+// edit replaced stay in the trie but are dead, and the lines that replaced
+// them are copied into a fragment: a `File` of their own, whose suffixes go
+// into the trie. A suffix is mapped through the log to the line it is on now
+// only when it is reported, so an edit costs the size of the lines it
+// touches, however many suffixes come after it. Dead suffixes are reclaimed
+// when the workspace is next indexed.
+
+// lines [line, line + del) of a text were replaced by `ins` lines.
+struct LineEdit {
+  int line = 0;
+  int del = 0;
+  int ins = 0;
+};
+
+// `a` followed by `b`, as one edit that covers both.
+LineEdit line_edit_merge(LineEdit a, LineEdit b) {
+  // the lines that either of them touches, in the text between the two.
+  const int begin = std::min<int>(a.line, b.line);
+  const int end = std::max<int>(a.line + a.ins, b.line + b.del);
+  LineEdit e;
+  e.line = begin;
+  e.del = end - (a.ins - a.del) - begin;
+  e.ins = end + (b.ins - b.del) - begin;
+  return e;
 }
 
-// create an empty line after line.
-void editor_create_line_after(EditorState *editor, int line) {
-  editor_create_line_before(editor, line + 1);
+// whether `b` replaces or borders on the lines that `a` wrote.
+bool line_edit_touches(LineEdit a, LineEdit b) {
+  return b.line <= a.line + a.ins && a.line <= b.line + b.del;
 }
 
-struct BottomlineState {
-  std::string info;
-};
+// the line that `line` is on after `e`, or -1 if `e` replaced it.
+int line_edit_map(LineEdit e, int line) {
+  if (line < e.line) {
+    return line;
+  }
+  if (line < e.line + e.del) {
+    return -1;
+  }
+  return line + e.ins - e.del;
+}
 
-enum class FocusState {
-  FSK_Palette,
-  FSK_Viewer,
+// a file of the workspace that is being edited.
+struct LiveDoc {
+  std::string path; // as the editor knows it.
+  File *file = nullptr; // as the indexer read it, or nullptr if it didn't.
+  std::vector<LineEdit> edits;
+  // the fragment with the lines of the last edit, or nullptr.
+  File *fragment = nullptr;
+};
 
+// what a file of the trie holds: lines [line, ...) of `doc`, as of the first
+// `since` edits of its log.
+struct LiveFile {
+  int doc = -1;
+  int line = 0;
+  int since = 0;
+  // a later edit was merged into the one that made it, or it changed on
+  // disk since it was read.
+  bool dead = false;
 };
-struct CommandPaletteState {
-  std::string input;
-  std::vector<Loc> matches;
-  int sequence_number = 0;
-  // index of selected option.
-  // invariant: selected_ix <= matches.len(). Is equal to denote deselected
-  // index.
-  int selected_ix = 0;
+
+struct LiveIndex {
+  std::vector<LiveDoc> docs;
+  // files that are not in here are as they were read.
+  std::unordered_map<const File *, LiveFile> files;
 };
 
-mu_Id editor_state_mu_id(mu_Context *ctx, EditorState *editor) {
-  return mu_get_id(ctx, &editor, sizeof(EditorState *));
+// edits that are kept apart in the log of a doc. Past that, each edit is
+// merged with the last one, which bounds the cost of mapping a suffix.
+static const int LIVE_INDEX_MAX_EDITS = 64;
+
+// the doc of the file at `path`, which is looked up in `workspace` the first
+// time. Returns -1 if it isn't there yet and the workspace is still being
+// walked; once `walked`, a file that isn't in it gets a doc with no `file`.
+int live_index_doc(LiveIndex *live, const std::vector<File *> &workspace,
+                   const std::string &path, bool walked) {
+  for (int i = 0; i < (int)live->docs.size(); ++i) {
+    if (live->docs[i].path == path) {
+      return i;
+    }
+  }
+  LiveDoc d;
+  d.path = path;
+  const std::filesystem::path p(path);
+  for (File *f : workspace) {
+    std::error_code ec;
+    if (std::filesystem::path(f->path).filename() == p.filename() &&
+        std::filesystem::equivalent(f->path, p, ec)) {
+      d.file = f;
+      break;
+    }
+  }
+  if (!d.file && !walked) {
+    return -1;
+  }
+  const int doc = live->docs.size();
+  live->docs.push_back(d);
+  if (d.file) {
+    live->files[d.file].doc = doc;
+  }
+  return doc;
 }
 
-void mu_draw_cursor(mu_Context *ctx, mu_Rect *r, EditMode mode) {
-  mu_Rect cursor = *r;
-  mu_Rect cursor_new = *r;
+// log `e` for `doc`, and add the lines it wrote to the trie. `lines(begin,
+// end)` is the text of lines [begin, end) after `e`, joined by newlines.
+template <typename F>
+void live_index_edit(LiveIndex *live, ArtTrie *t, const IndexPolicy *p,
+                     int doc, LineEdit e, F lines) {
+  LiveDoc *d = &live->docs[doc];
+  assert(d->file);
+  if (!d->edits.empty() &&
+      (line_edit_touches(d->edits.back(), e) ||
+       (int)d->edits.size() >= LIVE_INDEX_MAX_EDITS)) {
+    // typing on a line keeps replacing the same fragment.
+    e = line_edit_merge(d->edits.back(), e);
+    d->edits.pop_back();
+    if (d->fragment) {
+      live->files[d->fragment].dead = true;
+    }
+  }
+  d->edits.push_back(e);
+  d->fragment = nullptr;
+  if (e.ins == 0) {
+    return;
+  }
 
-  cursor_new.h = r_get_text_height();
-  cursor_new.w = mode == EditMode::Insert ? 3 : r_get_text_width(" ", 1);
-  mu_draw_rect(ctx, cursor_new, mu_Color(0, 255, 0, 255));
+  const std::string text = lines(e.line, e.line + e.ins);
+  File *frag = new File(d->file->path, text.size());
+  frag->buf = new char[text.size()];
+  memcpy(frag->buf, text.data(), text.size());
+  file_build_rope(frag);
+  // the lines were written just now, which ranks their matches as recent.
+  clock_gettime(CLOCK_REALTIME, &frag->mtime);
+  d->fragment = frag;
+  LiveFile &lf = live->files[frag];
+  lf.doc = doc;
+  lf.line = e.line;
+  lf.since = d->edits.size();
+  index_for_each_suffix(
+      frag, p, [&](Loc l, int len) { art_add(t, frag, l.ix, len); });
+}
 
-  // mu_Font font = ctx->_style.font;
-  // const char *c = mode == EditMode::Insert ? "|" : "-";
-  // const int width = r_get_text_width(c, 1);
-  // mu_draw_rect(ctx,
-  // mu_draw_text(ctx, font, c, 1, mu_vec2(r->x - width / 2, r->y),
-  //              ctx->_style.colors[MU_COLOR_TEXT]);
-  // r->w += width;
+// where the suffix at byte `ix` of `f` is now, or false if its line was
+// edited since it was indexed.
+bool live_index_loc(const LiveIndex *live, File *f, int ix, Loc *out) {
+  auto it = live->files.find(f);
+  if (it != live->files.end() && it->second.dead) {
+    return false;
+  }
+  Loc l = Loc::at(f, ix);
+  if (it != live->files.end() && it->second.doc != -1) {
+    const LiveFile &lf = it->second;
+    const std::vector<LineEdit> &edits = live->docs[lf.doc].edits;
+    int line = lf.line + l.line;
+    for (int i = lf.since; i < (int)edits.size() && line != -1; ++i) {
+      line = line_edit_map(edits[i], line);
+    }
+    if (line == -1) {
+      return false;
+    }
+    l.line = line;
+  }
+  *out = l;
+  return true;
 }
 
-void mu_command_palette(mu_Context *ctx, EventState *event, EditorState *editor,
-                        CommandPaletteState *pal, FocusState *focus) {
-  assert(pal->selected_ix <= (int)pal->matches.size());
+// ===SUFFIX ARRAY===
+// The sorted suffixes of all indexed files, concatenated. Unlike the tries it
+// holds every suffix of the corpus in 6 bytes per byte of input: the text, a
+// 4 byte offset per suffix, and the longest common prefix of neighbouring
+// suffixes, clamped to a byte. A query is a binary search for the first
+// suffix it prefixes, and its matches are the run of suffixes after it that
+// share at least the query's length with their neighbour. Built at once with
+// SA-IS (Nong, Zhang and Chan) once all files are in.
+
+struct SuffixArray {
+  std::vector<File *> files;
+  std::vector<int> file_begin; // where each file begins in `text`.
+  // the files, each followed by '\n', and then a '\0' that ends the text.
+  std::string text;
+  std::vector<int> sa;
+  // lcp[i] is the common prefix of the suffixes sa[i - 1] and sa[i], at most
+  // SUFFIX_ARRAY_MAX_LCP.
+  std::vector<uint8_t> lcp;
+};
 
-  const bool focused = *focus == FocusState::FSK_Palette;
-  if (mu_begin_window(ctx, "ERROR", mu_Rect(0, 0, width, 0))) {
-    if (focused) {
-      if (event->key_pressed & KEY_BACKSPACE) {
-        pal->sequence_number++;
-        pal->input.resize(std::max<int>(0, pal->input.size() - 1));
-      }
+static const int SUFFIX_ARRAY_MAX_LCP = 255;
+// how many neighbours a query checks in the LCP array before it binary
+// searches for the end of its matches instead.
+static const int SUFFIX_ARRAY_LCP_SCAN = 64;
+
+// start, or if `end`, the end of each character's bucket in the suffix array.
+template <typename T>
+void sais_buckets(const T *s, int n, int k, std::vector<int> *bkt, bool end) {
+  bkt->assign(k, 0);
+  for (int i = 0; i < n; ++i) {
+    (*bkt)[s[i]]++;
+  }
+  int sum = 0;
+  for (int c = 0; c < k; ++c) {
+    sum += (*bkt)[c];
+    (*bkt)[c] = end ? sum : sum - (*bkt)[c];
+  }
+}
 
-      // TODO: Ask @codelegend for clean way to handle this.
-      if (event->key_pressed & KEY_DOWNARROW) {
-        pal->selected_ix =
-            std::min<int>(pal->selected_ix + 1, pal->matches.size() - 1);
-      }
+// sort the L-type suffixes from the S-type ones in `sa`, then the other way.
+template <typename T>
+void sais_induce(const T *s, int *sa, int n, int k,
+                 const std::vector<uint8_t> &stype) {
+  std::vector<int> bkt;
+  sais_buckets(s, n, k, &bkt, false);
+  for (int i = 0; i < n; ++i) {
+    const int j = sa[i] - 1;
+    if (sa[i] > 0 && !stype[j]) {
+      sa[bkt[s[j]]++] = j;
+    }
+  }
+  sais_buckets(s, n, k, &bkt, true);
+  for (int i = n - 1; i >= 0; --i) {
+    const int j = sa[i] - 1;
+    if (sa[i] > 0 && stype[j]) {
+      sa[--bkt[s[j]]] = j;
+    }
+  }
+}
 
-      if (event->key_pressed & KEY_UPARROW) {
-        pal->selected_ix = std::max<int>(0, pal->selected_ix - 1);
-      }
+// sort the suffixes of `s`, whose characters are in [0, k) and whose last
+// character is a 0 that occurs nowhere else.
+template <typename T> void sais(const T *s, int *sa, int n, int k) {
+  if (n == 1) {
+    sa[0] = 0;
+    return;
+  }
+  std::vector<uint8_t> stype(n);
+  stype[n - 1] = true;
+  for (int i = n - 2; i >= 0; --i) {
+    stype[i] = s[i] < s[i + 1] || (s[i] == s[i + 1] && stype[i + 1]);
+  }
+  // the leftmost S-type suffixes in a run.
+  auto lms = [&](int i) { return i > 0 && stype[i] && !stype[i - 1]; };
+
+  // sort the LMS substrings, by inducing from their first characters.
+  std::vector<int> bkt;
+  sais_buckets(s, n, k, &bkt, true);
+  std::fill_n(sa, n, -1);
+  for (int i = 1; i < n; ++i) {
+    if (lms(i)) {
+      sa[--bkt[s[i]]] = i;
+    }
+  }
+  sais_induce(s, sa, n, k, stype);
 
-      if (event->key_pressed & KEY_RETURN) {
-        *focus = FocusState::FSK_Viewer;
+  // name the sorted LMS substrings, equal substrings getting equal names.
+  int n1 = 0;
+  for (int i = 0; i < n; ++i) {
+    if (lms(sa[i])) {
+      sa[n1++] = sa[i];
+    }
+  }
+  std::fill(sa + n1, sa + n, -1);
+  int name = 0;
+  int prev = -1;
+  for (int i = 0; i < n1; ++i) {
+    const int pos = sa[i];
+    bool diff = prev == -1;
+    for (int d = 0; !diff && d < n; ++d) {
+      if (s[pos + d] != s[prev + d] || stype[pos + d] != stype[prev + d]) {
+        diff = true;
+      } else if (d > 0 && (lms(pos + d) || lms(prev + d))) {
+        break;
       }
+    }
+    if (diff) {
+      name++;
+      prev = pos;
+    }
+    // LMS positions are at least 2 apart, so pos / 2 does not collide.
+    sa[n1 + pos / 2] = name - 1;
+  }
+  for (int i = n - 1, j = n - 1; i >= n1; --i) {
+    if (sa[i] >= 0) {
+      sa[j--] = sa[i];
+    }
+  }
 
-      if (strlen(event->input_text)) {
-        /* handle key press. stolen from mu_textbox_raw */
-        pal->sequence_number++;
-        pal->input += std::string(event->input_text);
-        pal->matches = {};
-        pal->selected_ix = 0;
-      }
+  // sort the LMS suffixes by the string of their names, recursing if two
+  // names are equal.
+  int *s1 = sa + n - n1;
+  int *sa1 = sa;
+  if (name < n1) {
+    sais(s1, sa1, n1, name);
+  } else {
+    for (int i = 0; i < n1; ++i) {
+      sa1[s1[i]] = i;
+    }
+  }
 
-      if (pal->selected_ix < pal->matches.size()) {
-        assert(false && "do not know how to focus");
-        // editor->set_focus(pal->matches[pal->selected_ix]);
-      }
-    }
-
-    mu_Font font = ctx->_style.font;
-
-    mu_layout_begin_column(ctx);
-    const int width[] = {800};
-    mu_layout_row(ctx, 1, width, ctx->text_height(font));
-    mu_Rect r = mu_layout_next(ctx);
-    // mu_draw_text(ctx, font, "Command Palette", strlen("Command Palette"),
-    // mu_vec2(r.x, r.y), ctx->_style.colors[MU_COLOR_TEXT]);
-    // mu_draw_text(ctx, font, state->input.c_str(), state->input.size(),
-    // mu_vec2(0, 20), ctx->_style.colors[MU_COLOR_TEXT]);
-    const mu_Color BLUE_COLOR = {.r = 187, .g = 222, .b = 251, .a = 255};
-    mu_draw_text(ctx, font, pal->input.c_str(), pal->input.size(),
-                 mu_vec2(r.x, r.y), BLUE_COLOR);
-    r.x += r_get_text_width(pal->input.c_str(), pal->input.size());
-    if (focused) {
-      mu_draw_text(ctx, font, "|", 1, mu_vec2(r.x, r.y), BLUE_COLOR);
+  // induce every suffix from the sorted LMS suffixes.
+  sais_buckets(s, n, k, &bkt, true);
+  for (int i = 1, j = 0; i < n; ++i) {
+    if (lms(i)) {
+      s1[j++] = i;
     }
+  }
+  for (int i = 0; i < n1; ++i) {
+    sa1[i] = s1[sa1[i]];
+  }
+  std::fill(sa + n1, sa + n, -1);
+  for (int i = n1 - 1; i >= 0; --i) {
+    const int j = sa[i];
+    sa[i] = -1;
+    sa[--bkt[s[j]]] = j;
+  }
+  sais_induce(s, sa, n, k, stype);
+}
 
-    static const int NUM_ANSWERS = 80;
-    static const int TOP_OFFSET = 3;
-    for (int i = std::max<int>(0, pal->selected_ix - TOP_OFFSET);
-         i < pal->matches.size() && i < NUM_ANSWERS; ++i) {
-      const Loc l = pal->matches[i];
-      int ix_line_end = l.ix;
-      while (ix_line_end < l.file->len &&
-             !is_newline(l.file->buf[ix_line_end])) {
-        ix_line_end++;
-      }
-      int ix_line_begin = l.ix;
-
-      while (ix_line_begin > 0 && !is_newline(l.file->buf[ix_line_begin])) {
-        ix_line_begin--;
-      }
+// add `f` to the text. Files with a '\0' in them are binary, and skipped.
+bool suffix_array_add_file(SuffixArray *sa, File *f) {
+  if (memchr(f->buf, '\0', f->len)) {
+    return false;
+  }
+  sa->files.push_back(f);
+  sa->file_begin.push_back(sa->text.size());
+  sa->text.append(f->buf, f->len);
+  sa->text += '\n';
+  return true;
+}
 
-      mu_Rect r = mu_layout_next(ctx);
+// end the text, and sort its suffixes.
+void suffix_array_sort(SuffixArray *sa) {
+  sa->text += '\0';
+  sa->text.shrink_to_fit();
+  sa->sa.resize(sa->text.size());
+  sais((const uint8_t *)sa->text.data(), sa->sa.data(), sa->text.size(), 256);
+}
 
-      const bool SELECTED = focused && (i == pal->selected_ix);
-      const mu_Color WHITE_COLOR = {.r = 255, .g = 255, .b = 255, .a = 255};
-      const mu_Color GRAY_COLOR = {.r = 100, .g = 100, .b = 100, .a = 255};
-      const char selection = SELECTED ? '>' : ' ';
-      mu_draw_text(ctx, font, &selection, 1, mu_vec2(r.x, r.y), WHITE_COLOR);
-      r.x += r_get_text_width(&selection, 1);
+// sort the suffixes of the text, and find their common prefixes (Kasai et
+// al.).
+void suffix_array_build(SuffixArray *sa) {
+  suffix_array_sort(sa);
+  const int n = sa->text.size();
+  const uint8_t *s = (const uint8_t *)sa->text.data();
 
-      std::string istr = std::to_string(i + 1); // TODO: right-pad.
-      istr += ".";
-      mu_draw_text(ctx, font, istr.c_str(), istr.size(), mu_vec2(r.x, r.y),
-                   SELECTED ? WHITE_COLOR : GRAY_COLOR);
-      r.x += r_get_text_width(istr.c_str(), istr.size());
+  std::vector<int> rank(n);
+  for (int i = 0; i < n; ++i) {
+    rank[sa->sa[i]] = i;
+  }
+  sa->lcp.assign(n, 0);
+  for (int i = 0, h = 0; i < n; ++i) {
+    if (rank[i] == 0) {
+      h = 0;
+      continue;
+    }
+    const int j = sa->sa[rank[i] - 1];
+    while (i + h < n && j + h < n && s[i + h] == s[j + h]) {
+      h++;
+    }
+    sa->lcp[rank[i]] = std::min<int>(h, SUFFIX_ARRAY_MAX_LCP);
+    if (h > 0) {
+      h--;
+    }
+  }
+}
 
-      mu_draw_text(ctx, font, l.file->path.c_str(), l.file->path.size(),
-                   mu_vec2(r.x, r.y), SELECTED ? WHITE_COLOR : GRAY_COLOR);
-      r.x += r_get_text_width(l.file->path.c_str(), l.file->path.size());
+// the suffixes [*lo, *hi) of the suffix array that begin with `key`.
+void suffix_array_range(const SuffixArray *sa, const char *key, int len,
+                        int *lo, int *hi) {
+  const int n = sa->sa.size();
+  const char *text = sa->text.data();
+  // the first suffix that is not less than `key`.
+  int l = 0, r = n;
+  while (l < r) {
+    const int m = l + (r - l) / 2;
+    const int suf = sa->sa[m];
+    const int k = std::min<int>(len, n - suf);
+    const int cmp = memcmp(text + suf, key, k);
+    if (cmp < 0 || (cmp == 0 && k < len)) {
+      l = m + 1;
+    } else {
+      r = m;
+    }
+  }
+  *lo = *hi = l;
+  if (l == n || n - sa->sa[l] < len || memcmp(text + sa->sa[l], key, len)) {
+    return;
+  }
+  // the matches are the run after it that share `len` bytes with it. Short
+  // runs are read off the LCP array, long ones are found by binary search.
+  int h = l + 1;
+  if (len <= SUFFIX_ARRAY_MAX_LCP) {
+    while (h < n && h - l <= SUFFIX_ARRAY_LCP_SCAN && sa->lcp[h] >= len) {
+      h++;
+    }
+    if (h == n || sa->lcp[h] < len) {
+      *hi = h;
+      return;
+    }
+  }
+  // the first suffix after `l` that does not begin with `key`.
+  r = n;
+  while (h < r) {
+    const int m = h + (r - h) / 2;
+    const int suf = sa->sa[m];
+    if (n - suf >= len && !memcmp(text + suf, key, len)) {
+      h = m + 1;
+    } else {
+      r = m;
+    }
+  }
+  *hi = h;
+}
 
-      mu_draw_text(ctx, font, ":", 1, mu_vec2(r.x, r.y), GRAY_COLOR);
-      r.x += r_get_text_width(":", 1);
+// the Loc of byte `ix` of a text made of `files`, which begin at
+// `file_begin`.
+Loc corpus_loc(const std::vector<File *> &files,
+               const std::vector<int> &file_begin, int ix) {
+  const int file =
+      std::upper_bound(file_begin.begin(), file_begin.end(), ix) -
+      file_begin.begin() - 1;
+  return Loc::at(files[file], ix - file_begin[file]);
+}
 
-      std::string linenostr = std::to_string(l.line + 1);
-      mu_draw_text(ctx, font, linenostr.c_str(), linenostr.size(),
-                   mu_vec2(r.x, r.y), GRAY_COLOR);
-      r.x += r_get_text_width(linenostr.c_str(), linenostr.size());
+// where the `i`th suffix begins.
+Loc suffix_array_loc(const SuffixArray *sa, int i) {
+  return corpus_loc(sa->files, sa->file_begin, sa->sa[i]);
+}
 
-      mu_draw_text(ctx, font, " ", 1, mu_vec2(r.x, r.y), GRAY_COLOR);
-      r.x += r_get_text_width(" ", 1);
+long long suffix_array_memory(const SuffixArray *sa) {
+  return sa->text.capacity() + sa->sa.capacity() * sizeof(int) +
+         sa->lcp.capacity() + sa->file_begin.capacity() * sizeof(int);
+}
 
-      // [ix_line_begin, ix)
-      mu_draw_text(ctx, font, l.file->buf + ix_line_begin, l.ix - ix_line_begin,
-                   mu_vec2(r.x, r.y), SELECTED ? WHITE_COLOR : GRAY_COLOR);
-      r.x +=
-          r_get_text_width(l.file->buf + ix_line_begin, l.ix - ix_line_begin);
+// ===SUCCINCT===
+// Bit vectors with rank and select, and a wavelet tree over bytes built from
+// them. Rank counts in O(1) from a directory of one 32 bit count per 512
+// bits, 6% on top of the bits; select binary searches the directory.
 
-      // [ix, ix_str_end)
-      const int ix_str_end = l.ix + pal->input.size();
-      mu_draw_text(ctx, font, l.file->buf + l.ix, ix_str_end - l.ix,
-                   mu_vec2(r.x, r.y), BLUE_COLOR);
-      r.x += r_get_text_width(l.file->buf + l.ix, ix_str_end - l.ix);
+static const int BIT_VECTOR_BLOCK_WORDS = 8;
 
-      // [ix+search str, ix end)
-      mu_draw_text(ctx, font, l.file->buf + ix_str_end,
-                   ix_line_end - ix_str_end, mu_vec2(r.x, r.y),
-                   SELECTED ? WHITE_COLOR : GRAY_COLOR);
-      r.x +=
-          r_get_text_width(l.file->buf + ix_str_end, ix_line_end - ix_str_end);
+struct BitVector {
+  std::vector<uint64_t> words;
+  // blocks[k] is the number of ones before word k * BIT_VECTOR_BLOCK_WORDS.
+  std::vector<uint32_t> blocks;
+  int len = 0;
+};
 
-    } // end i
-    mu_layout_end_column(ctx);
-    mu_end_window(ctx);
-  } // end mu_begin_window
+void bit_vector_push(BitVector *bv, bool bit) {
+  if (bv->len % 64 == 0) {
+    bv->words.push_back(0);
+  }
+  bv->words.back() |= (uint64_t)bit << (bv->len % 64);
+  bv->len++;
 }
 
-void mu_bottom_line(mu_Context *ctx, BottomlineState *s) {
-  mu_Font font = ctx->_style.font;
-  mu_Rect parent_body = mu_get_current_container(ctx)->body;
-  int y = parent_body.y + parent_body.h - r_get_text_height();
-  mu_draw_text(ctx, font, s->info.c_str(), s->info.size(), mu_vec2(0, y),
-               ctx->_style.colors[MU_COLOR_TEXT]);
+bool bit_vector_get(const BitVector *bv, int i) {
+  assert(i >= 0 && i < bv->len);
+  return bv->words[i / 64] >> (i % 64) & 1;
 }
 
-void mu_editor(mu_Context *ctx, EventState *event, EditorState *editor,
-               FocusState *focus, const CommandPaletteState *pal) {
-  static Cursor cursor;
-
-  mu_Font font = ctx->_style.font;
-
-  mu_Id id = editor_state_mu_id(ctx, editor);
-  mu_Container *cnt = mu_get_current_container(ctx);
-  assert(cnt && "must be within container");
+// build the rank directory, once every bit is pushed.
+void bit_vector_build(BitVector *bv) {
+  bv->words.shrink_to_fit();
+  bv->blocks.clear();
+  uint32_t ones = 0;
+  for (int w = 0; w < (int)bv->words.size(); ++w) {
+    if (w % BIT_VECTOR_BLOCK_WORDS == 0) {
+      bv->blocks.push_back(ones);
+    }
+    ones += __builtin_popcountll(bv->words[w]);
+  }
+  bv->blocks.push_back(ones);
+  bv->blocks.shrink_to_fit();
+}
 
-  const int N_SCROLL_STEPS = 15;
-  const bool focused = true;
-  if (focused) {
-    for (int i = 0; i < strlen(event->input_text); ++i) {
-      const char c = event->input_text[i];
+// the number of ones in [0, i).
+int bit_vector_rank1(const BitVector *bv, int i) {
+  assert(i >= 0 && i <= bv->len);
+  const int w = i / 64;
+  int r = bv->blocks[w / BIT_VECTOR_BLOCK_WORDS];
+  for (int k = w / BIT_VECTOR_BLOCK_WORDS * BIT_VECTOR_BLOCK_WORDS; k < w;
+       ++k) {
+    r += __builtin_popcountll(bv->words[k]);
+  }
+  if (i % 64) {
+    r += __builtin_popcountll(bv->words[w] << (64 - i % 64));
+  }
+  return r;
+}
 
-      // if (event->key_held_down & KEY_CTRL && c == 'c') {
-      //     editor->mode = EditMode::Normal;
-      // }
+int bit_vector_rank0(const BitVector *bv, int i) {
+  return i - bit_vector_rank1(bv, i);
+}
 
-      if (!(event->key_held_down & KEY_CTRL) &&
-          editor->mode == EditMode::Insert) {
-        cursor = cursor_insert_str(editor, cursor, &c, 1);
+// the position of the one (if `bit`) or zero with rank `k`, counting from 0.
+int bit_vector_select(const BitVector *bv, bool bit, int k) {
+  // ones, or zeros, before block `b`.
+  auto before = [&](int b) {
+    const int ones = bv->blocks[b];
+    return bit ? ones : b * BIT_VECTOR_BLOCK_WORDS * 64 - ones;
+  };
+  int lo = 0, hi = bv->blocks.size() - 1;
+  while (hi - lo > 1) {
+    const int m = lo + (hi - lo) / 2;
+    if (before(m) <= k) {
+      lo = m;
+    } else {
+      hi = m;
+    }
+  }
+  k -= before(lo);
+  for (int w = lo * BIT_VECTOR_BLOCK_WORDS; w < (int)bv->words.size(); ++w) {
+    const uint64_t word = bit ? bv->words[w] : ~bv->words[w];
+    const int n = __builtin_popcountll(word);
+    if (k < n) {
+      uint64_t x = word;
+      for (int j = 0; j < k; ++j) {
+        x &= x - 1;
       }
+      const int i = w * 64 + __builtin_ctzll(x);
+      assert(i < bv->len);
+      return i;
     }
+    k -= n;
+  }
+  assert(false && "select past the last bit");
+  return -1;
+}
 
-    if (editor->mode == EditMode::Normal && event->key_held_down & KEY_I) {
-      editor->mode = EditMode::Insert;
-    }
+long long bit_vector_memory(const BitVector *bv) {
+  return bv->words.capacity() * sizeof(uint64_t) +
+         bv->blocks.capacity() * sizeof(uint32_t);
+}
 
-    if (event->key_held_down & KEY_CTRL && event->key_pressed & KEY_A) {
-      cursor.col = 0;
-    }
+// A wavelet tree shaped by the Huffman code of the bytes, so it takes about
+// as many bits as the zeroth order entropy of the sequence. Each node splits
+// the bytes that reach it by the next bit of their code.
+struct WaveletNode {
+  BitVector bits;
+  // child along each bit: a node if >= 0, or the leaf of byte -1 - child.
+  int child[2] = {-1, -1};
+};
 
-    if (event->key_held_down & KEY_CTRL && event->key_pressed & KEY_E) {
-      cursor = cursor_dollar(editor, cursor);
-    }
+struct WaveletTree {
+  std::vector<WaveletNode> nodes; // nodes[0] is the root.
+  uint64_t code[256] = {};        // read from the most significant bit.
+  int codelen[256] = {};          // 0 if the byte does not occur.
+};
 
-    if (event->key_held_down & KEY_CTRL && event->key_pressed & KEY_C) {
-      editor->mode = EditMode::Normal;
+void wavelet_tree_assign_codes(WaveletTree *wt, int node, uint64_t code,
+                               int len) {
+  for (int b = 0; b < 2; ++b) {
+    const int c = wt->nodes[node].child[b];
+    if (c >= 0) {
+      wavelet_tree_assign_codes(wt, c, code << 1 | b, len + 1);
+    } else {
+      wt->code[-1 - c] = code << 1 | b;
+      wt->codelen[-1 - c] = len + 1;
     }
+  }
+}
 
-    if (event->key_held_down & KEY_CTRL && event->key_pressed & KEY_D) {
-      for (int i = 0; i < N_SCROLL_STEPS; ++i) {
-        cursor = cursor_down(editor, cursor);
-      }
+void wavelet_tree_build(WaveletTree *wt, const uint8_t *s, int n) {
+  long long counts[256] = {};
+  for (int i = 0; i < n; ++i) {
+    counts[s[i]]++;
+  }
+  // huffman: merge the two least frequent trees until one is left. Trees are
+  // nodes, or leaves as -1 - byte.
+  typedef std::pair<long long, int> Tree;
+  std::priority_queue<Tree, std::vector<Tree>, std::greater<Tree>> q;
+  for (int c = 0; c < 256; ++c) {
+    if (counts[c]) {
+      q.push({counts[c], -1 - c});
     }
-
-    if (event->key_held_down & KEY_CTRL && event->key_pressed & KEY_U) {
-      for (int i = 0; i < N_SCROLL_STEPS; ++i) {
-        cursor = cursor_up(editor, cursor);
+  }
+  // the root needs two children, even if there is one byte.
+  for (int c = 0; q.size() < 2; ++c) {
+    if (!counts[c]) {
+      q.push({0, -1 - c});
+    }
+  }
+  wt->nodes.clear();
+  while (q.size() > 1) {
+    const Tree a = q.top();
+    q.pop();
+    const Tree b = q.top();
+    q.pop();
+    WaveletNode node;
+    node.child[0] = a.second;
+    node.child[1] = b.second;
+    wt->nodes.push_back(std::move(node));
+    q.push({a.first + b.first, (int)wt->nodes.size() - 1});
+  }
+  // the last merge is the root; move it to the front.
+  const int root = wt->nodes.size() - 1;
+  std::swap(wt->nodes[0], wt->nodes[root]);
+  for (WaveletNode &node : wt->nodes) {
+    for (int b = 0; b < 2; ++b) {
+      if (node.child[b] == 0) {
+        node.child[b] = root;
+      } else if (node.child[b] == root) {
+        node.child[b] = 0;
       }
     }
-
-    if (event->key_pressed & KEY_UPARROW ||
-        (editor->mode == EditMode::Normal && event->key_pressed & KEY_K)) {
-      cursor = cursor_up(editor, cursor);
+  }
+  wavelet_tree_assign_codes(wt, 0, 0, 0);
+
+  for (int i = 0; i < n; ++i) {
+    const uint64_t code = wt->code[s[i]];
+    int node = 0;
+    for (int d = wt->codelen[s[i]] - 1; d >= 0; --d) {
+      const bool bit = code >> d & 1;
+      bit_vector_push(&wt->nodes[node].bits, bit);
+      node = wt->nodes[node].child[bit];
     }
+  }
+  for (WaveletNode &node : wt->nodes) {
+    bit_vector_build(&node.bits);
+  }
+}
 
-    if (event->key_pressed & KEY_DOWNARROW ||
-        (editor->mode == EditMode::Normal && event->key_pressed & KEY_J)) {
-      cursor = cursor_down(editor, cursor);
-    }
+// the number of `c` in [0, i).
+int wavelet_tree_rank(const WaveletTree *wt, uint8_t c, int i) {
+  if (!wt->codelen[c]) {
+    return 0;
+  }
+  const uint64_t code = wt->code[c];
+  int node = 0;
+  for (int d = wt->codelen[c] - 1; d >= 0 && i > 0; --d) {
+    const bool bit = code >> d & 1;
+    const BitVector *bits = &wt->nodes[node].bits;
+    i = bit ? bit_vector_rank1(bits, i) : bit_vector_rank0(bits, i);
+    node = wt->nodes[node].child[bit];
+  }
+  return i;
+}
 
-    if (event->key_pressed & KEY_LEFTARROW ||
-        (editor->mode == EditMode::Normal && event->key_pressed & KEY_H)) {
-      cursor.col = std::max<int>(cursor.col - 1, 0);
-    }
+// the byte at `i`, and the number of times it occurs in [0, i).
+uint8_t wavelet_tree_access(const WaveletTree *wt, int i, int *rank) {
+  int node = 0;
+  while (node >= 0) {
+    const BitVector *bits = &wt->nodes[node].bits;
+    const bool bit = bit_vector_get(bits, i);
+    i = bit ? bit_vector_rank1(bits, i) : bit_vector_rank0(bits, i);
+    node = wt->nodes[node].child[bit];
+  }
+  *rank = i;
+  return -1 - node;
+}
 
-    if (event->key_pressed & KEY_RIGHTARROW ||
-        (editor->mode == EditMode::Normal && event->key_pressed & KEY_L)) {
-      cursor.col = std::min<int>(cursor.col + 1, editor->linelen[cursor.line]);
-    }
+// the position of the `c` with rank `k`, counting from 0.
+int wavelet_tree_select(const WaveletTree *wt, uint8_t c, int k) {
+  assert(wt->codelen[c]);
+  // the nodes on the path to `c`, then back up.
+  int path[64];
+  const uint64_t code = wt->code[c];
+  int node = 0;
+  for (int d = wt->codelen[c] - 1; d >= 0; --d) {
+    path[d] = node;
+    node = wt->nodes[node].child[code >> d & 1];
+  }
+  for (int d = 0; d < wt->codelen[c]; ++d) {
+    k = bit_vector_select(&wt->nodes[path[d]].bits, code >> d & 1, k);
+  }
+  return k;
+}
 
-    if (editor->mode == EditMode::Insert &&
-        event->key_pressed & KEY_BACKSPACE) {
-      if (cursor.col == 0) {
-        // TODO: think of how this codde can be cleaned up!
-        // In terms of differential geometry :)
-        // If we attach the space back on itself twisted (ala mobius
-        // strip), does that give us the correct implementation of
-        // cursors? I think so!
-        if (cursor.line == 0) {
-          return;
-        }
-        assert(cursor.line > 0);
-        // join previous line into currentline.
-        cursor = cursor_dollar(editor, cursor_up(editor, cursor));
-        editor_append_line(editor, cursor.line, editor->text[cursor.line + 1],
-                           editor->linelen[cursor.line + 1]);
-        editor_remove_line(editor, cursor.line + 1);
+long long wavelet_tree_memory(const WaveletTree *wt) {
+  long long n = wt->nodes.capacity() * sizeof(WaveletNode);
+  for (const WaveletNode &node : wt->nodes) {
+    n += bit_vector_memory(&node.bits);
+  }
+  return n;
+}
 
-      } else {
-        cursor = cursor_delete_backward(editor, cursor, 1);
-      }
-    }
+// ===FM INDEX===
+// The Burrows-Wheeler transform of the corpus in a wavelet tree, which
+// counts the occurrences of a query with two ranks per byte of it, searching
+// backwards. Every FM_INDEX_SAMPLE_RATE-th position of the text is kept, and
+// locating a match steps back through the text (LF) until it reaches one.
+// Smaller than the text it indexes, which it does not keep.
+
+static const int FM_INDEX_SAMPLE_RATE = 64;
+
+struct FmIndex {
+  std::vector<File *> files;
+  std::vector<int> file_begin;
+  int n = 0;
+  int C[257] = {}; // the number of bytes in the text smaller than each byte.
+  WaveletTree bwt;
+  // sampled[i] if suffix i begins at a multiple of FM_INDEX_SAMPLE_RATE.
+  BitVector sampled;
+  std::vector<int> samples; // where the sampled suffixes begin, in order.
+};
 
-    if (editor->mode == EditMode::Insert && event->key_pressed & KEY_RETURN) {
-      int len = editor->linelen[cursor.line] - cursor.col;
-      char *s = editor->text[cursor.line] + cursor.col;
-      // copy text to next line
-      Cursor new_cursor = cursor_down(editor, cursor);
-      new_cursor.col = 0;
-      cursor_insert_str(editor, new_cursor, s, len);
-      cursor_delete_till_end_of_line(editor, cursor);
-      cursor = new_cursor;
+// build from the sorted suffixes of `sa`, and free them.
+void fm_index_build(FmIndex *fm, SuffixArray *sa) {
+  fm->files = std::move(sa->files);
+  fm->file_begin = std::move(sa->file_begin);
+  const int n = sa->text.size();
+  const uint8_t *text = (const uint8_t *)sa->text.data();
+  fm->n = n;
+
+  std::fill_n(fm->C, 257, 0);
+  for (int i = 0; i < n; ++i) {
+    fm->C[text[i] + 1]++;
+  }
+  for (int c = 0; c < 256; ++c) {
+    fm->C[c + 1] += fm->C[c];
+  }
+
+  std::vector<uint8_t> bwt(n);
+  fm->sampled = BitVector();
+  fm->samples.clear();
+  for (int i = 0; i < n; ++i) {
+    const int suf = sa->sa[i];
+    bwt[i] = text[suf ? suf - 1 : n - 1];
+    const bool sample = suf % FM_INDEX_SAMPLE_RATE == 0;
+    bit_vector_push(&fm->sampled, sample);
+    if (sample) {
+      fm->samples.push_back(suf);
     }
   }
+  bit_vector_build(&fm->sampled);
+  fm->samples.shrink_to_fit();
+  *sa = SuffixArray();
+  wavelet_tree_build(&fm->bwt, bwt.data(), n);
+}
 
-  mu_layout_begin_column(ctx);
-  int width = -1;
-  mu_layout_row(ctx, 1, &width, ctx->text_height(font));
-  // mu_draw_control_frame(ctx, id, cnt->body, MU_COLOR_BASE, 0);
+// the suffixes [*lo, *hi) that begin with `key`.
+void fm_index_range(const FmIndex *fm, const char *key, int len, int *lo,
+                    int *hi) {
+  int l = 0, h = fm->n;
+  for (int i = len - 1; i >= 0 && l < h; --i) {
+    const uint8_t c = key[i];
+    l = fm->C[c] + wavelet_tree_rank(&fm->bwt, c, l);
+    h = fm->C[c] + wavelet_tree_rank(&fm->bwt, c, h);
+  }
+  *lo = l;
+  *hi = std::max<int>(l, h);
+}
 
-  const int NLINES = height / ctx->text_height(font);
+// where suffix `i` begins in the text.
+int fm_index_locate(const FmIndex *fm, int i) {
+  int steps = 0;
+  while (!bit_vector_get(&fm->sampled, i)) {
+    // LF: the suffix that begins one byte earlier.
+    int rank;
+    const uint8_t c = wavelet_tree_access(&fm->bwt, i, &rank);
+    i = fm->C[c] + rank;
+    steps++;
+  }
+  return fm->samples[bit_vector_rank1(&fm->sampled, i)] + steps;
+}
 
-  const mu_Color DARKGRAY_COLOR = {.r = 100, .g = 100, .b = 100, .a = 255};
-  const mu_Color GRAY_COLOR = {.r = 180, .g = 180, .b = 180, .a = 255};
-  const mu_Color WHITE_COLOR = {.r = 255, .g = 255, .b = 255, .a = 255};
-  const mu_Color BLUE_COLOR = {.r = 187, .g = 222, .b = 251, .a = 255};
+Loc fm_index_loc(const FmIndex *fm, int i) {
+  return corpus_loc(fm->files, fm->file_begin, fm_index_locate(fm, i));
+}
 
-  const int line_begin = std::max<int>(0, cursor.line - NLINES / 2);
-  for (int line = line_begin; line < line_begin + NLINES; ++line) {
-    mu_Rect r = mu_layout_next(ctx);
+long long fm_index_memory(const FmIndex *fm) {
+  return wavelet_tree_memory(&fm->bwt) + bit_vector_memory(&fm->sampled) +
+         fm->samples.capacity() * sizeof(int) +
+         fm->file_begin.capacity() * sizeof(int);
+}
 
-    const bool SELECTED = cursor.line == line;
+// ===TRIGRAM INDEX===
+// For each trigram (3 bytes) of the corpus, the files it occurs in. A query
+// of three or more bytes can only match in files that have every one of its
+// trigrams, so the palette intersects their posting lists, shortest first,
+// and then scans just those files for the query. Posting lists are the
+// differences between ascending file ids, as LEB128 varints, which is about a
+// byte per entry.
+//
+// The index of the last run can be loaded from disk, see `trigram_index_load`.
+// Its files take the first ids, and its posting lists come before those of
+// the files added since. A file that changed since gets a new id, and its old
+// id is dead.
+
+struct TrigramPostings {
+  std::vector<uint8_t> bytes; // varint deltas of file ids.
+  int last = -1;              // the last file id, to take the next delta from.
+  int count = 0;
+};
 
-    // 1. draw line number
-    static const int MAX_LINE_STRLEN = 5;
-    char lineno_str[MAX_LINE_STRLEN];
-    sprintf(lineno_str, "%d", line);
-    const int num_len = strlen(lineno_str);
-    assert(strlen(lineno_str) < MAX_LINE_STRLEN - 1);
-    for (int i = num_len; i < MAX_LINE_STRLEN; ++i) {
-      lineno_str[i] = ' ';
-    }
-    lineno_str[MAX_LINE_STRLEN - 1] = 0;
+// the index on disk: a header, then `nfiles` `TrigramFileEntry`s, then
+// `ntrigrams` `TrigramEntry`s sorted by trigram, then the paths, then the
+// posting lists. Offsets rather than pointers, so that it is used as mapped.
+struct TrigramFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t nfiles;
+  uint32_t ntrigrams;
+  uint32_t pad;
+  uint64_t paths_len;
+  uint64_t postings_len;
+};
 
-    mu_draw_text(ctx, font, lineno_str, strlen(lineno_str), mu_vec2(r.x, r.y),
-                 SELECTED ? WHITE_COLOR : GRAY_COLOR);
-    r.x += ctx->text_width(font, lineno_str, strlen(lineno_str));
-    r.h = ctx->text_height(font);
-    // draw text. yes less than or equals to enable writing of cursor.
-    for (int col = 0; col <= editor->linelen[line]; ++col) {
-      if (focused && line == cursor.line && col == cursor.col) {
-        mu_draw_cursor(ctx, &r, editor->mode);
+struct TrigramFileEntry {
+  uint64_t hash;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  uint32_t path; // offset into the paths.
+  uint32_t path_len;
+  uint32_t len;
+  uint32_t pad;
+};
+
+struct TrigramEntry {
+  uint32_t trigram;
+  uint32_t count;
+  uint64_t postings; // offset into the posting lists.
+};
+
+const TrigramFileEntry *trigram_file_entries(const TrigramFileHeader *h) {
+  return (const TrigramFileEntry *)(h + 1);
+}
+
+const TrigramEntry *trigram_file_trigrams(const TrigramFileHeader *h) {
+  return (const TrigramEntry *)(trigram_file_entries(h) + h->nfiles);
+}
+
+const char *trigram_file_paths(const TrigramFileHeader *h) {
+  return (const char *)(trigram_file_trigrams(h) + h->ntrigrams);
+}
+
+const uint8_t *trigram_file_postings(const TrigramFileHeader *h) {
+  return (const uint8_t *)trigram_file_paths(h) + h->paths_len;
+}
+
+struct TrigramIndex {
+  // by id. nullptr for the files of `base` that are dead, or not walked to.
+  std::vector<File *> files;
+  std::vector<uint64_t> hashes; // of the contents of each file.
+  std::unordered_map<uint32_t, TrigramPostings> postings;
+  // the mapped index of the last run, or nullptr. Its files are the first
+  // `nbase` ids, looked up by path in `base_ids`.
+  const TrigramFileHeader *base = nullptr;
+  size_t base_len = 0;
+  int nbase = 0;
+  std::unordered_map<std::string, int> base_ids;
+};
+
+// a posting list: the part from `base`, then the part added since.
+struct TrigramList {
+  const uint8_t *bytes[2] = {nullptr, nullptr};
+  int count[2] = {0, 0};
+  int total = 0;
+};
+
+// reads a `TrigramList` one id at a time.
+struct TrigramReader {
+  TrigramList list;
+  int part = 0;
+  int n = 0; // ids read from `part`.
+  const uint8_t *c = nullptr;
+  int id = -1;
+  int base = -1; // the id that the deltas of `part` start from.
+};
+
+// a 64 bit hash of `s`, 8 bytes at a time.
+uint64_t hash_bytes(const char *s, int len) {
+  uint64_t h = 0x9e3779b97f4a7c15ull ^ (uint64_t)len;
+  int i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t w;
+    memcpy(&w, s + i, 8);
+    h = (h ^ w) * 0xff51afd7ed558ccdull;
+    h ^= h >> 32;
+  }
+  uint64_t w = 0;
+  memcpy(&w, s + i, len - i);
+  h = (h ^ w) * 0xc4ceb9fe1a85ec53ull;
+  return h ^ (h >> 29);
+}
+
+uint32_t trigram_of(const char *s) {
+  return (uint32_t)(uint8_t)s[0] << 16 | (uint32_t)(uint8_t)s[1] << 8 |
+         (uint8_t)s[2];
+}
+
+// the distinct trigrams of `s`, sorted.
+std::vector<uint32_t> trigrams_of(const char *s, int len) {
+  std::vector<uint32_t> ts;
+  for (int i = 0; i + 3 <= len; ++i) {
+    ts.push_back(trigram_of(s + i));
+  }
+  std::sort(ts.begin(), ts.end());
+  ts.erase(std::unique(ts.begin(), ts.end()), ts.end());
+  return ts;
+}
+
+// add `f`. Files with a '\0' in them are binary, and skipped.
+bool trigram_index_add_file(TrigramIndex *ix, File *f) {
+  if (memchr(f->buf, '\0', f->len)) {
+    return false;
+  }
+  const int id = ix->files.size();
+  ix->files.push_back(f);
+  ix->hashes.push_back(hash_bytes(f->buf, f->len));
+  for (uint32_t t : trigrams_of(f->buf, f->len)) {
+    TrigramPostings &p = ix->postings[t];
+    varint_push(&p.bytes, id - p.last);
+    p.last = id;
+    p.count++;
+  }
+  return true;
+}
+
+// the posting list of trigram `t`.
+TrigramList trigram_index_list(const TrigramIndex *ix, uint32_t t) {
+  TrigramList l;
+  if (ix->base) {
+    const TrigramEntry *begin = trigram_file_trigrams(ix->base);
+    const TrigramEntry *end = begin + ix->base->ntrigrams;
+    const TrigramEntry *e = std::lower_bound(
+        begin, end, t,
+        [](const TrigramEntry &e, uint32_t t) { return e.trigram < t; });
+    if (e != end && e->trigram == t) {
+      l.bytes[0] = trigram_file_postings(ix->base) + e->postings;
+      l.count[0] = e->count;
+    }
+  }
+  auto it = ix->postings.find(t);
+  if (it != ix->postings.end()) {
+    l.bytes[1] = it->second.bytes.data();
+    l.count[1] = it->second.count;
+  }
+  l.total = l.count[0] + l.count[1];
+  return l;
+}
+
+TrigramReader trigram_reader(const TrigramList &list) {
+  TrigramReader r;
+  r.list = list;
+  r.c = list.bytes[0];
+  return r;
+}
+
+// the next id of `r` into `r->id`, or false at the end of the list.
+bool trigram_reader_next(TrigramReader *r) {
+  while (r->part < 2 && r->n == r->list.count[r->part]) {
+    r->part++;
+    r->n = 0;
+    r->c = r->part < 2 ? r->list.bytes[r->part] : nullptr;
+    r->base = -1;
+  }
+  if (r->part == 2) {
+    return false;
+  }
+  r->base += varint_read(&r->c);
+  r->id = r->base;
+  r->n++;
+  return true;
+}
+
+// the files that may contain `key`: the live ones with all its trigrams, or
+// every live file if it is too short to have any.
+std::vector<int> trigram_index_candidates(const TrigramIndex *ix,
+                                          const char *key, int len) {
+  std::vector<TrigramList> lists;
+  for (uint32_t t : trigrams_of(key, len)) {
+    lists.push_back(trigram_index_list(ix, t));
+    if (lists.back().total == 0) {
+      return {};
+    }
+  }
+  std::vector<int> ids;
+  if (lists.empty()) {
+    for (int i = 0; i < (int)ix->files.size(); ++i) {
+      if (ix->files[i]) {
+        ids.push_back(i);
       }
+    }
+    return ids;
+  }
+  std::sort(lists.begin(), lists.end(),
+            [](const TrigramList &a, const TrigramList &b) {
+              return a.total < b.total;
+            });
+  ids.reserve(lists[0].total);
+  TrigramReader r0 = trigram_reader(lists[0]);
+  while (trigram_reader_next(&r0)) {
+    ids.push_back(r0.id);
+  }
+  for (int i = 1; i < (int)lists.size() && !ids.empty(); ++i) {
+    // merge with the next list as it is decoded.
+    TrigramReader r = trigram_reader(lists[i]);
+    int out = 0;
+    bool more = true;
+    for (int j = 0; j < (int)ids.size() && more; ++j) {
+      while (r.id < ids[j] && (more = trigram_reader_next(&r))) {
+      }
+      if (r.id == ids[j]) {
+        ids[out++] = ids[j];
+      }
+    }
+    ids.resize(out);
+  }
+  int out = 0;
+  for (int id : ids) {
+    if (ix->files[id]) {
+      ids[out++] = id;
+    }
+  }
+  ids.resize(out);
+  return ids;
+}
 
-      // the character is within [NSCROLL] distance from cursor
-      bool IN_SCROLL_RANGE = abs(line - cursor.line) <= N_SCROLL_STEPS;
-      // the character is inside the query bounds.
-      bool AT_QUERY = false;
-      // bool AT_QUERY =
-      //     pal->selected_ix < pal->matches.size() &&
-      //     cur.ix >= pal->matches[pal->selected_ix].ix &&
-      //     cur.ix < pal->matches[pal->selected_ix].ix +
-      //     pal->input.size();
-      const char c = editor->text[line][col];
-      mu_draw_text(ctx, font, &c, 1, mu_vec2(r.x, r.y),
-                   AT_QUERY          ? BLUE_COLOR
-                   : SELECTED        ? WHITE_COLOR
-                   : IN_SCROLL_RANGE ? GRAY_COLOR
-                                     : DARKGRAY_COLOR);
-      r.x += ctx->text_width(font, &c, 1);
+long long trigram_index_memory(const TrigramIndex *ix) {
+  // a key, its postings, and the hash table's node and bucket pointers.
+  long long n = ix->postings.size() * (sizeof(uint32_t) +
+                                       sizeof(TrigramPostings) +
+                                       2 * sizeof(void *));
+  for (const auto &it : ix->postings) {
+    n += it.second.bytes.capacity();
+  }
+  return n + ix->base_len;
+}
+
+// move the files of `shard`, which has no base, to the end of `ix`.
+void trigram_index_merge(TrigramIndex *ix, TrigramIndex *shard) {
+  assert(!shard->base);
+  const int off = ix->files.size();
+  ix->files.insert(ix->files.end(), shard->files.begin(), shard->files.end());
+  ix->hashes.insert(ix->hashes.end(), shard->hashes.begin(),
+                    shard->hashes.end());
+  for (auto &it : shard->postings) {
+    TrigramPostings &p = ix->postings[it.first];
+    TrigramReader r = trigram_reader(trigram_index_list(shard, it.first));
+    while (trigram_reader_next(&r)) {
+      varint_push(&p.bytes, r.id + off - p.last);
+      p.last = r.id + off;
+      p.count++;
     }
+  }
+  *shard = TrigramIndex();
+}
 
-    // cursor
-    // if (editor->cursor.line == line && editor->focus.col ==
-    // right.col) {
-    //     mu_draw_cursor(ctx, &r);
-    // }
+// the first occurrence of `needle` in `hay`, or nullptr. Compares the first
+// and last byte of the needle at 16 positions at once, and the rest only
+// where both match.
+const char *simd_memmem(const char *hay, int n, const char *needle, int m) {
+  if (m == 0) {
+    return hay;
+  }
+  if (m > n) {
+    return nullptr;
+  }
+  int i = 0;
+#ifdef __SSE2__
+  const __m128i first = _mm_set1_epi8(needle[0]);
+  const __m128i last = _mm_set1_epi8(needle[m - 1]);
+  for (; i + m - 1 + 16 <= n; i += 16) {
+    const __m128i a = _mm_loadu_si128((const __m128i *)(hay + i));
+    const __m128i b = _mm_loadu_si128((const __m128i *)(hay + i + m - 1));
+    int mask = _mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+    while (mask) {
+      const int k = __builtin_ctz(mask);
+      if (!memcmp(hay + i + k + 1, needle + 1, m - 2 > 0 ? m - 2 : 0)) {
+        return hay + i + k;
+      }
+      mask &= mask - 1;
+    }
+  }
+#endif
+  return (const char *)memmem(hay + i, n - i, needle, m);
+}
 
-    // next line;
-    // assert(right.advance().eof() || left.line + 1 ==
-    // right.advance().line); left = right.advance();
+// ===FUZZY===
+// fzf-style matching of a query against short strings such as paths: the
+// bytes of the query must appear in the string in order, but need not be
+// adjacent. Candidates are first checked against a mask of the bytes they
+// contain, then for the subsequence, and only the survivors are scored.
+
+// the bucket of the byte `c` in a `fuzzy_mask`, case folded.
+int fuzzy_bucket(char c) {
+  c = tolower((unsigned char)c);
+  if (c >= 'a' && c <= 'z') {
+    return c - 'a';
   }
+  if (c >= '0' && c <= '9') {
+    return 26 + c - '0';
+  }
+  return 36 + (unsigned char)c % 28;
+}
 
-  mu_layout_end_column(ctx);
+// the set of buckets of the bytes of `s`. A string can only contain `q` as
+// a subsequence if its mask holds every bit of the mask of `q`.
+uint64_t fuzzy_mask(const char *s, int n) {
+  uint64_t mask = 0;
+  for (int i = 0; i < n; ++i) {
+    mask |= 1ull << fuzzy_bucket(s[i]);
+  }
+  return mask;
 }
 
-static void editor_window(mu_Context *ctx, EventState *event,
-                          EditorState *editor, BottomlineState *bot,
-                          FocusState *focus, const CommandPaletteState *pal) {
-  if (mu_begin_window(ctx, "Editor", mu_rect(0, 0, width, height))) {
-    int width_row[] = {-1};
-    mu_layout_row(ctx, 1, width_row, -25);
-    mu_layout_row(ctx, 1, width_row, -1);
-    mu_editor(ctx, event, editor, focus, pal);
-    mu_bottom_line(ctx, bot);
-    mu_end_window(ctx);
+// smart case: a query without upper case letters matches either case.
+bool fuzzy_folds(const char *q, int m) {
+  for (int i = 0; i < m; ++i) {
+    if (isupper((unsigned char)q[i])) {
+      return false;
+    }
   }
+  return true;
 }
 
-int button_map(int sdl_key) {
-  if (sdl_key == SDL_BUTTON_LEFT) {
-    return MU_MOUSE_LEFT;
-  } else if (sdl_key == SDL_BUTTON_RIGHT) {
-    return MU_MOUSE_RIGHT;
-  } else if (sdl_key == SDL_BUTTON_MIDDLE) {
-    return MU_MOUSE_MIDDLE;
+bool fuzzy_eq(char a, char b, bool fold) {
+  return fold ? tolower((unsigned char)a) == b : a == b;
+}
+
+// whether `q` is a subsequence of `s`.
+bool fuzzy_subsequence(const char *s, int n, const char *q, int m,
+                       bool fold) {
+  int i = 0;
+  for (int j = 0; j < n && i < m; ++j) {
+    i += fuzzy_eq(s[j], q[i], fold);
+  }
+  return i == m;
+}
+
+static const int FUZZY_NONE = INT_MIN / 2;
+static const int FUZZY_SCORE_MATCH = 16;
+static const int FUZZY_GAP_START = 3;
+static const int FUZZY_GAP_EXTENSION = 1;
+static const int FUZZY_BONUS_CONSECUTIVE = 4;
+static const int FUZZY_BONUS_FIRST_CHAR = 2; // multiplies the first bonus.
+
+// bonus for a match at `s[j]`, for starting a path component, a word, or a
+// camelCase hump.
+int fuzzy_bonus(const char *s, int j) {
+  if (j == 0 || s[j - 1] == '/') {
+    return 10;
+  }
+  const char prev = s[j - 1];
+  if (prev == '_' || prev == '-' || prev == '.' || prev == ' ') {
+    return 8;
+  }
+  if (islower((unsigned char)prev) && isupper((unsigned char)s[j])) {
+    return 7;
   }
   return 0;
 }
 
-int key_map(int sdl_key) {
-  if (sdl_key == SDLK_LSHIFT)
-    return KEY_SHIFT;
-  if (sdl_key == SDLK_RSHIFT)
-    return KEY_SHIFT;
-  if (sdl_key == SDLK_LCTRL || sdl_key == SDLK_RCTRL) {
-    return KEY_CTRL;
+// the best score of an alignment of `q` against `s`, Smith-Waterman style
+// with affine gaps, or FUZZY_NONE. Fills `pos`, if given, with the indices
+// of `s` that the best alignment matches.
+int fuzzy_score(const char *s, int n, const char *q, int m, bool fold,
+                std::vector<int> *pos) {
+  if (pos) {
+    pos->clear();
   }
-  if (sdl_key == SDLK_RCTRL)
-    return KEY_CTRL;
-  if (sdl_key == SDLK_LALT)
-    return KEY_ALT;
-  if (sdl_key == SDLK_RALT)
-    return KEY_ALT;
-  if (sdl_key == SDLK_RETURN)
-    return KEY_RETURN;
-  if (sdl_key == SDLK_UP)
-    return KEY_UPARROW;
-  if (sdl_key == SDLK_DOWN)
-    return KEY_DOWNARROW;
-  if (sdl_key == SDLK_LEFT)
-    return KEY_LEFTARROW;
-  if (sdl_key == SDLK_RIGHT)
-    return KEY_RIGHTARROW;
-  if (sdl_key == SDLK_BACKSPACE)
-    return KEY_BACKSPACE;
-  if (sdl_key == SDLK_p)
-    return KEY_COMMAND_PALETTE;
-  if (sdl_key == SDLK_d)
-    return KEY_D;
-  if (sdl_key == SDLK_c)
-    return KEY_C;
-  if (sdl_key == SDLK_u)
-    return KEY_U;
-  if (sdl_key == SDLK_h)
-    return KEY_H;
-  if (sdl_key == SDLK_j)
-    return KEY_J;
-  if (sdl_key == SDLK_k)
-    return KEY_K;
-  if (sdl_key == SDLK_l)
-    return KEY_L;
-  if (sdl_key == SDLK_i)
-    return KEY_I;
-  if (sdl_key == SDLK_a)
-    return KEY_A;
-  if (sdl_key == SDLK_e)
-    return KEY_E;
-  if (sdl_key == SDLK_TAB) {
-    return KEY_TAB;
+  if (m == 0) {
+    return 0;
+  }
+  if (m > n) {
+    return FUZZY_NONE;
+  }
+  // h[i * n + j]: best score of q[0..i] with q[i] matched at s[j].
+  std::vector<int> h(m * n, FUZZY_NONE);
+  for (int j = 0; j < n; ++j) {
+    if (fuzzy_eq(s[j], q[0], fold)) {
+      h[j] = FUZZY_SCORE_MATCH + fuzzy_bonus(s, j) * FUZZY_BONUS_FIRST_CHAR;
+    }
+  }
+  for (int i = 1; i < m; ++i) {
+    const int *prev = &h[(i - 1) * n];
+    int *cur = &h[i * n];
+    // best of prev[k] - gap for k < j - 1, carried along the row.
+    int gap = FUZZY_NONE;
+    for (int j = i; j < n; ++j) {
+      if (j >= 2) {
+        gap = std::max(gap - FUZZY_GAP_EXTENSION,
+                       prev[j - 2] - FUZZY_GAP_START);
+      }
+      if (!fuzzy_eq(s[j], q[i], fold)) {
+        continue;
+      }
+      const int best = std::max(prev[j - 1] + FUZZY_BONUS_CONSECUTIVE, gap);
+      if (best > FUZZY_NONE / 2) {
+        cur[j] = best + FUZZY_SCORE_MATCH + fuzzy_bonus(s, j);
+      }
+    }
+  }
+  const int *last = &h[(m - 1) * n];
+  int j = std::max_element(last, last + n) - last;
+  const int score = last[j];
+  if (score <= FUZZY_NONE / 2 || !pos) {
+    return score <= FUZZY_NONE / 2 ? FUZZY_NONE : score;
+  }
+
+  // walk the alignment back from its end.
+  pos->resize(m);
+  for (int i = m - 1;; --i) {
+    (*pos)[i] = j;
+    if (i == 0) {
+      break;
+    }
+    const int *prev = &h[(i - 1) * n];
+    const int want = h[i * n + j] - FUZZY_SCORE_MATCH - fuzzy_bonus(s, j);
+    if (prev[j - 1] + FUZZY_BONUS_CONSECUTIVE == want) {
+      j = j - 1;
+      continue;
+    }
+    int k = j - 2;
+    while (prev[k] - FUZZY_GAP_START - FUZZY_GAP_EXTENSION * (j - 2 - k) !=
+           want) {
+      assert(k > 0);
+      k--;
+    }
+    j = k;
+  }
+  return score;
+}
+
+// ===SYMBOLS===
+// The definitions in the C and C++ files of the workspace, so that the
+// palette can jump to a symbol by its name rather than to every mention of
+// it, see `PALETTE_SYMBOL_PREFIX`. The index workers extract them as they
+// read each file: with tree-sitter when its C++ grammar is built in (see
+// SMOL_TREE_SITTER_CPP in CMakeLists.txt), or else with a lexical scan that
+// knows the shapes of the common definitions. The symbols of a shard are
+// sorted by case-folded name into a run, so a query is a binary search of
+// each run.
+
+enum class SymbolKind : uint8_t {
+  Function,
+  Type,
+  Macro,
+  Namespace,
+  Constant, // an enumerator.
+  Field,
+};
+
+struct Symbol {
+  File *file = nullptr;
+  int name = 0; // `file->buf[name, name + len)` is the name.
+  int len = 0;
+  int begin = 0; // the definition is `file->buf[begin, end)`.
+  int end = 0;
+  SymbolKind kind = SymbolKind::Function;
+};
+
+// whether symbols are extracted from the file at `path`, by its extension.
+bool symbols_wanted(const std::string &path) {
+  static const char *const EXTENSIONS[] = {".c",   ".h",   ".cc",
+                                           ".cpp", ".cxx", ".hh",
+                                           ".hpp", ".hxx", ".inl"};
+  const size_t dot = path.rfind('.');
+  if (dot == std::string::npos || path.find('/', dot) != std::string::npos) {
+    return false;
+  }
+  for (const char *ext : EXTENSIONS) {
+    if (!strcmp(path.c_str() + dot, ext)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *symbol_name(const Symbol &s) { return s.file->buf + s.name; }
+
+// `c` in lower case, if it is an ASCII letter. Unlike tolower, this does
+// not depend on the locale.
+inline int symbol_fold(char c) {
+  return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : (unsigned char)c;
+}
+
+// compare `a[0, n)` to `b[0, m)` case folded, as strcmp does.
+int symbol_compare(const char *a, int n, const char *b, int m) {
+  for (int i = 0; i < std::min(n, m); ++i) {
+    const int d = symbol_fold(a[i]) - symbol_fold(b[i]);
+    if (d) {
+      return d;
+    }
+  }
+  return n - m;
+}
+
+// the order of a run: by case-folded name, then by name.
+bool symbol_less(const Symbol &a, const Symbol &b) {
+  const int d = symbol_compare(symbol_name(a), a.len, symbol_name(b), b.len);
+  if (d) {
+    return d < 0;
+  }
+  return memcmp(symbol_name(a), symbol_name(b), a.len) < 0;
+}
+
+// the range [*begin, *end) of `run` whose names start with `q[0, n)`, case
+// folded.
+void symbol_range(const std::vector<Symbol> &run, const char *q, int n,
+                  int *begin, int *end) {
+  auto cmp = [&](const Symbol &s) {
+    return symbol_compare(symbol_name(s), std::min(s.len, n), q, n);
+  };
+  const auto b = std::partition_point(
+      run.begin(), run.end(), [&](const Symbol &s) { return cmp(s) < 0; });
+  const auto e = std::partition_point(
+      b, run.end(), [&](const Symbol &s) { return cmp(s) == 0; });
+  *begin = b - run.begin();
+  *end = e - run.begin();
+}
+
+// a symbol whose name starts with `q[0, n)` scores higher when it is all of
+// the name, matches its case, and names a type or function rather than a
+// field or constant.
+int symbol_score(const Symbol &s, const char *q, int n) {
+  int score = 0;
+  if (s.len == n) {
+    score += 64;
+  }
+  if (!memcmp(symbol_name(s), q, n)) {
+    score += 32;
+  }
+  score -= std::min(s.len - n, 32);
+  if (s.kind == SymbolKind::Constant || s.kind == SymbolKind::Field) {
+    score -= 8;
+  }
+  return score;
+}
+
+// a token of the lexical scan: `type` is 'w' for a word, '0' for a number,
+// '"' for a string or character literal, ':' for `::` and '>' for `->` when
+// `end - begin` is 2, or else the punctuator.
+struct SymbolToken {
+  char type = 0;
+  int begin = 0;
+  int end = 0;
+};
+
+// what the braces that are open in the lexical scan enclose: a scope whose
+// definitions are looked for, the enumerators of an enum, or anything else,
+// which is skipped.
+enum class SymbolScope { Scope, Enum, Skip };
+
+bool symbol_word_char(char c) { return isalnum((unsigned char)c) || c == '_'; }
+
+bool symbol_token_is(const File *f, const SymbolToken &t, const char *w) {
+  const int n = strlen(w);
+  return t.type == 'w' && t.end - t.begin == n &&
+         !memcmp(f->buf + t.begin, w, n);
+}
+
+// the words that are followed by a `(` without naming a function.
+bool symbol_token_keyword(const File *f, const SymbolToken &t) {
+  static const char *const KEYWORDS[] = {
+      "if",       "for",           "while",          "switch",
+      "catch",    "return",        "sizeof",         "alignof",
+      "alignas",  "decltype",      "typeof",         "__typeof__",
+      "noexcept", "static_assert", "_Static_assert", "requires",
+      "operator", "__attribute__", "__declspec",     "throw",
+      "defined",  "asm",           "__asm__"};
+  for (const char *w : KEYWORDS) {
+    if (symbol_token_is(f, t, w)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// the index past the `open` at `d[k]` and what it encloses, up to the `close`
+// that matches it.
+int symbol_skip_group(const std::vector<SymbolToken> &d, int k, char open,
+                      char close) {
+  int depth = 0;
+  for (; k < (int)d.size(); ++k) {
+    if (d[k].type == open) {
+      depth++;
+    } else if (d[k].type == close && --depth == 0) {
+      return k + 1;
+    }
+  }
+  return k;
+}
+
+// the index of the first token of `d` past its `template <...>` prefixes.
+int symbol_skip_template(const File *f, const std::vector<SymbolToken> &d) {
+  int k = 0;
+  while (k < (int)d.size() && symbol_token_is(f, d[k], "template")) {
+    k++;
+    if (k < (int)d.size() && d[k].type == '<') {
+      k = symbol_skip_group(d, k, '<', '>');
+    }
+  }
+  return k;
+}
+
+int symbol_add(std::vector<Symbol> *out, File *f, const SymbolToken &name,
+               int begin, int end, SymbolKind kind) {
+  Symbol s;
+  s.file = f;
+  s.name = name.begin;
+  s.len = name.end - name.begin;
+  s.begin = begin;
+  s.end = end;
+  s.kind = kind;
+  out->push_back(s);
+  return out->size() - 1;
+}
+
+// the declaration `d` that ends with a `;` at `end` in a scope: a typedef or
+// an alias is a type. Others are not definitions.
+void symbols_declaration(File *f, const std::vector<SymbolToken> &d, int end,
+                         std::vector<Symbol> *out) {
+  const int k = symbol_skip_template(f, d);
+  if (k >= (int)d.size()) {
+    return;
+  }
+  if (symbol_token_is(f, d[k], "using")) {
+    if (k + 2 < (int)d.size() && d[k + 1].type == 'w' && d[k + 2].type == '=') {
+      symbol_add(out, f, d[k + 1], d[0].begin, end, SymbolKind::Type);
+    }
+    return;
+  }
+  if (!symbol_token_is(f, d[k], "typedef")) {
+    return;
+  }
+  // a pointer to function is named in the first parentheses, as in
+  // `typedef int (*name)(int)`, any other type last.
+  int name = -1;
+  for (int j = k + 1; j < (int)d.size(); ++j) {
+    if (d[j].type == '(') {
+      while (++j < (int)d.size() && d[j].type != 'w' && d[j].type != ')') {
+      }
+      name = j < (int)d.size() && d[j].type == 'w' ? j : -1;
+      break;
+    }
+    if (d[j].type == '[') {
+      j = symbol_skip_group(d, j, '[', ']') - 1;
+    } else if (d[j].type == 'w') {
+      name = j;
+    }
+  }
+  if (name > k) {
+    symbol_add(out, f, d[name], d[0].begin, end, SymbolKind::Type);
+  }
+}
+
+// the declaration `d` is followed by a `{` in a scope: say what the braces
+// enclose, and add the symbol that they define, if any, whose index is
+// returned. `*resume` is whether `d` goes on once they close, as in
+// `typedef struct {...} name;`.
+int symbols_definition(File *f, const std::vector<SymbolToken> &d,
+                       std::vector<Symbol> *out, SymbolScope *scope,
+                       bool *resume) {
+  *scope = SymbolScope::Skip;
+  *resume = true;
+  const int k = symbol_skip_template(f, d);
+  if (k >= (int)d.size()) {
+    return -1;
+  }
+  const int begin = d[0].begin;
+  if (symbol_token_is(f, d[k], "extern") && (int)d.size() == k + 2 &&
+      d[k + 1].type == '"') {
+    *scope = SymbolScope::Scope;
+    *resume = false;
+    return -1;
+  }
+  int j = k + (symbol_token_is(f, d[k], "inline") ||
+               symbol_token_is(f, d[k], "typedef"));
+  if (j < (int)d.size() && symbol_token_is(f, d[j], "namespace")) {
+    *scope = SymbolScope::Scope;
+    *resume = false;
+    // the last word, of `a::b::c` too, or none for an anonymous namespace.
+    return d.back().type == 'w' && (int)d.size() > j + 1
+               ? symbol_add(out, f, d.back(), begin, begin,
+                            SymbolKind::Namespace)
+               : -1;
+  }
+  if (j < (int)d.size() && (symbol_token_is(f, d[j], "struct") ||
+                       symbol_token_is(f, d[j], "class") ||
+                       symbol_token_is(f, d[j], "union") ||
+                       symbol_token_is(f, d[j], "enum"))) {
+    const bool is_enum = symbol_token_is(f, d[j], "enum");
+    j++;
+    if (is_enum && j < (int)d.size() &&
+        (symbol_token_is(f, d[j], "class") ||
+         symbol_token_is(f, d[j], "struct"))) {
+      j++;
+    }
+    // the name is the last word before the body or the bases, past any
+    // attributes and export macros.
+    int name = -1;
+    while (j < (int)d.size()) {
+      if (d[j].type == '[') {
+        j = symbol_skip_group(d, j, '[', ']');
+      } else if ((symbol_token_is(f, d[j], "__attribute__") ||
+                  symbol_token_is(f, d[j], "__declspec") ||
+                  symbol_token_is(f, d[j], "alignas")) &&
+                 j + 1 < (int)d.size() && d[j + 1].type == '(') {
+        j = symbol_skip_group(d, j + 1, '(', ')');
+      } else if (d[j].type == 'w') {
+        if (!symbol_token_is(f, d[j], "final")) {
+          name = j;
+        }
+        j++;
+      } else if (d[j].type == ':' && d[j].end - d[j].begin == 2) {
+        j++;
+      } else {
+        break;
+      }
+    }
+    if (j < (int)d.size() && d[j].type == '<') {
+      j = symbol_skip_group(d, j, '<', '>');
+    }
+    if (j == (int)d.size() ||
+        (d[j].type == ':' && d[j].end - d[j].begin == 1)) {
+      *scope = is_enum ? SymbolScope::Enum : SymbolScope::Scope;
+      return name == -1 ? -1
+                        : symbol_add(out, f, d[name], begin, begin,
+                                     SymbolKind::Type);
+    }
+    // a function that returns `struct name`, say.
+  }
+  // a function is named by the word before its first `(`, unless that is an
+  // initializer such as `auto f = [](int x) {`. Operators are not named.
+  for (int p = k; p < (int)d.size(); ++p) {
+    if (symbol_token_is(f, d[p], "operator")) {
+      *resume = false;
+      return -1;
+    }
+    if (d[p].type == '=') {
+      return -1;
+    }
+    if (d[p].type != '(') {
+      continue;
+    }
+    *resume = false;
+    if (p == k || d[p - 1].type != 'w' || symbol_token_keyword(f, d[p - 1])) {
+      return -1;
+    }
+    SymbolToken name = d[p - 1];
+    if (p - 2 >= k && d[p - 2].type == '~') {
+      name.begin = d[p - 2].begin;
+    }
+    return symbol_add(out, f, name, begin, begin, SymbolKind::Function);
+  }
+  return -1;
+}
+
+// append the symbols of `f` to `out`, as found by a lexical scan: the
+// definitions at the top level, in namespaces and in classes are recognized
+// by the shape of the tokens that lead up to a `{` or `;` there. Function
+// bodies and initializers are skipped but for their braces. Both branches of
+// an #if are scanned, as if the other were not there.
+void symbols_scan(File *f, std::vector<Symbol> *out) {
+  const char *s = f->buf;
+  const int n = f->len;
+  int i = 0;
+  bool line_start = true; // only space since the last newline.
+
+  // a preprocessor line and its continuations, of which #define is a macro.
+  auto directive = [&]() {
+    const int begin = i;
+    int e = i;
+    while (e < n && s[e] != '\n') {
+      e += s[e] == '\\' ? 2 : 1;
+    }
+    e = std::min(e, n);
+    int j = i + 1;
+    while (j < e && (s[j] == ' ' || s[j] == '\t')) {
+      j++;
+    }
+    if (e - j > 6 && !memcmp(s + j, "define", 6) &&
+        (s[j + 6] == ' ' || s[j + 6] == '\t')) {
+      j += 6;
+      while (j < e && (s[j] == ' ' || s[j] == '\t')) {
+        j++;
+      }
+      SymbolToken name;
+      name.begin = j;
+      while (j < e && symbol_word_char(s[j])) {
+        j++;
+      }
+      name.end = j;
+      if (name.end > name.begin) {
+        symbol_add(out, f, name, begin, e, SymbolKind::Macro);
+      }
+    }
+    i = e;
+  };
+
+  auto next = [&](SymbolToken *t) {
+    while (i < n) {
+      const char c = s[i];
+      if (c == '\n') {
+        line_start = true;
+        i++;
+      } else if (isspace((unsigned char)c)) {
+        i++;
+      } else if (c == '/' && i + 1 < n && s[i + 1] == '/') {
+        while (i < n && s[i] != '\n') {
+          i++;
+        }
+      } else if (c == '/' && i + 1 < n && s[i + 1] == '*') {
+        const char *e = (const char *)memmem(s + i + 2, n - i - 2, "*/", 2);
+        i = e ? e - s + 2 : n;
+      } else if (c == '#' && line_start) {
+        directive();
+      } else {
+        break;
+      }
+    }
+    if (i >= n) {
+      return false;
+    }
+    line_start = false;
+    t->begin = i;
+    const char c = s[i];
+    if (symbol_word_char(c)) {
+      const bool number = isdigit((unsigned char)c);
+      while (i < n && (symbol_word_char(s[i]) ||
+                       (number && (s[i] == '.' ||
+                                   (s[i] == '\'' && i + 1 < n &&
+                                    symbol_word_char(s[i + 1])))))) {
+        i++;
+      }
+      t->type = number ? '0' : 'w';
+      if (!number && s[i - 1] == 'R' && i < n && s[i] == '"') {
+        // a raw string: R"delim( ... )delim".
+        const int open = i + 1;
+        int paren = open;
+        while (paren < n && s[paren] != '(' && s[paren] != '\n') {
+          paren++;
+        }
+        const std::string close =
+            ")" + std::string(s + open, paren - open) + "\"";
+        const char *e = (const char *)memmem(s + paren, n - paren,
+                                             close.data(), close.size());
+        i = e ? e - s + close.size() : n;
+        t->type = '"';
+      }
+    } else if (c == '"' || c == '\'') {
+      i++;
+      while (i < n && s[i] != c && s[i] != '\n') {
+        i += s[i] == '\\' ? 2 : 1;
+      }
+      i = std::min(i + 1, n);
+      t->type = '"';
+    } else if (c == ':' && i + 1 < n && s[i + 1] == ':') {
+      i += 2;
+      t->type = ':';
+    } else if (c == '-' && i + 1 < n && s[i + 1] == '>') {
+      i += 2;
+      t->type = '>';
+    } else {
+      i++;
+      t->type = c;
+    }
+    t->end = i;
+    return true;
+  };
+
+  // the braces that are open, innermost last. Each holds the declaration
+  // that was going on outside of it.
+  struct Open {
+    SymbolScope scope;
+    int symbol; // that the braces define, or -1.
+    bool resume;
+    std::vector<SymbolToken> outer;
+    int outer_parens;
+  };
+  std::vector<Open> open;
+  // the tokens since the last `;`, `{` or `}` of the innermost scope, and how
+  // deep in () and [] they are.
+  std::vector<SymbolToken> decl;
+  int parens = 0;
+  bool enumerator = false; // the next word of an enum is an enumerator.
+  SymbolToken t;
+  while (next(&t)) {
+    if (t.type == '}') {
+      if (open.empty()) {
+        continue;
+      }
+      Open o = std::move(open.back());
+      open.pop_back();
+      if (o.symbol != -1) {
+        (*out)[o.symbol].end = t.end;
+      }
+      decl.clear();
+      parens = 0;
+      if (o.resume) {
+        decl = std::move(o.outer);
+        parens = o.outer_parens;
+      }
+      continue;
+    }
+    const SymbolScope scope =
+        open.empty() ? SymbolScope::Scope : open.back().scope;
+    if (scope == SymbolScope::Skip) {
+      if (t.type == '{') {
+        open.push_back({SymbolScope::Skip, -1, false, {}, 0});
+      }
+      continue;
+    }
+    if (t.type == '(' || t.type == '[') {
+      parens++;
+    } else if (t.type == ')' || t.type == ']') {
+      parens = std::max(0, parens - 1);
+    }
+    if (scope == SymbolScope::Enum) {
+      if (t.type == '{') {
+        open.push_back({SymbolScope::Skip, -1, false, {}, 0});
+      } else if (parens == 0 && t.type == ',') {
+        enumerator = true;
+      } else if (enumerator && t.type == 'w') {
+        symbol_add(out, f, t, t.begin, t.end, SymbolKind::Constant);
+        enumerator = false;
+      } else {
+        enumerator = false;
+      }
+      continue;
+    }
+    if (t.type == '{') {
+      Open o;
+      o.symbol = -1;
+      o.scope = SymbolScope::Skip;
+      o.resume = true;
+      if (parens == 0) {
+        o.symbol = symbols_definition(f, decl, out, &o.scope, &o.resume);
+      }
+      o.outer = std::move(decl);
+      o.outer_parens = parens;
+      open.push_back(std::move(o));
+      decl.clear();
+      parens = 0;
+      enumerator = open.back().scope == SymbolScope::Enum;
+      continue;
+    }
+    if (parens == 0 && t.type == ';') {
+      symbols_declaration(f, decl, t.end, out);
+      decl.clear();
+      continue;
+    }
+    if (parens == 0 && t.type == ':' && t.end - t.begin == 1 &&
+        decl.size() == 1 &&
+        (symbol_token_is(f, decl[0], "public") ||
+         symbol_token_is(f, decl[0], "protected") ||
+         symbol_token_is(f, decl[0], "private"))) {
+      decl.clear();
+      continue;
+    }
+    decl.push_back(t);
+  }
+}
+
+#ifdef SMOL_TREE_SITTER_CPP
+extern "C" const TSLanguage *tree_sitter_cpp(void);
+
+// the definitions, each captured as its kind with its name as @name.
+static const char SYMBOL_QUERY[] = R"(
+(function_definition
+  declarator: [
+    (function_declarator declarator: (_) @name)
+    (pointer_declarator
+      declarator: (function_declarator declarator: (_) @name))
+    (reference_declarator (function_declarator declarator: (_) @name))
+  ]) @function
+(struct_specifier name: (_) @name body: (_)) @type
+(class_specifier name: (_) @name body: (_)) @type
+(union_specifier name: (_) @name body: (_)) @type
+(enum_specifier name: (_) @name body: (_)) @type
+(type_definition declarator: (type_identifier) @name) @type
+(alias_declaration name: (type_identifier) @name) @type
+(namespace_definition name: (_) @name) @namespace
+(preproc_def name: (identifier) @name) @macro
+(preproc_function_def name: (identifier) @name) @macro
+(enumerator name: (identifier) @name) @constant
+(field_declaration declarator: (field_identifier) @name) @field
+)";
+
+static const struct {
+  const char *capture;
+  SymbolKind kind;
+} SYMBOL_CAPTURES[] = {
+    {"function", SymbolKind::Function},   {"type", SymbolKind::Type},
+    {"namespace", SymbolKind::Namespace}, {"macro", SymbolKind::Macro},
+    {"constant", SymbolKind::Constant},   {"field", SymbolKind::Field},
+};
+
+// files larger than this are scanned rather than parsed: they are most
+// likely generated, and their trees would take more memory than the index.
+static const int SYMBOL_PARSE_MAX_BYTES = 4 << 20;
+
+// the query, compiled once and shared by the parsers of every worker, or
+// nullptr if the grammar does not take it.
+const TSQuery *symbol_query() {
+  static const TSQuery *query = [] {
+    uint32_t offset;
+    TSQueryError error;
+    return ts_query_new(tree_sitter_cpp(), SYMBOL_QUERY, strlen(SYMBOL_QUERY),
+                        &offset, &error);
+  }();
+  return query;
+}
+#endif
+
+// the parser that an index worker extracts symbols with.
+struct SymbolParser {
+#ifdef SMOL_TREE_SITTER_CPP
+  TSParser *parser = nullptr;
+  TSQueryCursor *cursor = nullptr;
+#endif
+};
+
+void symbol_parser_init(SymbolParser *p) {
+#ifdef SMOL_TREE_SITTER_CPP
+  if (symbol_query()) {
+    p->parser = ts_parser_new();
+    ts_parser_set_language(p->parser, tree_sitter_cpp());
+    p->cursor = ts_query_cursor_new();
+  }
+#endif
+}
+
+void symbol_parser_free(SymbolParser *p) {
+#ifdef SMOL_TREE_SITTER_CPP
+  if (p->parser) {
+    ts_query_cursor_delete(p->cursor);
+    ts_parser_delete(p->parser);
+  }
+  *p = SymbolParser();
+#endif
+}
+
+#ifdef SMOL_TREE_SITTER_CPP
+// append the symbols of `f` to `out`, as found in its tree. A qualified name
+// such as `ns::T<int>::f` is named by its last component.
+bool symbols_parse(SymbolParser *p, File *f, std::vector<Symbol> *out) {
+  if (!p->parser || f->len > SYMBOL_PARSE_MAX_BYTES) {
+    return false;
+  }
+  TSTree *tree = ts_parser_parse_string(p->parser, nullptr, f->buf, f->len);
+  if (!tree) {
+    return false;
+  }
+  const TSQuery *query = symbol_query();
+  ts_query_cursor_exec(p->cursor, query, ts_tree_root_node(tree));
+  TSQueryMatch match;
+  while (ts_query_cursor_next_match(p->cursor, &match)) {
+    Symbol s;
+    s.file = f;
+    for (int i = 0; i < match.capture_count; ++i) {
+      const TSQueryCapture &c = match.captures[i];
+      uint32_t len;
+      const std::string_view capture(
+          ts_query_capture_name_for_id(query, c.index, &len), len);
+      const int b = ts_node_start_byte(c.node);
+      const int e = ts_node_end_byte(c.node);
+      if (capture != "name") {
+        s.begin = b;
+        s.end = e;
+        for (const auto &k : SYMBOL_CAPTURES) {
+          if (capture == k.capture) {
+            s.kind = k.kind;
+          }
+        }
+        continue;
+      }
+      const std::string_view name(f->buf + b, e - b);
+      size_t nb = name.rfind("::");
+      nb = nb == std::string_view::npos ? 0 : nb + 2;
+      size_t ne = name.compare(nb, 8, "operator") ? name.find('<', nb)
+                                                   : std::string_view::npos;
+      ne = ne == std::string_view::npos ? name.size() : ne;
+      s.name = b + nb;
+      s.len = ne - nb;
+    }
+    if (s.len > 0) {
+      out->push_back(s);
+    }
+  }
+  ts_tree_delete(tree);
+  return true;
+}
+#endif
+
+// append the symbols of `f` to `out`, if it is a C or C++ file.
+void symbols_extract(SymbolParser *p, File *f, std::vector<Symbol> *out) {
+  if (!symbols_wanted(f->path)) {
+    return;
+  }
+#ifdef SMOL_TREE_SITTER_CPP
+  if (symbols_parse(p, f, out)) {
+    return;
+  }
+#endif
+  symbols_scan(f, out);
+}
+
+enum {
+  KEY_SHIFT = (1 << 0),
+  KEY_CTRL = (1 << 1),
+  KEY_ALT = (1 << 2),
+  KEY_BACKSPACE = (1 << 3),
+  KEY_RETURN = (1 << 4),
+  KEY_LEFTARROW = (1 << 5),
+  KEY_RIGHTARROW = (1 << 6),
+  KEY_UPARROW = (1 << 7),
+  KEY_DOWNARROW = (1 << 8),
+  KEY_COMMAND_PALETTE = (1 << 9),
+  KEY_TAB = (1 << 10),
+  KEY_D = (1 << 11),
+  KEY_U = (1 << 12),
+  KEY_H = (1 << 13),
+  KEY_J = (1 << 14),
+  KEY_K = (1 << 15),
+  KEY_L = (1 << 16),
+  KEY_C = (1 << 17),
+  KEY_A = (1 << 18),
+  KEY_E = (1 << 19),
+  KEY_I = (1 << 20),
+  KEY_S = (1 << 21),
+  KEY_R = (1 << 22),
+  KEY_V = (1 << 23),
+};
+
+struct EventState {
+  int key_pressed;   // true if key was pressed this frame. reset each frame.
+  int key_held_down; // true if key was held down.
+  char input_text[32];
+
+  EventState() {
+    this->key_pressed = 0;
+    this->key_held_down = 0;
+    this->input_text[0] = 0;
+  }
+
+  void start_frame() {
+    this->key_pressed = 0;
+    this->input_text[0] = 0;
+  }
+
+  void set_keydown(int key) {
+    this->key_pressed |= key;
+    this->key_held_down |= key;
+  }
+
+  void set_keyup(int key) { this->key_held_down &= ~key; }
+
+  void set_input_text(const char *text) {
+    printf("text: |%s|\n", text);
+    int len = strlen(input_text);
+    int size = strlen(text) + 1;
+    assert(len + size <= (int)sizeof(input_text));
+    memcpy(input_text + len, text, size);
+  }
+};
+
+// ===GAP BUFFER===
+// A gap buffer holds the line under the cursor while typing: text lives in
+// [0, gap_begin) and [gap_end, buf.size()), and inserting or deleting next to
+// the gap is O(1). Moving the gap costs the distance moved, which is small
+// when edits are clustered.
+
+struct GapBuffer {
+  static int NEXT_GEN;
+  std::vector<char> buf;
+  int gap_begin = 0;
+  int gap_end = 0;
+  int gen = 0; // changes whenever the text does, unique across buffers.
+};
+
+int GapBuffer::NEXT_GEN = 0;
+
+int gap_buffer_len(const GapBuffer *gb) {
+  return gb->buf.size() - (gb->gap_end - gb->gap_begin);
+}
+
+void gap_buffer_set(GapBuffer *gb, const char *s, int len) {
+  gb->buf.assign(s, s + len);
+  gb->buf.resize(std::max<int>(2 * len, 64));
+  gb->gap_begin = len;
+  gb->gap_end = gb->buf.size();
+  gb->gen = ++GapBuffer::NEXT_GEN;
+}
+
+void gap_buffer_move_gap(GapBuffer *gb, int ix) {
+  assert(ix >= 0 && ix <= gap_buffer_len(gb));
+  char *b = gb->buf.data();
+  if (ix < gb->gap_begin) {
+    const int n = gb->gap_begin - ix;
+    memmove(b + gb->gap_end - n, b + ix, n);
+    gb->gap_begin -= n;
+    gb->gap_end -= n;
+  } else if (ix > gb->gap_begin) {
+    const int n = ix - gb->gap_begin;
+    memmove(b + gb->gap_begin, b + gb->gap_end, n);
+    gb->gap_begin += n;
+    gb->gap_end += n;
+  }
+}
+
+void gap_buffer_insert(GapBuffer *gb, int ix, const char *s, int len) {
+  gap_buffer_move_gap(gb, ix);
+  if (gb->gap_end - gb->gap_begin < len) {
+    // grow the gap, keeping the text after it at the end of `buf`.
+    const int tail = gb->buf.size() - gb->gap_end;
+    const int size = 2 * (gap_buffer_len(gb) + len);
+    gb->buf.resize(size);
+    memmove(gb->buf.data() + size - tail, gb->buf.data() + gb->gap_end, tail);
+    gb->gap_end = size - tail;
+  }
+  memcpy(gb->buf.data() + gb->gap_begin, s, len);
+  gb->gap_begin += len;
+  gb->gen = ++GapBuffer::NEXT_GEN;
+}
+
+// delete the `n` bytes before `ix`.
+void gap_buffer_delete_backward(GapBuffer *gb, int ix, int n) {
+  assert(n >= 0 && n <= ix);
+  gap_buffer_move_gap(gb, ix);
+  gb->gap_begin -= n;
+  gb->gen = ++GapBuffer::NEXT_GEN;
+}
+
+std::string gap_buffer_string(const GapBuffer *gb) {
+  std::string s(gb->buf.data(), gb->gap_begin);
+  s.append(gb->buf.data() + gb->gap_end, gb->buf.size() - gb->gap_end);
+  return s;
+}
+
+struct Cursor {
+  int line = 0;
+  int col = 0;
+};
+
+// editor mode
+enum EditMode { Insert, Normal, Visual };
+
+// a snapshot of the text in the undo tree. See `editor_history_commit`.
+struct HistoryEntry {
+  PieceNode *root = nullptr; // holds a reference.
+  int origlen = 0;           // bytes of the file loaded when it was taken.
+  int disk_epoch = 0;        // `EditorState::disk_epoch` when it was taken.
+  Cursor cursor;             // where the cursor was after the edit.
+  int parent = -1;           // the entry this one was edited from.
+  int redo = -1;             // the child that was undone from last.
+  long long bytes = 0;       // memory held by this entry alone, estimated.
+};
+
+// entries are keyed by an increasing id, so the oldest comes first.
+struct History {
+  std::map<int, HistoryEntry> entries;
+  int cur = -1; // the entry the text was last committed to or restored from.
+  int next_id = 0;
+  long long bytes = 0;
+  // `EditorState::text.add` at the last commit, to estimate what the next
+  // entry costs.
+  int last_add_len = 0;
+};
+
+// the state of the editor is a geodesic?
+struct EditorState {
+  EditMode mode = Normal;
+  PieceTable text;
+  // the line being typed into, or -1. While set, the contents of that line
+  // live in `active` and its copy in `text` is stale. Written back by
+  // `editor_flush_active_line` when the cursor leaves the line.
+  int active_line = -1;
+  GapBuffer active;
+  // the file backing `text.orig`, or nullptr for a scratch buffer. Files are
+  // loaded in chunks, see `editor_open`.
+  File *file = nullptr;
+  // where `text` is saved to, or empty. Pieces know where their bytes are
+  // in this file, see `Piece::disk`. `disk_len` and `disk_mtime` describe
+  // the file as of the last load or save.
+  std::string path;
+  int disk_len = 0;
+  struct timespec disk_mtime = {};
+  bool save_requested = false;
+  // bumped by every save. `Piece::disk` in snapshots from an older epoch no
+  // longer describes the file; restoring one sets `disk_stale`.
+  int disk_epoch = 0;
+  bool disk_stale = false;
+  History history;
+  // false once a loaded chunk of the file turned out not to be UTF-8.
+  bool utf8_valid = true;
+  // the columns of lines used recently, for `text.version`. Cleared when the
+  // text changes, or when there are too many.
+  std::unordered_map<int, LineColumns> columns;
+  int columns_version = -1;
+  // the lines edited since the index last caught up, as one edit. See
+  // `task_manager_reindex_timeslice`.
+  std::optional<LineEdit> index_edit;
+};
+
+int editor_num_lines(const EditorState *editor) {
+  return editor->text.nlines + 1;
+}
+
+int editor_line_len(const EditorState *editor, int line) {
+  if (line == editor->active_line) {
+    return gap_buffer_len(&editor->active);
+  }
+  return piece_table_line_len(&editor->text, line);
+}
+
+// byte offset of (line, col) in the editor text. There must be no active
+// line, since it would shift the offsets after it.
+int editor_offset(const EditorState *editor, int line, int col) {
+  assert(editor->active_line == -1);
+  assert(col >= 0 && col <= editor_line_len(editor, line));
+  return piece_table_line_begin(&editor->text, line) + col;
+}
+
+std::string editor_line(const EditorState *editor, int line) {
+  if (line == editor->active_line) {
+    return gap_buffer_string(&editor->active);
+  }
+  const int begin = piece_table_line_begin(&editor->text, line);
+  std::string s(piece_table_line_len(&editor->text, line), 0);
+  piece_table_copy(&editor->text, begin, s.size(), s.data());
+  return s;
+}
+
+// note for the index that lines [line, line + del) were replaced by `ins`
+// lines.
+void editor_note_edit(EditorState *editor, int line, int del, int ins) {
+  LineEdit e;
+  e.line = line;
+  e.del = del;
+  e.ins = ins;
+  editor->index_edit =
+      editor->index_edit ? line_edit_merge(*editor->index_edit, e) : e;
+}
+
+// write the active line back into the piece table. Only the bytes between
+// the common prefix and suffix of the old and new line are replaced.
+void editor_flush_active_line(EditorState *editor) {
+  const int line = editor->active_line;
+  if (line == -1) {
+    return;
+  }
+  editor->active_line = -1;
+  const std::string old = editor_line(editor, line);
+  const std::string cur = gap_buffer_string(&editor->active);
+  int pre = 0;
+  while (pre < (int)old.size() && pre < (int)cur.size() &&
+         old[pre] == cur[pre]) {
+    pre++;
+  }
+  int suf = 0;
+  while (suf < (int)old.size() - pre && suf < (int)cur.size() - pre &&
+         old[old.size() - 1 - suf] == cur[cur.size() - 1 - suf]) {
+    suf++;
+  }
+  const int begin = editor_offset(editor, line, pre);
+  piece_table_delete(&editor->text, begin, old.size() - pre - suf);
+  piece_table_insert(&editor->text, begin, cur.data() + pre,
+                     cur.size() - pre - suf);
+}
+
+// make `line` the active line, flushing the previous one.
+void editor_activate_line(EditorState *editor, int line) {
+  if (editor->active_line == line) {
+    return;
+  }
+  editor_flush_active_line(editor);
+  const std::string s = editor_line(editor, line);
+  gap_buffer_set(&editor->active, s.data(), s.size());
+  editor->active_line = line;
+}
+
+static const int EDITOR_MAX_CACHED_LINES = 1024;
+
+// the columns of `line`. Valid until the next call.
+const LineColumns *editor_line_columns(EditorState *editor, int line) {
+  if (editor->columns_version != editor->text.version ||
+      editor->columns.size() > EDITOR_MAX_CACHED_LINES) {
+    editor->columns.clear();
+    editor->columns_version = editor->text.version;
+  }
+  const int gen = line == editor->active_line ? editor->active.gen : -1;
+  auto it = editor->columns.find(line);
+  if (it != editor->columns.end() && it->second.gen == gen) {
+    return &it->second;
+  }
+  LineColumns &lc = editor->columns[line];
+  line_columns_build(&lc, editor_line(editor, line));
+  lc.gen = gen;
+  return &lc;
+}
+
+// the column the cursor is at on screen.
+int cursor_column(EditorState *editor, Cursor cursor) {
+  return line_columns_col(editor_line_columns(editor, cursor.line),
+                          cursor.col);
+}
+
+// move to `line`, keeping the cursor in the same column on screen.
+Cursor cursor_to_line(EditorState *editor, Cursor cursor, int line) {
+  const int col = cursor_column(editor, cursor);
+  cursor.line = line;
+  cursor.col = line_columns_ix(editor_line_columns(editor, line), col);
+  return cursor;
+}
+
+Cursor cursor_up(EditorState *editor, Cursor cursor) {
+  return cursor_to_line(editor, cursor, std::max<int>(0, cursor.line - 1));
+};
+
+Cursor cursor_down(EditorState *editor, Cursor cursor) {
+  return cursor_to_line(editor, cursor,
+                        std::min<int>(editor_num_lines(editor) - 1,
+                                      cursor.line + 1));
+};
+
+// one character to the left, within the line.
+Cursor cursor_left(EditorState *editor, Cursor cursor) {
+  if (cursor.col > 0) {
+    cursor.col =
+        line_columns_prev(editor_line_columns(editor, cursor.line), cursor.col);
+  }
+  return cursor;
+}
+
+// one character to the right, within the line.
+Cursor cursor_right(EditorState *editor, Cursor cursor) {
+  if (cursor.col < editor_line_len(editor, cursor.line)) {
+    cursor.col =
+        line_columns_next(editor_line_columns(editor, cursor.line), cursor.col);
+  }
+  return cursor;
+}
+
+Cursor cursor_dollar(EditorState *editor, Cursor cursor) {
+  cursor.col = editor_line_len(editor, cursor.line);
+  return cursor;
+}
+
+Cursor cursor_hat(EditorState *editor, Cursor cursor) {
+  cursor.col = 0;
+  return cursor;
+};
+
+// ===EDIT COMMANDS===
+// Edits as data. A batch records insert, delete, split and join commands
+// whose positions all refer to the text as it was before the batch, and
+// `editor_apply_batch` applies them in one pass: the inserted bytes go to the
+// add buffer in one append, and the piece tree is cut once at each edited
+// offset and put back together, so the text changes exactly once. Paste,
+// several cursors or a replayed macro thus cost one mutation (and one history
+// entry) rather than one per character.
+
+enum class EditCommandKind { Insert, Delete, Split, Join };
+
+struct EditCommand {
+  EditCommandKind kind = EditCommandKind::Insert;
+  int line = 0;
+  int col = 0;  // unused by `Join`, which joins `line` with the next.
+  int len = 0;  // bytes deleted, or bytes inserted.
+  int text = 0; // where the inserted bytes begin in `EditBatch::text`.
+};
+
+struct EditBatch {
+  std::vector<EditCommand> cmds;
+  std::string text; // the bytes of all inserts, back to back.
+};
+
+void edit_batch_insert(EditBatch *b, int line, int col, const char *s,
+                       int len) {
+  assert(len >= 0);
+  EditCommand c;
+  c.kind = EditCommandKind::Insert;
+  c.line = line;
+  c.col = col;
+  c.len = len;
+  c.text = b->text.size();
+  b->text.append(s, len);
+  b->cmds.push_back(c);
+}
+
+// delete `len` bytes starting at (line, col). May run past the end of line.
+void edit_batch_delete(EditBatch *b, int line, int col, int len) {
+  assert(len >= 0);
+  EditCommand c;
+  c.kind = EditCommandKind::Delete;
+  c.line = line;
+  c.col = col;
+  c.len = len;
+  b->cmds.push_back(c);
+}
+
+// split `line` in two at `col`.
+void edit_batch_split(EditBatch *b, int line, int col) {
+  EditCommand c;
+  c.kind = EditCommandKind::Split;
+  c.line = line;
+  c.col = col;
+  c.len = 1;
+  b->cmds.push_back(c);
+}
+
+// join `line` with the line after it.
+void edit_batch_join(EditBatch *b, int line) {
+  EditCommand c;
+  c.kind = EditCommandKind::Join;
+  c.line = line;
+  c.len = 1;
+  b->cmds.push_back(c);
+}
+
+// a command resolved to byte offsets: delete [off, off + del), then insert
+// `ins` bytes of the add buffer from `addstart` at `off`.
+struct EditOp {
+  int off = 0;
+  int del = 0;
+  int addstart = 0;
+  int ins = 0;
+};
+
+// where byte `ix` of the text before `ops` ends up after them. Text inserted
+// at `ix` goes before it, and bytes that were deleted go to where the
+// deletion was.
+int edit_ops_map_offset(const std::vector<EditOp> &ops, int ix) {
+  int shift = 0;
+  for (const EditOp &op : ops) {
+    if (op.off > ix) {
+      break;
+    }
+    if (ix < op.off + op.del) {
+      return op.off + shift + op.ins;
+    }
+    shift += op.ins - op.del;
+  }
+  return ix + shift;
+}
+
+// apply the commands of `b`, and return where `cursor` ends up. Commands
+// must not delete overlapping ranges; inserts at the same position end up in
+// the order they were recorded.
+Cursor editor_apply_batch(EditorState *editor, const EditBatch *b,
+                          Cursor cursor) {
+  // commands of length 0 change nothing and are dropped. A batch of only
+  // those leaves the text as it is, so it records no undo step either.
+  if (std::all_of(b->cmds.begin(), b->cmds.end(),
+                  [](const EditCommand &c) { return c.len == 0; })) {
+    return cursor;
+  }
+  editor_flush_active_line(editor);
+  PieceTable *pt = &editor->text;
+  const int addbase = pt->add.size();
+  pt->add += b->text;
+
+  std::vector<EditOp> ops;
+  ops.reserve(b->cmds.size());
+  for (const EditCommand &c : b->cmds) {
+    if (c.len == 0) {
+      continue;
+    }
+    EditOp op;
+    switch (c.kind) {
+    case EditCommandKind::Insert:
+      op.off = editor_offset(editor, c.line, c.col);
+      op.addstart = addbase + c.text;
+      op.ins = c.len;
+      break;
+    case EditCommandKind::Delete:
+      op.off = editor_offset(editor, c.line, c.col);
+      op.del = c.len;
+      break;
+    case EditCommandKind::Split:
+      op.off = editor_offset(editor, c.line, c.col);
+      op.addstart = pt->add.size();
+      op.ins = 1;
+      pt->add += '\n';
+      break;
+    case EditCommandKind::Join:
+      assert(c.line + 1 < editor_num_lines(editor));
+      op.off = editor_offset(editor, c.line, editor_line_len(editor, c.line));
+      op.del = 1;
+      break;
+    }
+    assert(op.off + op.del <= pt->len);
+    ops.push_back(op);
+  }
+  // by offset, with inserts before a delete at the same offset.
+  std::stable_sort(ops.begin(), ops.end(),
+                   [](const EditOp &a, const EditOp &b) {
+                     return a.off != b.off ? a.off < b.off
+                                           : (a.del > 0) < (b.del > 0);
+                   });
+
+  const int cursor_ix = editor_offset(editor, cursor.line, cursor.col);
+  // the lines from the first edited byte to the last.
+  const int edit_begin = ops.front().off;
+  int edit_end = 0;
+  for (const EditOp &op : ops) {
+    edit_end = std::max<int>(edit_end, op.off + op.del);
+  }
+  const int line_begin = piece_table_line_of(pt, edit_begin);
+  const int old_line_end = piece_table_line_of(pt, edit_end);
+  // `rest` is the old text from byte `pos` on; `out` is the new text so far.
+  PieceNode *rest = pt->root;
+  pt->root = nullptr;
+  PieceNode *out = nullptr;
+  int pos = 0;
+  for (const EditOp &op : ops) {
+    assert(op.off >= pos && "batch deletes overlap");
+    PieceNode *l;
+    piece_tree_split(pt, rest, op.off - pos, &l, &rest);
+    out = piece_tree_merge(out, l);
+    if (op.ins) {
+      out = piece_tree_merge(
+          out, piece_tree_from_span(pt, true, op.addstart, op.ins));
+    }
+    if (op.del) {
+      PieceNode *mid;
+      piece_tree_split(pt, rest, op.del, &mid, &rest);
+      piece_tree_decref(mid);
+    }
+    pos = op.off + op.del;
+  }
+  piece_table_set_root(pt, piece_tree_merge(out, rest));
+  const int new_line_end =
+      piece_table_line_of(pt, edit_ops_map_offset(ops, edit_end));
+  editor_note_edit(editor, line_begin, old_line_end - line_begin + 1,
+                   new_line_end - line_begin + 1);
+
+  const int ix = edit_ops_map_offset(ops, cursor_ix);
+  cursor.line = piece_table_line_of(pt, ix);
+  cursor.col = ix - piece_table_line_begin(pt, cursor.line);
+  return cursor;
+}
+
+// insert code into editor at cursor, and move cursor by string length.
+// newlines in `buf` split the line, and the cursor ends up after the last one.
+// Text without newlines goes into the gap buffer of the cursor's line, the
+// rest is one insert command.
+Cursor cursor_insert_str(EditorState *editor, Cursor cursor, const char *buf,
+                         int len) {
+  if (!memchr(buf, '\n', len)) {
+    editor_activate_line(editor, cursor.line);
+    gap_buffer_insert(&editor->active, cursor.col, buf, len);
+    editor_note_edit(editor, cursor.line, 1, 1);
+    cursor.col += len;
+    return cursor;
+  }
+
+  EditBatch b;
+  edit_batch_insert(&b, cursor.line, cursor.col, buf, len);
+  return editor_apply_batch(editor, &b, cursor);
+}
+
+Cursor cursor_delete_till_end_of_line(EditorState *editor, Cursor cursor) {
+  EditBatch b;
+  edit_batch_delete(&b, cursor.line, cursor.col,
+                    editor_line_len(editor, cursor.line) - cursor.col);
+  return editor_apply_batch(editor, &b, cursor);
+}
+
+// delete `n` characters before the cursor, within the line. Deleting within
+// the line is typing, and goes into the gap buffer.
+Cursor cursor_delete_backward(EditorState *editor, Cursor cursor, int n) {
+  assert(n >= 0);
+  int begin = cursor.col;
+  for (int i = 0; i < n && begin > 0; ++i) {
+    begin = line_columns_prev(editor_line_columns(editor, cursor.line), begin);
+  }
+  editor_activate_line(editor, cursor.line);
+  gap_buffer_delete_backward(&editor->active, cursor.col, cursor.col - begin);
+  editor_note_edit(editor, cursor.line, 1, 1);
+  cursor.col = begin;
+  return cursor;
+}
+
+// splice s of len `len` into line `l` beginning at col `col`. We must have
+// 0 <= col <= editor->lineline[line].
+void editor_splice_into_line(EditorState *editor, int line, int col,
+                             const char *s, int len) {
+  if (s == nullptr) {
+    assert(len == 0);
+  }
+  editor_flush_active_line(editor);
+  piece_table_insert(&editor->text, editor_offset(editor, line, col), s, len);
+  editor_note_edit(editor, line, 1, 1 + count_newlines(s, len));
+}
+
+void editor_append_line(EditorState *editor, int line, const char *s,
+                        int len) {
+  editor_splice_into_line(editor, line, editor_line_len(editor, line), s, len);
+}
+
+void editor_set_line(EditorState *editor, int line, const char *s, int len) {
+  if (s == nullptr) {
+    assert(len == 0);
+  }
+  editor_flush_active_line(editor);
+  const int begin = editor_offset(editor, line, 0);
+  piece_table_delete(&editor->text, begin, editor_line_len(editor, line));
+  piece_table_insert(&editor->text, begin, s, len);
+  editor_note_edit(editor, line, 1, 1 + count_newlines(s, len));
+}
+
+void editor_copy_line(EditorState *editor, int destix, int srcix) {
+  const std::string s = editor_line(editor, srcix);
+  editor_set_line(editor, destix, s.data(), s.size());
+}
+
+// join `line` with the line after it by removing the newline between them.
+void editor_join_line_with_next(EditorState *editor, int line) {
+  assert(line >= 0 && line + 1 < editor_num_lines(editor));
+  EditBatch b;
+  edit_batch_join(&b, line);
+  editor_apply_batch(editor, &b, Cursor());
+}
+
+void editor_remove_line(EditorState *editor, int line) {
+  assert(line >= 0 && line < editor_num_lines(editor));
+  editor_flush_active_line(editor);
+  const int begin = editor_offset(editor, line, 0);
+  const int len = editor_line_len(editor, line);
+  if (line + 1 < editor_num_lines(editor)) {
+    // remove the line and its newline.
+    piece_table_delete(&editor->text, begin, len + 1);
+  } else if (line > 0) {
+    // last line: remove the newline before it.
+    piece_table_delete(&editor->text, begin - 1, len + 1);
+  } else {
+    piece_table_delete(&editor->text, begin, len);
+    editor_note_edit(editor, line, 1, 1);
+    return;
+  }
+  editor_note_edit(editor, line, 1, 0);
+}
+
+// create an empty line before line.
+void editor_create_line_before(EditorState *editor, int line) {
+  assert(line >= 0 && line <= editor_num_lines(editor));
+  editor_flush_active_line(editor);
+  if (line == editor_num_lines(editor)) {
+    piece_table_insert(&editor->text, editor->text.len, "\n", 1);
+  } else {
+    piece_table_insert(&editor->text, editor_offset(editor, line, 0), "\n", 1);
+  }
+  editor_note_edit(editor, line, 0, 1);
+}
+
+// create an empty line after line.
+void editor_create_line_after(EditorState *editor, int line) {
+  editor_create_line_before(editor, line + 1);
+}
+
+// ===HISTORY===
+// Undo and redo. The piece tree is persistent, so a snapshot of the text is
+// a reference to its root: an edit copies only the nodes on the paths it
+// touches, and everything else is shared with the snapshots before it. The
+// snapshots form a tree: undo goes to the parent, redo to the child that was
+// last undone from, and editing after an undo starts a new branch.
+// The oldest entries are dropped once the history holds on to more than
+// HISTORY_MAX_BYTES.
+
+static const long long HISTORY_MAX_BYTES = 64 << 20;
+
+void editor_history_drop(EditorState *editor, int id) {
+  History *h = &editor->history;
+  auto it = h->entries.find(id);
+  assert(it != h->entries.end());
+  h->bytes -= it->second.bytes;
+  piece_tree_decref(it->second.root);
+  h->entries.erase(it);
+}
+
+// forget the history, and start it over from the current text.
+void editor_history_reset(EditorState *editor, Cursor cursor) {
+  History *h = &editor->history;
+  while (!h->entries.empty()) {
+    editor_history_drop(editor, h->entries.begin()->first);
+  }
+  h->cur = -1;
+  h->last_add_len = editor->text.add.size();
+
+  editor_flush_active_line(editor);
+  HistoryEntry e;
+  e.root = piece_tree_incref(editor->text.root);
+  e.origlen = editor->text.origlen;
+  e.disk_epoch = editor->disk_epoch;
+  e.cursor = cursor;
+  h->cur = h->next_id++;
+  h->entries[h->cur] = e;
+}
+
+// record the current text as a new entry if it changed since the last one.
+void editor_history_commit(EditorState *editor, Cursor cursor) {
+  editor_flush_active_line(editor);
+  History *h = &editor->history;
+  if (h->cur != -1 && h->entries.count(h->cur) &&
+      h->entries[h->cur].root == editor->text.root) {
+    return;
+  }
+
+  HistoryEntry e;
+  // the entry owns the nodes it shares with no entry before it, and the text
+  // added since the last commit. Counted before it takes its reference.
+  e.bytes = (long long)piece_tree_own_nodes(editor->text.root) *
+                sizeof(PieceNode) +
+            (editor->text.add.size() - h->last_add_len);
+  e.root = piece_tree_incref(editor->text.root);
+  e.origlen = editor->text.origlen;
+  e.disk_epoch = editor->disk_epoch;
+  e.cursor = cursor;
+  e.parent = h->cur;
+  h->last_add_len = editor->text.add.size();
+  h->bytes += e.bytes;
+  h->cur = h->next_id++;
+  h->entries[h->cur] = e;
+
+  while (h->bytes > HISTORY_MAX_BYTES && h->entries.size() > 1 &&
+         h->entries.begin()->first != h->cur) {
+    editor_history_drop(editor, h->entries.begin()->first);
+  }
+}
+
+// make the text that of entry `id`.
+void editor_history_restore(EditorState *editor, int id) {
+  History *h = &editor->history;
+  HistoryEntry &e = h->entries.at(id);
+  // the file was loaded further since the snapshot was taken. The entry
+  // grows to match, as it would have had it been current.
+  const int missing = editor->text.origlen - e.origlen;
+  if (missing > 0) {
+    e.root = piece_tree_merge(
+        e.root, piece_tree_from_span(&editor->text, false, e.origlen, missing));
+    e.origlen = editor->text.origlen;
+  }
+  PieceTable *pt = &editor->text;
+  if (pt->root != e.root) {
+    // the lines between the pieces the two texts have in common changed.
+    int pre, suf;
+    piece_tree_common(pt->root, e.root, &pre, &suf);
+    const int line = piece_tree_line_of(pt, pt->root, pre);
+    const int old_end = piece_tree_line_of(pt, pt->root, pt->len - suf);
+    const int new_end =
+        piece_tree_line_of(pt, e.root, piece_node_len(e.root) - suf);
+    editor_note_edit(editor, line, old_end - line + 1, new_end - line + 1);
+  }
+  piece_table_set_root(pt, piece_tree_incref(e.root));
+  if (e.disk_epoch != editor->disk_epoch) {
+    editor->disk_stale = true;
+  }
+  h->cur = id;
+}
+
+Cursor editor_clamp_cursor(const EditorState *editor, Cursor cursor) {
+  cursor.line = std::min<int>(cursor.line, editor_num_lines(editor) - 1);
+  cursor.col = std::min<int>(cursor.col, editor_line_len(editor, cursor.line));
+  return cursor;
+}
+
+Cursor editor_undo(EditorState *editor, Cursor cursor) {
+  editor_history_commit(editor, cursor);
+  History *h = &editor->history;
+  const int cur = h->cur;
+  const int parent = h->entries.at(cur).parent;
+  if (!h->entries.count(parent)) {
+    return cursor; // nothing to undo, or it was dropped.
+  }
+  h->entries[parent].redo = cur;
+  editor_history_restore(editor, parent);
+  return editor_clamp_cursor(editor, h->entries.at(cur).cursor);
+}
+
+Cursor editor_redo(EditorState *editor, Cursor cursor) {
+  editor_history_commit(editor, cursor);
+  History *h = &editor->history;
+  const int child = h->entries.at(h->cur).redo;
+  if (!h->entries.count(child)) {
+    return cursor;
+  }
+  editor_history_restore(editor, child);
+  return editor_clamp_cursor(editor, h->entries.at(child).cursor);
+}
+
+// bytes of a file that are loaded before the first frame. Enough for the
+// first screen of any reasonable file.
+static const int EDITOR_FIRST_LOAD_LEN = 1 << 20;
+// bytes of a file that are loaded per timeslice after that.
+static const int EDITOR_LOAD_CHUNK_LEN = 1 << 20;
+
+bool editor_loading(const EditorState *editor) {
+  return editor->file && editor->text.origlen < editor->file->len;
+}
+
+// load the next `len` bytes of the file. Only whole lines are loaded unless
+// the file ends or a single line is longer than `len`.
+void editor_load_chunk(EditorState *editor, int len) {
+  assert(editor_loading(editor));
+  File *f = editor->file;
+  const int begin = editor->text.origlen;
+  file_fill(f, begin + len);
+  int end = std::min<int>(f->len, begin + len);
+  if (end == begin) {
+    return; // the file was truncated, and ends here now.
+  }
+  if (end < f->len) {
+    const char *nl = (const char *)memrchr(f->buf + begin, '\n', end - begin);
+    if (nl) {
+      end = nl - f->buf + 1;
+    }
+  }
+  // chunks end at a newline, so no character is cut in two but for very long
+  // lines.
+  if (!utf8_valid(f->buf + begin, end - begin)) {
+    editor->utf8_valid = false;
+  }
+  // the chunk continues the last line. If that line is being edited, the
+  // edit goes to the text first, or flushing it later would overwrite what
+  // the chunk brought.
+  if (editor->active_line == editor_num_lines(editor) - 1) {
+    editor_flush_active_line(editor);
+  }
+  // loading is not an edit: if the text is that of the current history
+  // entry, the entry grows along with it.
+  History *h = &editor->history;
+  auto it = h->entries.find(h->cur);
+  const bool committed =
+      it != h->entries.end() && it->second.root == editor->text.root;
+  piece_table_append_orig(&editor->text, end - begin);
+  if (committed) {
+    piece_tree_decref(it->second.root);
+    it->second.root = piece_tree_incref(editor->text.root);
+    it->second.origlen = editor->text.origlen;
+  }
+}
+
+// edit `f`. The first screen is loaded right away, the rest of the file is
+// streamed in by `task_manager_load_timeslice`. The text is read rather than
+// mapped: a mapping faults on the pages past the end of a file truncated by
+// someone else, and the editor holds on to it for as long as it is open.
+void editor_open(EditorState *editor, File *f) {
+  editor->active_line = -1;
+  editor->file = f;
+  editor->path = f->path;
+  editor->disk_len = f->len;
+  editor->disk_mtime = f->mtime;
+  file_own_lazily(f);
+  editor->utf8_valid = true;
+  editor->index_edit.reset();
+  piece_table_init(&editor->text, f->buf, 0);
+  editor_history_reset(editor, Cursor());
+  if (editor_loading(editor)) {
+    editor_load_chunk(editor, EDITOR_FIRST_LOAD_LEN);
+  }
+}
+
+// ===SAVE===
+// Saving writes only what changed when it can. If every piece that is on
+// disk is still at its offset on disk, the pieces that are not are written
+// in place, one `pwritev` per run of adjacent dirty pieces. The regions are
+// first written to a journal next to the file, so a crash half way through
+// is repaired by `save_journal_replay` on the next start. Otherwise the
+// whole text goes to a temporary file that is renamed over the original.
+// Either way there is one fsync of the data per save, and save requests
+// that come in quick succession are coalesced by `task_manager_save_timeslice`.
+
+static const char SAVE_JOURNAL_MAGIC[8] = {'S', 'M', 'O', 'L',
+                                           'J', 'R', 'N', '1'};
+
+// a run of adjacent dirty bytes [off, off + len), made of several spans.
+struct SaveRegion {
+  int off = 0;
+  int len = 0;
+  std::vector<iovec> iov;
+};
+
+void save_region_push(std::vector<SaveRegion> *out, int off, const char *s,
+                      int len) {
+  if (out->empty() || out->back().off + out->back().len != off) {
+    out->push_back(SaveRegion{off, 0, {}});
+  }
+  out->back().len += len;
+  out->back().iov.push_back(iovec{(void *)s, (size_t)len});
+}
+
+// collect the bytes of `n` (which begins at `begin` in the text) that are not
+// at the same offset on disk. Returns false if a piece that is on disk has
+// moved, in which case the file can't be patched in place.
+bool piece_tree_dirty_regions(const PieceTable *pt, const PieceNode *n,
+                              int begin, std::vector<SaveRegion> *out) {
+  if (!n || n->disk == begin) {
+    return true;
+  }
+  if (!piece_tree_dirty_regions(pt, n->l, begin, out)) {
+    return false;
+  }
+  const int off = begin + piece_node_len(n->l);
+  const Piece &p = n->piece;
+  if (p.disk != -1 && p.disk != off) {
+    return false;
+  }
+  if (p.disk == -1) {
+    save_region_push(out, off, piece_table_span(pt, p), p.len);
+  }
+  return piece_tree_dirty_regions(pt, n->r, off + p.len, out);
+}
+
+void piece_tree_iovecs(const PieceTable *pt, const PieceNode *n,
+                       std::vector<iovec> *out) {
+  if (!n) {
+    return;
+  }
+  piece_tree_iovecs(pt, n->l, out);
+  out->push_back(iovec{(void *)piece_table_span(pt, n->piece),
+                       (size_t)n->piece.len});
+  piece_tree_iovecs(pt, n->r, out);
+}
+
+// the text of `n` now lives on disk at `begin`.
+PieceNode *piece_tree_mark_saved(PieceNode *n, int begin) {
+  if (!n || n->disk == begin) {
+    return n;
+  }
+  n = piece_node_own(n);
+  n->l = piece_tree_mark_saved(n->l, begin);
+  n->piece.disk = begin + piece_node_len(n->l);
+  n->r = piece_tree_mark_saved(n->r, n->piece.disk + n->piece.len);
+  piece_node_update(n);
+  return n;
+}
+
+// FNV-1a, to detect a journal that was only partially written.
+unsigned long long save_checksum(unsigned long long h, const void *data,
+                                 size_t len) {
+  for (size_t i = 0; i < len; ++i) {
+    h ^= ((const unsigned char *)data)[i];
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+std::string save_journal_path(const std::string &path) {
+  return path + ".smol-journal";
+}
+
+// fsync the directory containing `path`, making a create/rename durable.
+void save_fsync_dir(const std::string &path) {
+  std::string dir = std::filesystem::path(path).parent_path().string();
+  const int fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd >= 0) {
+    fsync(fd);
+    close(fd);
+  }
+}
+
+bool save_write_all(int fd, const void *data, size_t len) {
+  const char *p = (const char *)data;
+  while (len > 0) {
+    const ssize_t n = write(fd, p, len);
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+bool save_pwritev_all(int fd, std::vector<iovec> iov, off_t off) {
+  for (size_t i = 0; i < iov.size();) {
+    const int n = std::min<size_t>(iov.size() - i, IOV_MAX);
+    ssize_t written = pwritev(fd, iov.data() + i, n, off);
+    if (written < 0) {
+      return false;
+    }
+    off += written;
+    // skip the iovecs that were written fully, trim a partial one.
+    while (i < iov.size() && written >= (ssize_t)iov[i].iov_len) {
+      written -= iov[i].iov_len;
+      i++;
+    }
+    if (written > 0) {
+      iov[i].iov_base = (char *)iov[i].iov_base + written;
+      iov[i].iov_len -= written;
+    }
+  }
+  return true;
+}
+
+// journal layout: magic, new file length, #regions, then for each region its
+// offset, length and bytes, then a checksum of everything before it.
+bool save_journal_write(const std::string &path, int newlen,
+                        const std::vector<SaveRegion> &regions) {
+  const std::string jpath = save_journal_path(path);
+  const int fd = open(jpath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  std::string header(SAVE_JOURNAL_MAGIC, sizeof(SAVE_JOURNAL_MAGIC));
+  const long long hdr[2] = {newlen, (long long)regions.size()};
+  header.append((const char *)hdr, sizeof(hdr));
+  unsigned long long h = save_checksum(14695981039346656037ull, header.data(),
+                                       header.size());
+  bool ok = save_write_all(fd, header.data(), header.size());
+  for (const SaveRegion &r : regions) {
+    const long long rhdr[2] = {r.off, r.len};
+    h = save_checksum(h, rhdr, sizeof(rhdr));
+    ok = ok && save_write_all(fd, rhdr, sizeof(rhdr));
+    for (const iovec &v : r.iov) {
+      h = save_checksum(h, v.iov_base, v.iov_len);
+      ok = ok && save_write_all(fd, v.iov_base, v.iov_len);
+    }
+  }
+  ok = ok && save_write_all(fd, &h, sizeof(h));
+  ok = ok && fsync(fd) == 0;
+  close(fd);
+  if (ok) {
+    save_fsync_dir(jpath);
+  }
+  return ok;
+}
+
+// if a save of `path` was interrupted after its journal was written, finish
+// it. Torn journals are discarded: the file was not touched yet.
+void save_journal_replay(const std::string &path) {
+  const std::string jpath = save_journal_path(path);
+  std::ifstream in(jpath, std::ios::binary);
+  if (!in) {
+    return;
+  }
+  const std::string j((std::istreambuf_iterator<char>(in)),
+                      std::istreambuf_iterator<char>());
+  in.close();
+
+  const size_t hdrlen = sizeof(SAVE_JOURNAL_MAGIC) + 2 * sizeof(long long);
+  unsigned long long h = 0;
+  bool ok = j.size() >= hdrlen + sizeof(h) &&
+            !memcmp(j.data(), SAVE_JOURNAL_MAGIC, sizeof(SAVE_JOURNAL_MAGIC));
+  if (ok) {
+    memcpy(&h, j.data() + j.size() - sizeof(h), sizeof(h));
+    ok = h == save_checksum(14695981039346656037ull, j.data(),
+                            j.size() - sizeof(h));
+  }
+  const int fd = ok ? open(path.c_str(), O_WRONLY) : -1;
+  if (fd >= 0) {
+    long long hdr[2];
+    memcpy(hdr, j.data() + sizeof(SAVE_JOURNAL_MAGIC), sizeof(hdr));
+    size_t pos = hdrlen;
+    for (long long i = 0; i < hdr[1]; ++i) {
+      long long rhdr[2];
+      memcpy(rhdr, j.data() + pos, sizeof(rhdr));
+      pos += sizeof(rhdr);
+      ok = ok && pwrite(fd, j.data() + pos, rhdr[1], rhdr[0]) == rhdr[1];
+      pos += rhdr[1];
+    }
+    ok = ok && ftruncate(fd, hdr[0]) == 0 && fdatasync(fd) == 0;
+    close(fd);
+  }
+  if (ok || fd < 0) {
+    unlink(jpath.c_str());
+  }
+}
+
+bool editor_save_in_place(EditorState *editor,
+                          const std::vector<SaveRegion> &regions) {
+  const PieceTable *pt = &editor->text;
+  if (!save_journal_write(editor->path, pt->len, regions)) {
+    return false;
+  }
+
+  const int fd = open(editor->path.c_str(), O_WRONLY);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = true;
+  for (const SaveRegion &r : regions) {
+    ok = ok && save_pwritev_all(fd, r.iov, r.off);
+  }
+  ok = ok && ftruncate(fd, pt->len) == 0 && fdatasync(fd) == 0;
+  close(fd);
+  if (ok) {
+    unlink(save_journal_path(editor->path).c_str());
+  }
+  return ok;
+}
+
+bool editor_save_rewrite(EditorState *editor) {
+  const std::string tmp = editor->path + ".smol-tmp";
+  struct stat st;
+  const mode_t mode =
+      stat(editor->path.c_str(), &st) == 0 ? st.st_mode & 07777 : 0644;
+  const int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, mode);
+  if (fd < 0) {
+    return false;
+  }
+  std::vector<iovec> iov;
+  piece_tree_iovecs(&editor->text, editor->text.root, &iov);
+  bool ok = save_pwritev_all(fd, iov, 0) && fsync(fd) == 0;
+  close(fd);
+  ok = ok && rename(tmp.c_str(), editor->path.c_str()) == 0;
+  if (!ok) {
+    unlink(tmp.c_str());
+    return false;
+  }
+  // a journal left by a failed in-place save is stale now: replaying it on
+  // the next start would patch old regions into the new text.
+  unlink(save_journal_path(editor->path).c_str());
+  save_fsync_dir(editor->path);
+  return true;
+}
+
+// save the text to `editor->path`. `status` says what happened.
+bool editor_save(EditorState *editor, std::string *status) {
+  if (editor->path.empty()) {
+    *status = "save: no file";
+    return false;
+  }
+  editor_flush_active_line(editor);
+  while (editor_loading(editor)) {
+    editor_load_chunk(editor, EDITOR_LOAD_CHUNK_LEN);
+  }
+
+  // pieces only know where they are on disk if nobody else wrote the file.
+  struct stat st;
+  const bool unchanged = stat(editor->path.c_str(), &st) == 0 &&
+                         st.st_size == editor->disk_len &&
+                         st.st_mtim.tv_sec == editor->disk_mtime.tv_sec &&
+                         st.st_mtim.tv_nsec == editor->disk_mtime.tv_nsec;
+  std::vector<SaveRegion> regions;
+  const bool in_place =
+      unchanged && !editor->disk_stale &&
+      piece_tree_dirty_regions(&editor->text, editor->text.root, 0, &regions);
+  int nbytes = 0;
+  for (const SaveRegion &r : regions) {
+    nbytes += r.len;
+  }
+  if (in_place && regions.empty() && editor->text.len == editor->disk_len) {
+    *status = "save: no changes";
+    return true;
+  }
+
+  const bool ok = in_place ? editor_save_in_place(editor, regions)
+                           : editor_save_rewrite(editor);
+  if (!ok) {
+    *status = "save failed: " + editor->path + ": " + strerror(errno);
+    return false;
+  }
+  // the current history entry is the text that was saved.
+  auto it = editor->history.entries.find(editor->history.cur);
+  const bool committed = it != editor->history.entries.end() &&
+                         it->second.root == editor->text.root;
+  editor->text.root = piece_tree_mark_saved(editor->text.root, 0);
+  editor->disk_epoch++;
+  editor->disk_stale = false;
+  if (committed) {
+    piece_tree_decref(it->second.root);
+    it->second.root = piece_tree_incref(editor->text.root);
+    it->second.disk_epoch = editor->disk_epoch;
+  }
+  editor->disk_len = editor->text.len;
+  if (stat(editor->path.c_str(), &st) == 0) {
+    editor->disk_mtime = st.st_mtim;
+  }
+  *status = "saved: " + editor->path + " | ";
+  *status += in_place ? "patched " + std::to_string(regions.size()) +
+                            " regions, " + std::to_string(nbytes) + " bytes"
+                      : "rewrote " + std::to_string(editor->text.len) +
+                            " bytes";
+  return true;
+}
+
+// ===INDEX FILE===
+// The trigram index is saved when indexing is done, and loaded on the next
+// start: files whose size and mtime are those on record, or failing that
+// whose contents hash the same, take their postings from the loaded index
+// without being read. Only files that changed or are new are indexed again.
+// The file is mapped as is. One that isn't of this version, or doesn't hold
+// together, is ignored, see `trigram_file_valid`.
+
+static const char TRIGRAM_FILE_MAGIC[8] = {'S', 'M', 'O', 'L',
+                                           'T', 'R', 'I', 'G'};
+static const uint32_t TRIGRAM_FILE_VERSION = 1;
+
+// where the index of the workspace at `root` is kept.
+std::string index_file_path(const std::string &root) {
+  const char *cache = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  const std::string dir = cache && *cache ? std::string(cache)
+                                          : std::string(home ? home : "/tmp") +
+                                                "/.cache";
+  std::error_code ec;
+  const std::string canon =
+      std::filesystem::weakly_canonical(root, ec).string();
+  char name[64];
+  snprintf(name, sizeof(name), "smol-%016llx.trigrams",
+           (unsigned long long)hash_bytes(canon.data(), canon.size()));
+  return dir + "/" + name;
+}
+
+// whether the index of `size` bytes at `h` can be used as mapped: every
+// offset and length in it stays within the file, and every posting list
+// decodes to ascending ids of its files. A torn or foreign file fails here
+// rather than faulting, or indexing past `TrigramIndex::files`, later on.
+bool trigram_file_valid(const TrigramFileHeader *h, uint64_t size) {
+  if (memcmp(h->magic, TRIGRAM_FILE_MAGIC, 8) ||
+      h->version != TRIGRAM_FILE_VERSION || h->nfiles > INT_MAX) {
+    return false;
+  }
+  // part by part, so that a huge length can't wrap the total around.
+  uint64_t left = size - sizeof(TrigramFileHeader);
+  const uint64_t parts[] = {h->nfiles * sizeof(TrigramFileEntry),
+                            h->ntrigrams * sizeof(TrigramEntry),
+                            h->paths_len, h->postings_len};
+  for (uint64_t n : parts) {
+    if (n > left) {
+      return false;
+    }
+    left -= n;
+  }
+  if (left != 0) {
+    return false;
+  }
+
+  const TrigramFileEntry *fe = trigram_file_entries(h);
+  for (uint32_t i = 0; i < h->nfiles; ++i) {
+    if (fe[i].path > h->paths_len ||
+        fe[i].path_len > h->paths_len - fe[i].path) {
+      return false;
+    }
+  }
+  const TrigramEntry *te = trigram_file_trigrams(h);
+  const uint8_t *postings = trigram_file_postings(h);
+  const uint8_t *end = postings + h->postings_len;
+  for (uint32_t i = 0; i < h->ntrigrams; ++i) {
+    // sorted, for `trigram_index_list` to search.
+    if ((i > 0 && te[i].trigram <= te[i - 1].trigram) ||
+        te[i].postings > h->postings_len || te[i].count > h->nfiles) {
+      return false;
+    }
+    const uint8_t *c = postings + te[i].postings;
+    int64_t id = -1;
+    for (uint32_t n = 0; n < te[i].count; ++n) {
+      uint32_t delta;
+      if (!varint_read_checked(&c, end, &delta) || delta == 0) {
+        return false;
+      }
+      id += delta;
+      if (id >= h->nfiles) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// map the index at `path` as the base of `ix`, which must be empty. Returns
+// false if there is none, or it is not one we can read.
+bool trigram_index_load(TrigramIndex *ix, const std::string &path) {
+  assert(ix->files.empty() && !ix->base);
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(TrigramFileHeader)) {
+    close(fd);
+    return false;
+  }
+  void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    return false;
+  }
+  const TrigramFileHeader *h = (const TrigramFileHeader *)p;
+  if (!trigram_file_valid(h, st.st_size)) {
+    munmap(p, st.st_size);
+    return false;
+  }
+  ix->base = h;
+  ix->base_len = st.st_size;
+  ix->nbase = h->nfiles;
+  ix->files.assign(h->nfiles, nullptr);
+  ix->hashes.resize(h->nfiles);
+  const TrigramFileEntry *fe = trigram_file_entries(h);
+  const char *paths = trigram_file_paths(h);
+  for (int i = 0; i < ix->nbase; ++i) {
+    ix->hashes[i] = fe[i].hash;
+    ix->base_ids[std::string(paths + fe[i].path, fe[i].path_len)] = i;
+  }
+  return true;
+}
+
+// the id of `f` in the base of `ix` if it has not changed since, or -1. Its
+// contents are only read if its mtime changed. Only reads the base, so that
+// index workers may call it.
+int trigram_index_base_id(const TrigramIndex *ix, const File *f) {
+  auto it = ix->base_ids.find(f->path);
+  if (it == ix->base_ids.end()) {
+    return -1;
+  }
+  const TrigramFileEntry &e = trigram_file_entries(ix->base)[it->second];
+  if (e.len != (uint32_t)f->len) {
+    return -1;
+  }
+  if ((e.mtime_sec != f->mtime.tv_sec || e.mtime_nsec != f->mtime.tv_nsec) &&
+      e.hash != hash_bytes(f->buf, f->len)) {
+    return -1;
+  }
+  return it->second;
+}
+
+// whether saving `ix` would write anything new: a file was added, or one of
+// the base is dead.
+bool trigram_index_dirty(const TrigramIndex *ix) {
+  if ((int)ix->files.size() != ix->nbase) {
+    return true;
+  }
+  for (File *f : ix->files) {
+    if (!f) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// write the live files of `ix` to `path`, renumbered without the dead ones,
+// through a temporary file that is renamed over it.
+bool trigram_index_save(const TrigramIndex *ix, const std::string &path) {
+  std::vector<int> newid(ix->files.size(), -1);
+  std::vector<TrigramFileEntry> entries;
+  std::string paths;
+  for (int i = 0; i < (int)ix->files.size(); ++i) {
+    const File *f = ix->files[i];
+    if (!f) {
+      continue;
+    }
+    newid[i] = entries.size();
+    TrigramFileEntry e = {};
+    e.hash = ix->hashes[i];
+    e.mtime_sec = f->mtime.tv_sec;
+    e.mtime_nsec = f->mtime.tv_nsec;
+    e.path = paths.size();
+    e.path_len = f->path.size();
+    e.len = f->len;
+    paths += f->path;
+    entries.push_back(e);
+  }
+  // keep the posting lists 8 byte aligned after the paths.
+  paths.resize((paths.size() + 7) & ~7);
+
+  std::vector<uint32_t> ts;
+  if (ix->base) {
+    const TrigramEntry *te = trigram_file_trigrams(ix->base);
+    for (uint32_t i = 0; i < ix->base->ntrigrams; ++i) {
+      ts.push_back(te[i].trigram);
+    }
+  }
+  for (const auto &it : ix->postings) {
+    ts.push_back(it.first);
+  }
+  std::sort(ts.begin(), ts.end());
+  ts.erase(std::unique(ts.begin(), ts.end()), ts.end());
+
+  std::vector<TrigramEntry> trigrams;
+  std::vector<uint8_t> postings;
+  for (uint32_t t : ts) {
+    TrigramEntry e = {};
+    e.trigram = t;
+    e.postings = postings.size();
+    TrigramReader r = trigram_reader(trigram_index_list(ix, t));
+    int last = -1;
+    while (trigram_reader_next(&r)) {
+      if (newid[r.id] != -1) {
+        varint_push(&postings, newid[r.id] - last);
+        last = newid[r.id];
+        e.count++;
+      }
+    }
+    if (e.count) {
+      trigrams.push_back(e);
+    }
+  }
+
+  TrigramFileHeader h = {};
+  memcpy(h.magic, TRIGRAM_FILE_MAGIC, 8);
+  h.version = TRIGRAM_FILE_VERSION;
+  h.nfiles = entries.size();
+  h.ntrigrams = trigrams.size();
+  h.paths_len = paths.size();
+  h.postings_len = postings.size();
+
+  std::error_code ec;
+  std::filesystem::create_directories(
+      std::filesystem::path(path).parent_path(), ec);
+  const std::string tmp = path + ".smol-tmp";
+  const int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = save_write_all(fd, &h, sizeof(h)) &&
+            save_write_all(fd, entries.data(),
+                           entries.size() * sizeof(TrigramFileEntry)) &&
+            save_write_all(fd, trigrams.data(),
+                           trigrams.size() * sizeof(TrigramEntry)) &&
+            save_write_all(fd, paths.data(), paths.size()) &&
+            save_write_all(fd, postings.data(), postings.size()) &&
+            fsync(fd) == 0;
+  close(fd);
+  // the base may be this very file; it stays mapped after the rename.
+  ok = ok && rename(tmp.c_str(), path.c_str()) == 0;
+  if (!ok) {
+    unlink(tmp.c_str());
+  }
+  return ok;
+}
+
+struct BottomlineState {
+  std::string info;
+};
+
+enum class FocusState {
+  FSK_Palette,
+  FSK_Viewer,
+
+};
+// number of matches the palette shows, and so keeps, per query.
+static const int NUM_ANSWERS = 80;
+
+// a palette input starting with this fuzzy-matches the paths of the
+// workspace instead of searching their contents.
+static const char PALETTE_FUZZY_PREFIX = '@';
+// and this looks up the C and C++ symbols whose names start with the rest,
+// see `Index::symbols`.
+static const char PALETTE_SYMBOL_PREFIX = '#';
+
+struct PaletteMatch {
+  Loc loc;
+  int score = 0;
+  int64_t seq = 0; // order in which matches arrived; earlier wins a tie.
+  // for a fuzzy match, the indices of the path of `loc.file` it matched.
+  std::vector<int> path;
+  bool fuzzy = false;
+  // the bytes at `loc` that matched, if not as many as the input has.
+  int len = -1;
+};
+
+// `a` ranks above `b`.
+bool palette_match_better(const PaletteMatch &a, const PaletteMatch &b) {
+  return a.score != b.score ? a.score > b.score : a.seq < b.seq;
+}
+
+bool is_word(char c) { return isalnum((unsigned char)c) || c == '_'; }
+
+// a match of `len` bytes at `l` scores higher when it sits on word
+// boundaries, starts early in its line, and is in a recently modified file.
+// `now` is the wall clock in seconds.
+int palette_match_score(const Loc &l, int len, int64_t now) {
+  const File *f = l.file;
+  int score = 0;
+  if (l.ix == 0 || !is_word(f->buf[l.ix - 1])) {
+    score += 64;
+  }
+  if (l.ix + len >= f->len || !is_word(f->buf[l.ix + len])) {
+    score += 32;
+  }
+  score -= std::min(l.col, 32);
+  // lose a point for each doubling of the age, from a second to ~136 years.
+  const int64_t age = std::max<int64_t>(1, now - f->mtime.tv_sec);
+  score -= 63 - __builtin_clzll(age);
+  return score;
+}
+
+struct CommandPaletteState {
+  std::string input;
+  // the best NUM_ANSWERS matches of `input` so far, as a heap whose top is
+  // the worst of them. see `palette_add_match`. Only for `input` if
+  // `matches_sequence_number` is `sequence_number`; until then they are
+  // those of the last input, which the task manager caches.
+  std::vector<PaletteMatch> matches;
+  // matches offered to `matches` since `input` last changed.
+  int64_t num_matches = 0;
+  int sequence_number = 0;
+  int matches_sequence_number = 0;
+  // index of selected option.
+  // invariant: selected_ix <= matches.len(). Is equal to denote deselected
+  // index.
+  int selected_ix = 0;
+};
+
+// whether a match of `score` offered now would be kept.
+bool palette_keeps(const CommandPaletteState *pal, int score) {
+  return (int)pal->matches.size() < NUM_ANSWERS ||
+         score > pal->matches.front().score;
+}
+
+// offer `m`, keeping it only if it ranks among the best NUM_ANSWERS so far.
+void palette_keep_match(CommandPaletteState *pal, PaletteMatch m) {
+  m.seq = pal->num_matches++;
+  if ((int)pal->matches.size() == NUM_ANSWERS) {
+    if (!palette_match_better(m, pal->matches.front())) {
+      return;
+    }
+    std::pop_heap(pal->matches.begin(), pal->matches.end(),
+                  palette_match_better);
+    pal->matches.pop_back();
+  }
+  pal->matches.push_back(std::move(m));
+  std::push_heap(pal->matches.begin(), pal->matches.end(),
+                 palette_match_better);
+}
+
+// offer the match `l` of `pal->input`.
+void palette_add_match(CommandPaletteState *pal, const Loc &l, int64_t now) {
+  PaletteMatch m;
+  m.loc = l;
+  m.score = palette_match_score(l, pal->input.size(), now);
+  palette_keep_match(pal, std::move(m));
+}
+
+// the kept matches, best first.
+std::vector<PaletteMatch> palette_sorted_matches(const CommandPaletteState *pal) {
+  std::vector<PaletteMatch> out = pal->matches;
+  std::sort(out.begin(), out.end(), palette_match_better);
+  return out;
+}
+
+mu_Id editor_state_mu_id(mu_Context *ctx, EditorState *editor) {
+  return mu_get_id(ctx, &editor, sizeof(EditorState *));
+}
+
+void mu_draw_cursor(mu_Context *ctx, mu_Rect *r, EditMode mode) {
+  mu_Rect cursor = *r;
+  mu_Rect cursor_new = *r;
+
+  cursor_new.h = r_get_text_height();
+  cursor_new.w = mode == EditMode::Insert ? 3 : r_get_text_width(" ", 1);
+  mu_draw_rect(ctx, cursor_new, mu_Color(0, 255, 0, 255));
+
+  // mu_Font font = ctx->_style.font;
+  // const char *c = mode == EditMode::Insert ? "|" : "-";
+  // const int width = r_get_text_width(c, 1);
+  // mu_draw_rect(ctx,
+  // mu_draw_text(ctx, font, c, 1, mu_vec2(r->x - width / 2, r->y),
+  //              ctx->_style.colors[MU_COLOR_TEXT]);
+  // r->w += width;
+}
+
+void mu_command_palette(mu_Context *ctx, EventState *event, EditorState *editor,
+                        CommandPaletteState *pal, FocusState *focus) {
+  assert(pal->selected_ix <= (int)pal->matches.size());
+
+  const bool focused = *focus == FocusState::FSK_Palette;
+  if (mu_begin_window(ctx, "ERROR", mu_Rect(0, 0, width, 0))) {
+    if (focused) {
+      if (event->key_pressed & KEY_BACKSPACE) {
+        pal->sequence_number++;
+        pal->input.resize(std::max<int>(0, pal->input.size() - 1));
+        pal->selected_ix = 0;
+      }
+
+      // TODO: Ask @codelegend for clean way to handle this.
+      if (event->key_pressed & KEY_DOWNARROW) {
+        pal->selected_ix =
+            std::min<int>(pal->selected_ix + 1, pal->matches.size() - 1);
+      }
+
+      if (event->key_pressed & KEY_UPARROW) {
+        pal->selected_ix = std::max<int>(0, pal->selected_ix - 1);
+      }
+
+      if (event->key_pressed & KEY_RETURN) {
+        *focus = FocusState::FSK_Viewer;
+      }
+
+      if (strlen(event->input_text)) {
+        /* handle key press. stolen from mu_textbox_raw */
+        pal->sequence_number++;
+        pal->input += std::string(event->input_text);
+        pal->selected_ix = 0;
+      }
+
+      if (pal->selected_ix < pal->matches.size()) {
+        assert(false && "do not know how to focus");
+        // editor->set_focus(pal->matches[pal->selected_ix]);
+      }
+    }
+
+    mu_Font font = ctx->_style.font;
+
+    mu_layout_begin_column(ctx);
+    const int width[] = {800};
+    mu_layout_row(ctx, 1, width, ctx->text_height(font));
+    mu_Rect r = mu_layout_next(ctx);
+    // mu_draw_text(ctx, font, "Command Palette", strlen("Command Palette"),
+    // mu_vec2(r.x, r.y), ctx->_style.colors[MU_COLOR_TEXT]);
+    // mu_draw_text(ctx, font, state->input.c_str(), state->input.size(),
+    // mu_vec2(0, 20), ctx->_style.colors[MU_COLOR_TEXT]);
+    const mu_Color BLUE_COLOR = {.r = 187, .g = 222, .b = 251, .a = 255};
+    mu_draw_text(ctx, font, pal->input.c_str(), pal->input.size(),
+                 mu_vec2(r.x, r.y), BLUE_COLOR);
+    r.x += r_get_text_width(pal->input.c_str(), pal->input.size());
+    if (focused) {
+      mu_draw_text(ctx, font, "|", 1, mu_vec2(r.x, r.y), BLUE_COLOR);
+    }
+
+    static const int TOP_OFFSET = 3;
+    const std::vector<PaletteMatch> matches =
+        pal->matches_sequence_number == pal->sequence_number
+            ? palette_sorted_matches(pal)
+            : std::vector<PaletteMatch>();
+    for (int i = std::max<int>(0, pal->selected_ix - TOP_OFFSET);
+         i < (int)matches.size(); ++i) {
+      const Loc l = matches[i].loc;
+      mu_Rect r = mu_layout_next(ctx);
+
+      const bool SELECTED = focused && (i == pal->selected_ix);
+      const mu_Color WHITE_COLOR = {.r = 255, .g = 255, .b = 255, .a = 255};
+      const mu_Color GRAY_COLOR = {.r = 100, .g = 100, .b = 100, .a = 255};
+      const char selection = SELECTED ? '>' : ' ';
+      mu_draw_text(ctx, font, &selection, 1, mu_vec2(r.x, r.y), WHITE_COLOR);
+      r.x += r_get_text_width(&selection, 1);
+
+      std::string istr = std::to_string(i + 1); // TODO: right-pad.
+      istr += ".";
+      mu_draw_text(ctx, font, istr.c_str(), istr.size(), mu_vec2(r.x, r.y),
+                   SELECTED ? WHITE_COLOR : GRAY_COLOR);
+      r.x += r_get_text_width(istr.c_str(), istr.size());
+
+      if (matches[i].fuzzy) {
+        // the path, with the runs of bytes it matched in blue.
+        const std::string &p = l.file->path;
+        const std::vector<int> &hit = matches[i].path;
+        int k = 0;
+        for (int j = 0; j < (int)p.size();) {
+          const bool matched = k < (int)hit.size() && hit[k] == j;
+          int e = j;
+          while (e < (int)p.size() &&
+                 (k < (int)hit.size() && hit[k] == e) == matched) {
+            k += matched;
+            e++;
+          }
+          mu_draw_text(ctx, font, p.c_str() + j, e - j, mu_vec2(r.x, r.y),
+                       matched ? BLUE_COLOR
+                               : (SELECTED ? WHITE_COLOR : GRAY_COLOR));
+          r.x += r_get_text_width(p.c_str() + j, e - j);
+          j = e;
+        }
+        continue;
+      }
+
+      int ix_line_end = l.ix;
+      while (ix_line_end < l.file->len &&
+             !is_newline(l.file->buf[ix_line_end])) {
+        ix_line_end++;
+      }
+      int ix_line_begin = l.ix;
+
+      while (ix_line_begin > 0 && !is_newline(l.file->buf[ix_line_begin])) {
+        ix_line_begin--;
+      }
+
+      mu_draw_text(ctx, font, l.file->path.c_str(), l.file->path.size(),
+                   mu_vec2(r.x, r.y), SELECTED ? WHITE_COLOR : GRAY_COLOR);
+      r.x += r_get_text_width(l.file->path.c_str(), l.file->path.size());
+
+      mu_draw_text(ctx, font, ":", 1, mu_vec2(r.x, r.y), GRAY_COLOR);
+      r.x += r_get_text_width(":", 1);
+
+      std::string linenostr = std::to_string(l.line + 1);
+      mu_draw_text(ctx, font, linenostr.c_str(), linenostr.size(),
+                   mu_vec2(r.x, r.y), GRAY_COLOR);
+      r.x += r_get_text_width(linenostr.c_str(), linenostr.size());
+
+      mu_draw_text(ctx, font, " ", 1, mu_vec2(r.x, r.y), GRAY_COLOR);
+      r.x += r_get_text_width(" ", 1);
+
+      // [ix_line_begin, ix)
+      mu_draw_text(ctx, font, l.file->buf + ix_line_begin, l.ix - ix_line_begin,
+                   mu_vec2(r.x, r.y), SELECTED ? WHITE_COLOR : GRAY_COLOR);
+      r.x +=
+          r_get_text_width(l.file->buf + ix_line_begin, l.ix - ix_line_begin);
+
+      // [ix, ix_str_end)
+      const int ix_str_end =
+          l.ix + (matches[i].len >= 0 ? matches[i].len : pal->input.size());
+      mu_draw_text(ctx, font, l.file->buf + l.ix, ix_str_end - l.ix,
+                   mu_vec2(r.x, r.y), BLUE_COLOR);
+      r.x += r_get_text_width(l.file->buf + l.ix, ix_str_end - l.ix);
+
+      // [ix+search str, ix end)
+      mu_draw_text(ctx, font, l.file->buf + ix_str_end,
+                   ix_line_end - ix_str_end, mu_vec2(r.x, r.y),
+                   SELECTED ? WHITE_COLOR : GRAY_COLOR);
+      r.x +=
+          r_get_text_width(l.file->buf + ix_str_end, ix_line_end - ix_str_end);
+
+    } // end i
+    mu_layout_end_column(ctx);
+    mu_end_window(ctx);
+  } // end mu_begin_window
+}
+
+void mu_bottom_line(mu_Context *ctx, BottomlineState *s) {
+  mu_Font font = ctx->_style.font;
+  mu_Rect parent_body = mu_get_current_container(ctx)->body;
+  int y = parent_body.y + parent_body.h - r_get_text_height();
+  mu_draw_text(ctx, font, s->info.c_str(), s->info.size(), mu_vec2(0, y),
+               ctx->_style.colors[MU_COLOR_TEXT]);
+}
+
+void mu_editor(mu_Context *ctx, EventState *event, EditorState *editor,
+               FocusState *focus, const CommandPaletteState *pal) {
+  static Cursor cursor;
+
+  mu_Font font = ctx->_style.font;
+
+  mu_Id id = editor_state_mu_id(ctx, editor);
+  mu_Container *cnt = mu_get_current_container(ctx);
+  assert(cnt && "must be within container");
+
+  const int N_SCROLL_STEPS = 15;
+  const bool focused = true;
+  if (focused) {
+    for (int i = 0; i < strlen(event->input_text); ++i) {
+      const char c = event->input_text[i];
+
+      // if (event->key_held_down & KEY_CTRL && c == 'c') {
+      //     editor->mode = EditMode::Normal;
+      // }
+
+      if (!(event->key_held_down & KEY_CTRL) &&
+          editor->mode == EditMode::Insert) {
+        cursor = cursor_insert_str(editor, cursor, &c, 1);
+      }
+    }
+
+    if (editor->mode == EditMode::Normal && event->key_held_down & KEY_I) {
+      editor->mode = EditMode::Insert;
+    }
+
+    if (event->key_held_down & KEY_CTRL && event->key_pressed & KEY_A) {
+      cursor.col = 0;
+    }
+
+    if (event->key_held_down & KEY_CTRL && event->key_pressed & KEY_E) {
+      cursor = cursor_dollar(editor, cursor);
+    }
+
+    if (event->key_held_down & KEY_CTRL && event->key_pressed & KEY_C) {
+      editor->mode = EditMode::Normal;
+      editor_history_commit(editor, cursor);
+    }
+
+    if (editor->mode == EditMode::Normal &&
+        !(event->key_held_down & KEY_CTRL) && event->key_pressed & KEY_U) {
+      cursor = editor_undo(editor, cursor);
+    }
+
+    if (event->key_held_down & KEY_CTRL && event->key_pressed & KEY_R) {
+      cursor = editor_redo(editor, cursor);
+    }
+
+    // paste is a single edit, however large the clipboard is.
+    if (editor->mode == EditMode::Insert && event->key_held_down & KEY_CTRL &&
+        event->key_pressed & KEY_V && SDL_HasClipboardText()) {
+      char *clip = SDL_GetClipboardText();
+      EditBatch b;
+      edit_batch_insert(&b, cursor.line, cursor.col, clip, strlen(clip));
+      cursor = editor_apply_batch(editor, &b, cursor);
+      SDL_free(clip);
+    }
+
+    if (event->key_held_down & KEY_CTRL && event->key_pressed & KEY_S) {
+      editor->save_requested = true;
+    }
+
+    if (event->key_held_down & KEY_CTRL && event->key_pressed & KEY_D) {
+      for (int i = 0; i < N_SCROLL_STEPS; ++i) {
+        cursor = cursor_down(editor, cursor);
+      }
+    }
+
+    if (event->key_held_down & KEY_CTRL && event->key_pressed & KEY_U) {
+      for (int i = 0; i < N_SCROLL_STEPS; ++i) {
+        cursor = cursor_up(editor, cursor);
+      }
+    }
+
+    if (event->key_pressed & KEY_UPARROW ||
+        (editor->mode == EditMode::Normal && event->key_pressed & KEY_K)) {
+      cursor = cursor_up(editor, cursor);
+    }
+
+    if (event->key_pressed & KEY_DOWNARROW ||
+        (editor->mode == EditMode::Normal && event->key_pressed & KEY_J)) {
+      cursor = cursor_down(editor, cursor);
+    }
+
+    if (event->key_pressed & KEY_LEFTARROW ||
+        (editor->mode == EditMode::Normal && event->key_pressed & KEY_H)) {
+      cursor = cursor_left(editor, cursor);
+    }
+
+    if (event->key_pressed & KEY_RIGHTARROW ||
+        (editor->mode == EditMode::Normal && event->key_pressed & KEY_L)) {
+      cursor = cursor_right(editor, cursor);
+    }
+
+    if (editor->mode == EditMode::Insert &&
+        event->key_pressed & KEY_BACKSPACE) {
+      if (cursor.col == 0) {
+        // TODO: think of how this codde can be cleaned up!
+        // In terms of differential geometry :)
+        // If we attach the space back on itself twisted (ala mobius
+        // strip), does that give us the correct implementation of
+        // cursors? I think so!
+        if (cursor.line == 0) {
+          return;
+        }
+        assert(cursor.line > 0);
+        // join previous line into currentline.
+        cursor = cursor_dollar(editor, cursor_up(editor, cursor));
+        editor_join_line_with_next(editor, cursor.line);
+
+      } else {
+        cursor = cursor_delete_backward(editor, cursor, 1);
+      }
+    }
+
+    if (editor->mode == EditMode::Insert && event->key_pressed & KEY_RETURN) {
+      // split the line at the cursor.
+      cursor = cursor_insert_str(editor, cursor, "\n", 1);
+    }
+
+    // the cursor left the line it was typing into.
+    if (cursor.line != editor->active_line) {
+      editor_history_commit(editor, cursor);
+    }
+  }
+
+  mu_layout_begin_column(ctx);
+  int width = -1;
+  mu_layout_row(ctx, 1, &width, ctx->text_height(font));
+  // mu_draw_control_frame(ctx, id, cnt->body, MU_COLOR_BASE, 0);
+
+  const int NLINES = height / ctx->text_height(font);
+
+  const mu_Color DARKGRAY_COLOR = {.r = 100, .g = 100, .b = 100, .a = 255};
+  const mu_Color GRAY_COLOR = {.r = 180, .g = 180, .b = 180, .a = 255};
+  const mu_Color WHITE_COLOR = {.r = 255, .g = 255, .b = 255, .a = 255};
+  const mu_Color BLUE_COLOR = {.r = 187, .g = 222, .b = 251, .a = 255};
+
+  const int line_begin = std::max<int>(0, cursor.line - NLINES / 2);
+  // line numbers are padded to the width of the largest one on screen.
+  const int lineno_width =
+      std::max<int>(4, std::to_string(line_begin + NLINES).size() + 1);
+  for (int line = line_begin;
+       line < line_begin + NLINES && line < editor_num_lines(editor); ++line) {
+    mu_Rect r = mu_layout_next(ctx);
+    const LineColumns *lc = editor_line_columns(editor, line);
+    const std::string &text = lc->text;
+
+    const bool SELECTED = cursor.line == line;
+
+    // 1. draw line number
+    static const int MAX_LINE_STRLEN = 16;
+    char lineno_str[MAX_LINE_STRLEN];
+    snprintf(lineno_str, MAX_LINE_STRLEN, "%-*d", lineno_width, line);
+
+    mu_draw_text(ctx, font, lineno_str, strlen(lineno_str), mu_vec2(r.x, r.y),
+                 SELECTED ? WHITE_COLOR : GRAY_COLOR);
+    r.x += ctx->text_width(font, lineno_str, strlen(lineno_str));
+    r.h = ctx->text_height(font);
+    // draw text, a character at a time. yes less than or equals to enable
+    // writing of cursor.
+    for (int col = 0, next = 0; col <= (int)text.size(); col = next) {
+      if (focused && line == cursor.line && col == cursor.col) {
+        mu_draw_cursor(ctx, &r, editor->mode);
+      }
+
+      // the character is within [NSCROLL] distance from cursor
+      bool IN_SCROLL_RANGE = abs(line - cursor.line) <= N_SCROLL_STEPS;
+      // the character is inside the query bounds.
+      bool AT_QUERY = false;
+      // bool AT_QUERY =
+      //     pal->selected_ix < pal->matches.size() &&
+      //     cur.ix >= pal->matches[pal->selected_ix].ix &&
+      //     cur.ix < pal->matches[pal->selected_ix].ix +
+      //     pal->input.size();
+      if (col == (int)text.size()) {
+        break;
+      }
+      next = line_columns_next(lc, col);
+      mu_draw_text(ctx, font, text.data() + col, next - col, mu_vec2(r.x, r.y),
+                   AT_QUERY          ? BLUE_COLOR
+                   : SELECTED        ? WHITE_COLOR
+                   : IN_SCROLL_RANGE ? GRAY_COLOR
+                                     : DARKGRAY_COLOR);
+      r.x += ctx->text_width(font, text.data() + col, next - col);
+    }
+
+    // cursor
+    // if (editor->cursor.line == line && editor->focus.col ==
+    // right.col) {
+    //     mu_draw_cursor(ctx, &r);
+    // }
+
+    // next line;
+    // assert(right.advance().eof() || left.line + 1 ==
+    // right.advance().line); left = right.advance();
+  }
+
+  mu_layout_end_column(ctx);
+}
+
+static void editor_window(mu_Context *ctx, EventState *event,
+                          EditorState *editor, BottomlineState *bot,
+                          FocusState *focus, const CommandPaletteState *pal) {
+  if (mu_begin_window(ctx, "Editor", mu_rect(0, 0, width, height))) {
+    int width_row[] = {-1};
+    mu_layout_row(ctx, 1, width_row, -25);
+    mu_layout_row(ctx, 1, width_row, -1);
+    mu_editor(ctx, event, editor, focus, pal);
+    mu_bottom_line(ctx, bot);
+    mu_end_window(ctx);
+  }
+}
+
+int button_map(int sdl_key) {
+  if (sdl_key == SDL_BUTTON_LEFT) {
+    return MU_MOUSE_LEFT;
+  } else if (sdl_key == SDL_BUTTON_RIGHT) {
+    return MU_MOUSE_RIGHT;
+  } else if (sdl_key == SDL_BUTTON_MIDDLE) {
+    return MU_MOUSE_MIDDLE;
+  }
+  return 0;
+}
+
+int key_map(int sdl_key) {
+  if (sdl_key == SDLK_LSHIFT)
+    return KEY_SHIFT;
+  if (sdl_key == SDLK_RSHIFT)
+    return KEY_SHIFT;
+  if (sdl_key == SDLK_LCTRL || sdl_key == SDLK_RCTRL) {
+    return KEY_CTRL;
+  }
+  if (sdl_key == SDLK_RCTRL)
+    return KEY_CTRL;
+  if (sdl_key == SDLK_LALT)
+    return KEY_ALT;
+  if (sdl_key == SDLK_RALT)
+    return KEY_ALT;
+  if (sdl_key == SDLK_RETURN)
+    return KEY_RETURN;
+  if (sdl_key == SDLK_UP)
+    return KEY_UPARROW;
+  if (sdl_key == SDLK_DOWN)
+    return KEY_DOWNARROW;
+  if (sdl_key == SDLK_LEFT)
+    return KEY_LEFTARROW;
+  if (sdl_key == SDLK_RIGHT)
+    return KEY_RIGHTARROW;
+  if (sdl_key == SDLK_BACKSPACE)
+    return KEY_BACKSPACE;
+  if (sdl_key == SDLK_p)
+    return KEY_COMMAND_PALETTE;
+  if (sdl_key == SDLK_d)
+    return KEY_D;
+  if (sdl_key == SDLK_c)
+    return KEY_C;
+  if (sdl_key == SDLK_u)
+    return KEY_U;
+  if (sdl_key == SDLK_h)
+    return KEY_H;
+  if (sdl_key == SDLK_j)
+    return KEY_J;
+  if (sdl_key == SDLK_k)
+    return KEY_K;
+  if (sdl_key == SDLK_l)
+    return KEY_L;
+  if (sdl_key == SDLK_i)
+    return KEY_I;
+  if (sdl_key == SDLK_a)
+    return KEY_A;
+  if (sdl_key == SDLK_e)
+    return KEY_E;
+  if (sdl_key == SDLK_s)
+    return KEY_S;
+  if (sdl_key == SDLK_r)
+    return KEY_R;
+  if (sdl_key == SDLK_v)
+    return KEY_V;
+  if (sdl_key == SDLK_TAB) {
+    return KEY_TAB;
+  }
+  return 0;
+}
+
+static int text_width(mu_Font font, const char *text, int len) {
+  if (len == -1) {
+    len = strlen(text);
+  }
+  return r_get_text_width(text, len);
+}
+
+static int text_height(mu_Font font) { return r_get_text_height(); }
+
+// the index that the palette searches, picked on the command line.
+enum class IndexKind { Trie, SuffixArray, FmIndex, Trigram };
+
+// how a file of the workspace is indexed, see `index_policy_tier`.
+enum class IndexTier {
+  Full,    // by the kind of the index.
+  Trigram, // into `Index::trigram`, next to a trie.
+  Path,    // not at all: it is only found by a fuzzy search of paths.
+};
+
+struct Index {
+  IndexKind kind = IndexKind::Trie;
+  IndexPolicy policy;
+  // the files in each `IndexTier`, and the files of trie shards that were
+  // evicted to keep to the budget.
+  int ntier[3] = {};
+  int nevicted = 0;
+  // which of those counts each file is in, so that a file that is retired
+  // is taken out of it again.
+  std::unordered_map<const File *, IndexTier> tiers;
+  std::unordered_set<const File *> evicted;
+  // the fragments of edited files, see `LiveIndex`. The files of the
+  // workspace are in `trie_shards`, which are searched side by side.
+  ArtTrie trie;
+  std::vector<ArtTrie *> trie_shards;
+  // the suffix array, or for the FM-index the files collected to build it.
+  SuffixArray sa;
+  FmIndex fm;
+  // the trigram index, or next to a trie the files that were indexed into
+  // trigrams to save memory.
+  TrigramIndex trigram;
+  // the edits to the files of the trie since they were indexed.
+  LiveIndex live;
+  // the symbols of the files that were read, a sorted run per shard, see
+  // `symbol_less`.
+  std::vector<std::vector<Symbol>> symbols;
+};
+
+// bytes held by `index`.
+long long index_memory(const Index *index) {
+  long long n = art_memory(&index->trie) +
+                trigram_index_memory(&index->trigram) +
+                suffix_array_memory(&index->sa) + fm_index_memory(&index->fm);
+  for (const ArtTrie *t : index->trie_shards) {
+    n += art_memory(t);
+  }
+  for (const std::vector<Symbol> &run : index->symbols) {
+    n += run.capacity() * sizeof(Symbol);
+  }
+  return n;
+}
+
+// how to index the next file, when the index takes `memory` bytes. Files are
+// indexed in full while the index fits its budget, except that a trie takes
+// new files into trigrams, at a byte or so a byte rather than ~25, once it
+// has used three quarters of it. Past the budget, files are not indexed.
+IndexTier index_policy_tier(const IndexPolicy *p, IndexKind kind,
+                            long long memory) {
+  if (memory >= p->budget) {
+    return IndexTier::Path;
+  }
+  if (kind == IndexKind::Trie && memory >= p->budget / 4 * 3) {
+    return IndexTier::Trigram;
+  }
+  return IndexTier::Full;
+}
+
+// bytes, roughly, that an index of `kind` takes for `len` bytes of text, for
+// the kinds whose size is not cheap to measure as they grow: a trigram index
+// takes about a byte a byte, a suffix array 4 bytes a byte and a copy of the
+// text, as does the one an FM-index is built from.
+long long index_policy_cost(IndexKind kind, long long len) {
+  return kind == IndexKind::Trigram ? len : 5 * len;
+}
+
+// the memory the index takes, and how it has kept to its budget.
+std::string index_policy_report(const Index *index, long long memory) {
+  std::string out = std::to_string(memory >> 20);
+  if (index->policy.budget != LLONG_MAX) {
+    out += " of " + std::to_string(index->policy.budget >> 20);
+  }
+  out += " MB";
+  if (index->ntier[(int)IndexTier::Trigram]) {
+    out += " | trigrams only: " +
+           std::to_string(index->ntier[(int)IndexTier::Trigram]);
+  }
+  if (index->ntier[(int)IndexTier::Path]) {
+    out += " | paths only: " +
+           std::to_string(index->ntier[(int)IndexTier::Path]);
+  }
+  if (index->nevicted) {
+    out += " | evicted: " + std::to_string(index->nevicted);
+  }
+  return out;
+}
+
+// ===INDEX WORKERS===
+// Files are read and indexed by a pool of threads, one per core, while the
+// `Walker` walks the workspace and hands them paths. Each worker indexes
+// into a shard of its own, and hands it over once it holds
+// INDEX_SHARD_BYTES of text, or when there are no paths left. The UI thread
+// then makes the shard part of the index: trie shards are searched as they
+// are, trigram shards are merged into the index, and the files of a shard
+// are added to the suffix array's corpus. Workers only ever read the index.
+// They keep a running estimate of its size, from which each file gets its
+// `IndexTier`, and a trie shard is also handed over once it holds an eighth
+// of the budget, since tries take ~3 times as much while they are built.
+
+static const long long INDEX_SHARD_BYTES = 32 << 20;
+// paths queued for the workers, past which the walk waits for them.
+static const int INDEX_QUEUE_PATHS = 4096;
+
+struct IndexShard {
+  std::vector<File *> files; // every file that was read.
+  std::vector<IndexTier> tiers; // of each of `files`.
+  ArtTrie *trie = nullptr;
+  TrigramIndex trigram; // files that are new to the trigram index.
+  // files that are live again in the base of the trigram index, by id.
+  std::vector<std::pair<int, File *>> reused;
+  std::vector<Symbol> symbols; // of `files`, sorted once it is finished.
+  long long bytes = 0;
+  int nbinary = 0; // files that were skipped as binaries.
+};
+
+struct IndexWorkers {
+  std::vector<std::thread> threads;
+  std::mutex mu;
+  std::condition_variable cv;
+  std::condition_variable space; // signalled as paths are taken.
+  // guarded by `mu`.
+  std::deque<std::string> paths; // yet to be indexed.
+  bool closed = false;           // no more paths are coming.
+  int running = 0;               // workers that have not exited.
+  std::vector<IndexShard *> shards; // to be collected by the UI thread.
+  // bytes of the index, counting the shards being built.
+  std::atomic<long long> memory{0};
+};
+
+IndexShard *index_shard_new(const Index *index) {
+  IndexShard *shard = new IndexShard();
+  if (index->kind == IndexKind::Trie) {
+    shard->trie = new ArtTrie();
+  }
+  return shard;
+}
+
+// whether `shard` should be handed over.
+bool index_shard_full(const IndexShard *shard, const Index *index) {
+  return shard->bytes >= INDEX_SHARD_BYTES ||
+         (shard->trie && art_memory(shard->trie) >= index->policy.budget / 8);
+}
+
+// nothing more is added to `shard`: freeze its trie, which gives back the
+// difference to `memory`, and sort its symbols.
+void index_shard_finish(IndexShard *shard, std::atomic<long long> *memory) {
+  if (shard->trie) {
+    const long long before = art_memory(shard->trie);
+    art_freeze(shard->trie);
+    *memory += art_memory(shard->trie) - before;
+  }
+  std::sort(shard->symbols.begin(), shard->symbols.end(), symbol_less);
+}
+
+// read the file at `path` into `shard`, extracting its symbols with
+// `parser`, and add what that takes to `memory`.
+void index_shard_add(IndexShard *shard, const Index *index,
+                     SymbolParser *parser, const std::string &path,
+                     std::atomic<long long> *memory) {
+  File *f = file_map(path);
+  if (!f) {
+    return;
+  }
+  if (file_is_binary(f)) {
+    shard->nbinary++;
+    file_unmap(f);
+    return;
+  }
+  const IndexTier tier =
+      index_policy_tier(&index->policy, index->kind, *memory);
+  shard->files.push_back(f);
+  shard->tiers.push_back(tier);
+  shard->bytes += f->len;
+  if (tier == IndexTier::Path) {
+    return;
+  }
+  if (index->kind == IndexKind::Trie && tier == IndexTier::Full) {
+    // the edges of the trie are labelled with the text, which must stay as
+    // it is if the file is written in place.
+    file_own(f);
+  }
+  const int nsymbols = shard->symbols.size();
+  symbols_extract(parser, f, &shard->symbols);
+  *memory += (shard->symbols.size() - nsymbols) * sizeof(Symbol);
+  if (index->kind == IndexKind::Trigram || tier == IndexTier::Trigram) {
+    // the rope is built when a match is found, so that files that were
+    // indexed by the last run are not read.
+    const int id = index->kind == IndexKind::Trigram
+                       ? trigram_index_base_id(&index->trigram, f)
+                       : -1;
+    if (id != -1) {
+      shard->reused.push_back({id, f});
+    } else {
+      trigram_index_add_file(&shard->trigram, f);
+      *memory += index_policy_cost(IndexKind::Trigram, f->len);
+    }
+    return;
+  }
+  file_build_rope(f);
+  if (index->kind == IndexKind::Trie) {
+    const long long before = art_memory(shard->trie);
+    index_for_each_suffix(f, &index->policy, [&](Loc l, int len) {
+      art_add(shard->trie, f, l.ix, len);
+    });
+    *memory += art_memory(shard->trie) - before;
+    return;
+  }
+  // the suffix array and FM-index are built once every file is in.
+  *memory += index_policy_cost(index->kind, f->len);
+}
+
+void index_worker(IndexWorkers *w, const Index *index) {
+  SymbolParser parser;
+  symbol_parser_init(&parser);
+  IndexShard *shard = index_shard_new(index);
+  std::unique_lock<std::mutex> lock(w->mu);
+  while (true) {
+    w->cv.wait(lock, [&] { return !w->paths.empty() || w->closed; });
+    if (w->paths.empty()) {
+      break;
+    }
+    const std::string path = std::move(w->paths.front());
+    w->paths.pop_front();
+    lock.unlock();
+    w->space.notify_one();
+    index_shard_add(shard, index, &parser, path, &w->memory);
+    const bool full = index_shard_full(shard, index);
+    if (full) {
+      index_shard_finish(shard, &w->memory);
+    }
+    lock.lock();
+    if (full) {
+      w->shards.push_back(shard);
+      shard = index_shard_new(index);
+    }
+  }
+  lock.unlock();
+  symbol_parser_free(&parser);
+  if (shard->files.empty()) {
+    delete shard->trie;
+    delete shard;
+    shard = nullptr;
+  } else {
+    index_shard_finish(shard, &w->memory);
+  }
+  lock.lock();
+  if (shard) {
+    w->shards.push_back(shard);
+  }
+  w->running--;
+}
+
+// start `n` workers, or one per core if `n` is 0.
+void index_workers_start(IndexWorkers *w, const Index *index, int n) {
+  if (n == 0) {
+    n = std::max<int>(1, std::thread::hardware_concurrency());
+  }
+  w->closed = false;
+  w->running = n;
+  for (int i = 0; i < n; ++i) {
+    w->threads.emplace_back(index_worker, w, index);
+  }
+}
+
+// queue `paths` for the workers and clear it, first waiting for them while
+// INDEX_QUEUE_PATHS are queued already.
+void index_workers_push(IndexWorkers *w, std::vector<std::string> *paths) {
+  {
+    std::unique_lock<std::mutex> lock(w->mu);
+    w->space.wait(lock, [&] { return w->paths.size() < INDEX_QUEUE_PATHS; });
+    for (std::string &path : *paths) {
+      w->paths.push_back(std::move(path));
+    }
+  }
+  paths->clear();
+  w->cv.notify_all();
+}
+
+// no more paths are coming. Workers exit once the queue is empty.
+void index_workers_close(IndexWorkers *w) {
+  {
+    std::lock_guard<std::mutex> lock(w->mu);
+    w->closed = true;
+  }
+  w->cv.notify_all();
+}
+
+// the shards done so far, and whether the workers have all exited, in which
+// case they are joined.
+std::vector<IndexShard *> index_workers_collect(IndexWorkers *w, bool *done) {
+  std::vector<IndexShard *> shards;
+  {
+    std::lock_guard<std::mutex> lock(w->mu);
+    shards.swap(w->shards);
+    *done = w->closed && w->running == 0;
+  }
+  if (*done) {
+    for (std::thread &t : w->threads) {
+      t.join();
+    }
+    w->threads.clear();
+  }
+  return shards;
+}
+
+// make `shard` part of `index`, and free it.
+void index_shard_collect(Index *index, IndexShard *shard) {
+  for (int i = 0; i < (int)shard->files.size(); ++i) {
+    index->ntier[(int)shard->tiers[i]]++;
+    index->tiers[shard->files[i]] = shard->tiers[i];
+  }
+  switch (index->kind) {
+  case IndexKind::Trie:
+    index->trie_shards.push_back(shard->trie);
+    if (!shard->trigram.files.empty()) {
+      trigram_index_merge(&index->trigram, &shard->trigram);
+    }
+    break;
+  case IndexKind::Trigram:
+    trigram_index_merge(&index->trigram, &shard->trigram);
+    for (const auto &r : shard->reused) {
+      index->trigram.files[r.first] = r.second;
+    }
+    break;
+  case IndexKind::SuffixArray:
+  case IndexKind::FmIndex:
+    for (int i = 0; i < (int)shard->files.size(); ++i) {
+      if (shard->tiers[i] == IndexTier::Full) {
+        suffix_array_add_file(&index->sa, shard->files[i]);
+      }
+    }
+    break;
+  }
+  if (!shard->symbols.empty()) {
+    index->symbols.push_back(std::move(shard->symbols));
+  }
+  delete shard;
+}
+
+// ===WATCHER===
+// Once the workspace is indexed, changes to it from outside the editor are
+// followed with inotify. The walker watches each directory as it walks it.
+// The events for a path are coalesced into one `WatchChange`, which is due
+// once no event came for it in WATCH_QUIET_MS, or WATCH_MAX_DELAY_MS after
+// the first if it keeps changing. The changes that are due are then
+// reindexed by the TaskManager as a job of their own, see
+// `task_manager_watch_timeslice`. If the kernel drops events, the whole
+// workspace is walked again.
+
+static const uint32_t WATCH_EVENTS = IN_CREATE | IN_DELETE | IN_MODIFY |
+                                     IN_CLOSE_WRITE | IN_MOVED_FROM |
+                                     IN_MOVED_TO | IN_ONLYDIR | IN_EXCL_UNLINK;
+static const int WATCH_QUIET_MS = 100;
+static const int WATCH_MAX_DELAY_MS = 2000;
+
+struct IgnoreFile;
+
+// a directory that is watched.
+struct WatchDir {
+  std::string path;
+  std::string rel; // below the root, with a trailing slash unless it is it.
+  const IgnoreFile *ignore = nullptr; // that apply to its entries.
+};
+
+// the events for a path since it was last reindexed.
+struct WatchChange {
+  int wd = -1; // of the directory it is in, or -1 for the root.
+  std::string rel;
+  bool is_dir = false;
+  // the path is the directory of `wd` itself, whose ignore files changed.
+  bool self = false;
+  std::chrono::steady_clock::time_point first;
+  std::chrono::steady_clock::time_point last;
+};
+
+struct Watcher {
+  int fd = -1;
+  std::string root;
+  std::mutex mu;
+  // guarded by `mu`, as the walker's threads add to it: the directories
+  // that are watched, by watch descriptor.
+  std::unordered_map<int, WatchDir> dirs;
+  // only touched by the UI thread: the changes yet to be reindexed, by path.
+  std::unordered_map<std::string, WatchChange> changes;
+  bool overflowed = false;
+};
+
+// start watching the workspace at `root`, or return false if inotify is not
+// to be had.
+bool watcher_start(Watcher *w, const std::string &root) {
+  w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  w->root = root;
+  while (w->root.size() > 1 && w->root.back() == '/') {
+    w->root.pop_back();
+  }
+  return w->fd >= 0;
+}
+
+// watch the directory `path`, which is `rel` below the root. Returns its
+// watch descriptor, or -1.
+int watcher_watch(Watcher *w, const std::string &path, const std::string &rel) {
+  const int wd = inotify_add_watch(w->fd, path.c_str(), WATCH_EVENTS);
+  if (wd >= 0) {
+    std::lock_guard<std::mutex> lock(w->mu);
+    WatchDir &d = w->dirs[wd];
+    d.path = path;
+    d.rel = rel;
+  }
+  return wd;
+}
+
+// the ignore files of the directory of `wd` have been read.
+void watcher_set_ignore(Watcher *w, int wd, const IgnoreFile *ignore) {
+  std::lock_guard<std::mutex> lock(w->mu);
+  w->dirs[wd].ignore = ignore;
+}
+
+// note the change to `path` at `now`.
+void watcher_note(Watcher *w, const std::string &path, WatchChange c,
+                  std::chrono::steady_clock::time_point now) {
+  auto [it, added] = w->changes.insert({path, c});
+  if (added) {
+    it->second.first = now;
+  } else {
+    it->second.is_dir |= c.is_dir;
+  }
+  it->second.last = now;
+}
+
+// coalesce the events that are waiting into `w->changes`.
+void watcher_read(Watcher *w, std::chrono::steady_clock::time_point now) {
+  alignas(struct inotify_event) char buf[1 << 16];
+  ssize_t n;
+  while ((n = read(w->fd, buf, sizeof(buf))) > 0) {
+    std::lock_guard<std::mutex> lock(w->mu);
+    for (ssize_t i = 0; i < n;) {
+      const struct inotify_event *e = (const struct inotify_event *)(buf + i);
+      i += sizeof(struct inotify_event) + e->len;
+      if (e->mask & IN_Q_OVERFLOW) {
+        w->overflowed = true;
+        continue;
+      }
+      if (e->mask & IN_IGNORED) {
+        w->dirs.erase(e->wd);
+        continue;
+      }
+      auto it = w->dirs.find(e->wd);
+      if (it == w->dirs.end() || e->len == 0) {
+        continue;
+      }
+      const WatchDir &d = it->second;
+      const std::string name = e->name;
+      WatchChange c;
+      c.wd = e->wd;
+      if (name == ".gitignore" || name == ".ignore") {
+        // what is ignored in the directory changed: walk it again.
+        c.rel = d.rel.empty() ? "" : d.rel.substr(0, d.rel.size() - 1);
+        c.is_dir = true;
+        c.self = true;
+        watcher_note(w, d.path, c, now);
+        continue;
+      }
+      c.rel = d.rel + name;
+      c.is_dir = e->mask & IN_ISDIR;
+      const bool slash = !d.path.empty() && d.path.back() == '/';
+      watcher_note(w, d.path + (slash ? "" : "/") + name, c, now);
+    }
+  }
+}
+
+// take the changes that are due at `now`.
+std::vector<std::pair<std::string, WatchChange>>
+watcher_take(Watcher *w, std::chrono::steady_clock::time_point now) {
+  std::vector<std::pair<std::string, WatchChange>> due;
+  if (w->overflowed) {
+    w->overflowed = false;
+    w->changes.clear();
+    WatchChange c;
+    c.is_dir = true;
+    c.self = true;
+    due.push_back({w->root, c});
+    return due;
+  }
+  for (auto it = w->changes.begin(); it != w->changes.end();) {
+    if (now - it->second.last >= std::chrono::milliseconds(WATCH_QUIET_MS) ||
+        now - it->second.first >=
+            std::chrono::milliseconds(WATCH_MAX_DELAY_MS)) {
+      due.push_back(std::move(*it));
+      it = w->changes.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  return due;
+}
+
+// ===WALKER===
+// The workspace is walked by a pool of threads, which take directories off
+// a shared stack, read each with getdents64 in large batches, and push the
+// directories below it back on the stack. The type of an entry comes with
+// it, so that no file is stat'ed unless it is a symlink. Files go to the
+// `IndexWorkers` a directory at a time, and the walk waits for them once
+// INDEX_QUEUE_PATHS are queued. What .gitignore and .ignore files say to
+// ignore is not walked, nor is .git. A walk may also start from a set of
+// directories and files, to reindex what the `Watcher` saw change.
+
+// a line of an ignore file.
+struct IgnoreRule {
+  std::string glob;
+  bool negate = false;   // `!glob`: not ignored after all.
+  bool dir_only = false; // `glob/`: only matches directories.
+  // the glob had a slash other than at its end, and matches the path below
+  // the directory of the ignore file rather than just the name.
+  bool anchored = false;
+};
+
+// the rules of the ignore files of a directory, `dir` relative to the root
+// of the walk with a trailing slash, and through `parent` those of the
+// directories above it.
+struct IgnoreFile {
+  std::string dir;
+  std::vector<IgnoreRule> rules;
+  const IgnoreFile *parent = nullptr;
+};
+
+// whether the glob [p, pe) matches all of [s, se), as git matches them: `*`
+// and `?` do not match a slash, `**` matches anything, and `**/` also
+// matches nothing.
+bool glob_match(const char *p, const char *pe, const char *s, const char *se) {
+  while (p < pe) {
+    if (*p == '*' && p + 1 < pe && p[1] == '*') {
+      p += 2;
+      if (p < pe && *p == '/' && glob_match(p + 1, pe, s, se)) {
+        return true;
+      }
+      for (; s <= se; ++s) {
+        if (glob_match(p, pe, s, se)) {
+          return true;
+        }
+      }
+      return false;
+    }
+    if (*p == '*') {
+      for (; s <= se; ++s) {
+        if (glob_match(p + 1, pe, s, se)) {
+          return true;
+        }
+        if (s < se && *s == '/') {
+          return false;
+        }
+      }
+      return false;
+    }
+    if (s == se) {
+      return false;
+    }
+    if (*p == '?') {
+      if (*s == '/') {
+        return false;
+      }
+      p++, s++;
+      continue;
+    }
+    if (*p == '[') {
+      const char *q = p + 1;
+      const bool negate = q < pe && (*q == '!' || *q == '^');
+      q += negate;
+      const char *first = q;
+      bool hit = false;
+      while (q < pe && (*q != ']' || q == first)) {
+        if (q + 2 < pe && q[1] == '-' && q[2] != ']') {
+          hit |= *s >= q[0] && *s <= q[2];
+          q += 3;
+        } else {
+          hit |= *s == *q;
+          q++;
+        }
+      }
+      if (q < pe) {
+        if (hit == negate || *s == '/') {
+          return false;
+        }
+        p = q + 1, s++;
+        continue;
+      }
+      // no closing bracket: it is a bracket.
+    }
+    if (*p == '\\' && p + 1 < pe) {
+      p++;
+    }
+    if (*p != *s) {
+      return false;
+    }
+    p++, s++;
+  }
+  return s == se;
+}
+
+// add the rules of the ignore file `text` to `ig`.
+void ignore_file_parse(IgnoreFile *ig, const std::string &text) {
+  size_t begin = 0;
+  while (begin < text.size()) {
+    size_t end = text.find('\n', begin);
+    if (end == std::string::npos) {
+      end = text.size();
+    }
+    std::string line = text.substr(begin, end - begin);
+    begin = end + 1;
+    while (!line.empty() && (line.back() == '\r' || line.back() == ' ') &&
+           !(line.size() >= 2 && line[line.size() - 2] == '\\')) {
+      line.pop_back();
+    }
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    IgnoreRule r;
+    if (line[0] == '!') {
+      r.negate = true;
+      line.erase(0, 1);
+    } else if (line[0] == '\\') {
+      line.erase(0, 1); // `\#` and `\!`.
+    }
+    if (!line.empty() && line.back() == '/') {
+      r.dir_only = true;
+      line.pop_back();
+    }
+    r.anchored = line.find('/') != std::string::npos;
+    if (!line.empty() && line[0] == '/') {
+      line.erase(0, 1);
+    }
+    if (line.empty()) {
+      continue;
+    }
+    r.glob = line;
+    ig->rules.push_back(r);
+  }
+}
+
+// whether `rel`, a path relative to the root of the walk, is ignored by
+// `ig`. The last rule that matches decides, and the rules of a directory
+// come before those of the directories above it.
+bool ignore_match(const IgnoreFile *ig, const std::string &rel,
+                  bool is_dir) {
+  const size_t slash = rel.rfind('/');
+  const char *name = rel.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+  const char *end = rel.c_str() + rel.size();
+  for (; ig; ig = ig->parent) {
+    assert(rel.compare(0, ig->dir.size(), ig->dir) == 0);
+    const char *below = rel.c_str() + ig->dir.size();
+    for (int i = ig->rules.size() - 1; i >= 0; --i) {
+      const IgnoreRule &r = ig->rules[i];
+      if (r.dir_only && !is_dir) {
+        continue;
+      }
+      const char *g = r.glob.c_str();
+      if (glob_match(g, g + r.glob.size(), r.anchored ? below : name, end)) {
+        return !r.negate;
+      }
+    }
+  }
+  return false;
+}
+
+// a directory yet to be walked: `path` as it is opened, and `rel` relative
+// to the root of the walk, with a trailing slash unless it is the root.
+struct WalkDir {
+  std::string path;
+  std::string rel;
+  const IgnoreFile *ignore = nullptr; // that apply to its entries.
+};
+
+struct Walker {
+  std::vector<std::thread> threads;
+  IndexWorkers *out = nullptr;
+  Watcher *watch = nullptr; // watches every directory walked, if set.
+  std::mutex mu;
+  std::condition_variable cv;
+  // guarded by `mu`.
+  std::vector<WalkDir> dirs;      // yet to be walked.
+  std::vector<std::string> files; // to be handed over as they are.
+  int busy = 0;                   // threads walking a directory.
+  bool done = false;              // `dirs` ran out with no thread busy.
+  // every one read. Freed once the walk is done, unless `watch` points to
+  // them.
+  std::vector<IgnoreFile *> ignores;
+  // what was walked so far.
+  std::atomic<int> ndirs{0};
+  std::atomic<int> nfiles{0};
+  std::atomic<int> nignored{0};
+};
+
+// read the ignore file `name` in the directory `dirfd` into `ig`, and
+// whether there is one.
+bool ignore_file_read(IgnoreFile *ig, int dirfd, const char *name) {
+  const int fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  std::string text;
+  char buf[4096];
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof(buf))) > 0) {
+    text.append(buf, n);
+  }
+  close(fd);
+  ignore_file_parse(ig, text);
+  return true;
+}
+
+// the layout of the entries that getdents64 fills a buffer with.
+struct LinuxDirent64 {
+  ino64_t d_ino;
+  off64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+// walk the directory `d`: queue its files for the index, and push the
+// directories in it onto `w->dirs`.
+void walker_walk_dir(Walker *w, const WalkDir &d) {
+  const int fd = open(d.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    return;
+  }
+  w->ndirs++;
+  // watched before it is read, so that no change to it is missed.
+  const int wd = w->watch ? watcher_watch(w->watch, d.path, d.rel) : -1;
+  std::vector<std::pair<std::string, unsigned char>> entries;
+  static const int BUF_BYTES = 1 << 16;
+  std::vector<char> buf(BUF_BYTES);
+  long n;
+  while ((n = syscall(SYS_getdents64, fd, buf.data(), BUF_BYTES)) > 0) {
+    for (long i = 0; i < n;) {
+      const LinuxDirent64 *e = (const LinuxDirent64 *)(buf.data() + i);
+      i += e->d_reclen;
+      if (strcmp(e->d_name, ".") && strcmp(e->d_name, "..")) {
+        entries.push_back({e->d_name, e->d_type});
+      }
+    }
+  }
+
+  // the ignore files of a directory apply to what is in it. Later rules
+  // win, so .ignore wins over .gitignore, which wins over the exclude file
+  // of the repository.
+  const IgnoreFile *ignore = d.ignore;
+  IgnoreFile *ig = new IgnoreFile();
+  ig->dir = d.rel;
+  ig->parent = d.ignore;
+  bool found = false;
+  if (d.rel.empty()) {
+    found |= ignore_file_read(ig, fd, ".git/info/exclude");
+  }
+  found |= ignore_file_read(ig, fd, ".gitignore");
+  found |= ignore_file_read(ig, fd, ".ignore");
+  if (found) {
+    std::lock_guard<std::mutex> lock(w->mu);
+    w->ignores.push_back(ig);
+    ignore = ig;
+  } else {
+    delete ig;
+  }
+  if (wd >= 0) {
+    watcher_set_ignore(w->watch, wd, ignore);
+  }
+
+  const std::string prefix =
+      d.path.empty() || d.path.back() == '/' ? d.path : d.path + "/";
+  std::vector<std::string> files;
+  std::vector<WalkDir> dirs;
+  for (const auto &[name, type] : entries) {
+    bool is_dir = type == DT_DIR;
+    bool is_file = type == DT_REG;
+    if (type == DT_UNKNOWN || type == DT_LNK) {
+      // symlinks to files are followed, to directories they are not, so
+      // that there are no cycles.
+      struct stat st;
+      if (fstatat(fd, name.c_str(), &st,
+                  type == DT_LNK ? 0 : AT_SYMLINK_NOFOLLOW) < 0) {
+        continue;
+      }
+      is_dir = type == DT_UNKNOWN && S_ISDIR(st.st_mode);
+      is_file = S_ISREG(st.st_mode);
+    }
+    if ((!is_dir && !is_file) || (is_dir && name == ".git")) {
+      continue;
+    }
+    const std::string rel = d.rel + name;
+    if (ignore && ignore_match(ignore, rel, is_dir)) {
+      w->nignored++;
+      continue;
+    }
+    if (is_dir) {
+      dirs.push_back({prefix + name, rel + "/", ignore});
+    } else {
+      files.push_back(prefix + name);
+    }
+  }
+  close(fd);
+
+  if (!dirs.empty()) {
+    {
+      std::lock_guard<std::mutex> lock(w->mu);
+      for (WalkDir &sub : dirs) {
+        w->dirs.push_back(std::move(sub));
+      }
+    }
+    w->cv.notify_all();
+  }
+  if (!files.empty()) {
+    w->nfiles += files.size();
+    index_workers_push(w->out, &files);
+  }
+}
+
+void walker_thread(Walker *w) {
+  std::unique_lock<std::mutex> lock(w->mu);
+  if (!w->files.empty()) {
+    std::vector<std::string> files;
+    files.swap(w->files);
+    w->busy++;
+    lock.unlock();
+    w->nfiles += files.size();
+    index_workers_push(w->out, &files);
+    lock.lock();
+    w->busy--;
+    if (w->busy == 0 && w->dirs.empty()) {
+      w->cv.notify_all();
+    }
+  }
+  while (true) {
+    w->cv.wait(lock, [&] { return !w->dirs.empty() || w->busy == 0; });
+    if (w->dirs.empty()) {
+      break;
+    }
+    const WalkDir d = std::move(w->dirs.back());
+    w->dirs.pop_back();
+    w->busy++;
+    lock.unlock();
+    walker_walk_dir(w, d);
+    lock.lock();
+    w->busy--;
+    if (w->busy == 0 && w->dirs.empty()) {
+      w->cv.notify_all();
+    }
+  }
+  w->done = true;
+}
+
+// walk `dirs` with `n` threads, or one per core if `n` is 0, handing
+// `files` and the files under `dirs` to `out`.
+void walker_start(Walker *w, std::vector<WalkDir> dirs,
+                  std::vector<std::string> files, IndexWorkers *out, int n) {
+  if (n == 0) {
+    n = std::max<int>(1, std::thread::hardware_concurrency());
+  }
+  w->out = out;
+  w->done = false;
+  w->dirs = std::move(dirs);
+  w->files = std::move(files);
+  w->ndirs = 0;
+  w->nfiles = 0;
+  w->nignored = 0;
+  for (int i = 0; i < n; ++i) {
+    w->threads.emplace_back(walker_thread, w);
+  }
+}
+
+// whether the walk is done, in which case its threads are joined.
+bool walker_done(Walker *w) {
+  {
+    std::lock_guard<std::mutex> lock(w->mu);
+    if (!w->done) {
+      return false;
+    }
+  }
+  for (std::thread &t : w->threads) {
+    t.join();
+  }
+  w->threads.clear();
+  if (!w->watch) {
+    for (IgnoreFile *ig : w->ignores) {
+      delete ig;
+    }
+    w->ignores.clear();
+  }
+  return true;
+}
+
+// how far a query of the palette has got, carried from one timeslice to
+// the next.
+struct QueryCursor {
+  // the nodes of the tries whose suffixes are yet to be reported.
+  std::stack<std::pair<const ArtTrie *, ArtRef>> walk_stack;
+  // the range of the suffix array or FM-index that is yet to be reported.
+  int sa_next = 0;
+  int sa_end = 0;
+  // the files of the trigram index that are yet to be scanned for the query.
+  std::vector<int> files;
+  int file_next = 0;
+  // a fuzzy query of the paths of the workspace, see `PALETTE_FUZZY_PREFIX`:
+  // the files yet to be checked, and those that matched. A query that
+  // extends `fuzzy_query` can only match files that it matched or did not
+  // reach.
+  bool fuzzy = false;
+  std::string fuzzy_query;
+  std::vector<int> fuzzy_pool;
+  int fuzzy_next = 0;
+  std::vector<int> fuzzy_kept;
+  int fuzzy_nfiles = 0; // files [fuzzy_nfiles, ..) are not pooled.
+  // a query of the symbols, see `PALETTE_SYMBOL_PREFIX`: the range of each
+  // run of `Index::symbols` that is yet to be reported, from `symbol_run` on.
+  bool symbol = false;
+  std::string symbol_query;
+  std::vector<std::pair<int, int>> symbol_ranges;
+  int symbol_run = 0;
+};
+
+// whether the query has reported all of its matches.
+bool query_cursor_done(const QueryCursor *c) {
+  return c->walk_stack.empty() && c->sa_next >= c->sa_end &&
+         c->file_next >= (int)c->files.size() &&
+         c->fuzzy_next >= (int)c->fuzzy_pool.size() &&
+         c->symbol_run >= (int)c->symbol_ranges.size();
+}
+
+// a query that the palette moved away from, with the matches it had kept.
+struct QueryCacheEntry {
+  std::string input;
+  QueryCursor cursor;
+  std::vector<PaletteMatch> matches;
+  int64_t num_matches = 0;
+  int64_t last_used = 0;
+};
+
+static const int QUERY_CACHE_ENTRIES = 32;
+
+// the last QUERY_CACHE_ENTRIES queries, so that going back to one, as
+// backspace does, carries on from where it was left rather than starting
+// over. Entries are for the index as of `version`, see
+// `TaskManager::index_version`.
+struct QueryCache {
+  std::vector<QueryCacheEntry> entries;
+  int64_t version = 0;
+  int64_t clock = 0;
+};
+
+// forget the entries of `c` if the index has changed since.
+void query_cache_sync(QueryCache *c, int64_t version) {
+  if (c->version != version) {
+    c->entries.clear();
+    c->version = version;
+  }
+}
+
+// add `e`, replacing the entry for the same input or else the least
+// recently used one.
+void query_cache_put(QueryCache *c, QueryCacheEntry e) {
+  e.last_used = ++c->clock;
+  QueryCacheEntry *slot = nullptr;
+  for (QueryCacheEntry &old : c->entries) {
+    if (old.input == e.input) {
+      slot = &old;
+      break;
+    }
+    if (c->entries.size() == QUERY_CACHE_ENTRIES &&
+        (!slot || old.last_used < slot->last_used)) {
+      slot = &old;
+    }
+  }
+  if (slot) {
+    *slot = std::move(e);
+  } else {
+    c->entries.push_back(std::move(e));
+  }
+}
+
+// move the entry for `input` out of `c` into `out`.
+bool query_cache_take(QueryCache *c, const std::string &input,
+                      QueryCacheEntry *out) {
+  for (int i = 0; i < (int)c->entries.size(); ++i) {
+    if (c->entries[i].input == input) {
+      *out = std::move(c->entries[i]);
+      c->entries.erase(c->entries.begin() + i);
+      return true;
+    }
+  }
+  return false;
+}
+
+// the entry for the longest query that `input` extends, or nullptr.
+QueryCacheEntry *query_cache_prefix(QueryCache *c, const std::string &input) {
+  QueryCacheEntry *best = nullptr;
+  for (QueryCacheEntry &e : c->entries) {
+    if (e.input.size() < input.size() &&
+        input.compare(0, e.input.size(), e.input) == 0 &&
+        (!best || e.input.size() > best->input.size())) {
+      best = &e;
+    }
+  }
+  if (best) {
+    best->last_used = ++c->clock;
+  }
+  return best;
+}
+
+struct TaskManager {
+  int query_sequence_number = 0;
+  QueryCursor query;
+  std::string query_input; // the palette input `query` is for.
+  int64_t query_version = 0; // `index_version` when `query` started.
+  QueryCache query_cache;
+  // bumped whenever the index changes, which stales cached queries.
+  int64_t index_version = 0;
+  // the sequence number of the last query that walked each trie shard, to
+  // evict the coldest when over budget.
+  std::unordered_map<const ArtTrie *, int> shard_used;
+  std::vector<uint64_t> fuzzy_masks; // of the paths of `files`.
+
+  // indexing of the workspace, or of what `watcher` saw change in it:
+  // `walker` hands its files to `workers`.
+  bool indexing = false;
+  Walker walker;
+  IndexWorkers workers;
+  Watcher watcher;
+  int nworkers = 0; // 0 for one per core, for each of the pools.
+  std::vector<File *> files; // every file that has been indexed.
+  // files that changed on disk since they were indexed, see
+  // `task_manager_retire`.
+  std::vector<File *> retired;
+  int nbinary = 0; // files that were skipped as binaries.
+  std::string root;
+  // where the index is saved. Defaults to `index_file_path` of the root.
+  std::string index_path;
+
+  // when the editor was last saved.
+  std::chrono::steady_clock::time_point last_save;
+};
+
+// index `files` and the files under `dirs` into `index`. Done once
+// `s->indexing` is false again.
+void task_manager_start_job(TaskManager *s, Index *index,
+                            std::vector<WalkDir> dirs,
+                            std::vector<std::string> files) {
+  s->indexing = true;
+  s->workers.memory = index_memory(index);
+  index_workers_start(&s->workers, index, s->nworkers);
+  walker_start(&s->walker, std::move(dirs), std::move(files), &s->workers,
+               s->nworkers);
+}
+
+// start indexing every file under `root` into `index`, loading what was
+// saved of it by the last run. The trie and the trigram index then follow
+// changes to the workspace; the others are built once.
+void task_manager_start_indexing(TaskManager *s, Index *index,
+                                 const std::string &root) {
+  s->root = root;
+  if (s->index_path.empty()) {
+    s->index_path = index_file_path(root);
+  }
+  if (index->kind == IndexKind::Trigram) {
+    trigram_index_load(&index->trigram, s->index_path);
+  }
+  if ((index->kind == IndexKind::Trie || index->kind == IndexKind::Trigram) &&
+      watcher_start(&s->watcher, root)) {
+    s->walker.watch = &s->watcher;
+  }
+  task_manager_start_job(s, index, {{root, "", nullptr}}, {});
+}
+
+// what the walk has found so far.
+std::string task_manager_walk_report(const TaskManager *s) {
+  std::string out = std::to_string(s->walker.nfiles) + " files in " +
+                    std::to_string(s->walker.ndirs) + " dirs";
+  if (s->walker.nignored) {
+    out += " | ignored: " + std::to_string(s->walker.nignored);
+  }
+  if (s->nbinary) {
+    out += " | binaries: " + std::to_string(s->nbinary);
+  }
+  return out;
+}
+
+// the index changed under the query: start it over.
+void task_manager_reset_query(TaskManager *s) {
+  s->query = QueryCursor();
+  s->query_input.clear();
+  s->query_sequence_number = -1;
+  s->index_version++;
+}
+
+// the paths of the files that are open in the editor, whose index follows
+// their edits rather than what is on disk.
+std::unordered_set<std::string_view> task_manager_editing(const Index *index) {
+  std::unordered_set<std::string_view> paths;
+  for (const LiveDoc &d : index->live.docs) {
+    if (d.file) {
+      paths.insert(d.file->path);
+    }
+  }
+  return paths;
+}
+
+// `gone` changed on disk since they were indexed: their ids in the trigram
+// index and their suffixes in the trie are dead, and their symbols are
+// dropped. They are kept, as the index still points to them. The edges of
+// the tries are labelled with the text of the files, so only the trigram
+// index gives the text back.
+void task_manager_retire(TaskManager *s, Index *index,
+                         const std::unordered_set<File *> &gone) {
+  if (gone.empty()) {
+    return;
+  }
+  for (File *&f : index->trigram.files) {
+    if (f && gone.count(f)) {
+      f = nullptr;
+    }
+  }
+  for (std::vector<Symbol> &run : index->symbols) {
+    run.erase(std::remove_if(run.begin(), run.end(),
+                             [&](const Symbol &sym) {
+                               return gone.count(sym.file) != 0;
+                             }),
+              run.end());
+  }
+  for (File *f : gone) {
+    auto it = index->tiers.find(f);
+    if (it != index->tiers.end()) {
+      index->ntier[(int)it->second]--;
+      index->tiers.erase(it);
+    } else if (index->evicted.erase(f)) {
+      index->nevicted--;
+    }
+    index->live.files[f].dead = true;
+    if (index->kind == IndexKind::Trigram) {
+      file_release(f);
+    }
+    s->retired.push_back(f);
+  }
+  // the query may be reading them.
+  task_manager_reset_query(s);
+}
+
+// while the index is over its budget, evict the trie shard that was walked
+// by a query longest ago, or failing that the last one indexed. Its files
+// are then only found by path.
+void task_manager_enforce_budget(TaskManager *s, Index *index) {
+  long long memory = index_memory(index);
+  while (memory > index->policy.budget && !index->trie_shards.empty()) {
+    int cold = 0;
+    for (int i = 1; i < (int)index->trie_shards.size(); ++i) {
+      if (s->shard_used[index->trie_shards[i]] <=
+          s->shard_used[index->trie_shards[cold]]) {
+        cold = i;
+      }
+    }
+    ArtTrie *t = index->trie_shards[cold];
+    memory -= art_memory(t);
+    s->workers.memory -= art_memory(t);
+    index->nevicted += t->files.size();
+    index->ntier[(int)IndexTier::Full] -= t->files.size();
+    for (const File *f : t->files) {
+      index->tiers.erase(f);
+      index->evicted.insert(f);
+    }
+    index->trie_shards.erase(index->trie_shards.begin() + cold);
+    s->shard_used.erase(t);
+    delete t;
+    // the query may be walking the shard.
+    task_manager_reset_query(s);
+  }
+}
+
+// the index is complete: build what is built once, and say so.
+void task_manager_finish_indexing(TaskManager *s, BottomlineState *bot,
+                                  Index *g_index) {
+  bot->info = "DONE indexing;";
+  if (g_index->kind == IndexKind::SuffixArray) {
+    suffix_array_build(&g_index->sa);
+    bot->info += "#bytes: " + std::to_string(g_index->sa.sa.size());
+    bot->info +=
+        " #MB: " + std::to_string(suffix_array_memory(&g_index->sa) >> 20);
+  } else if (g_index->kind == IndexKind::Trigram) {
+    const TrigramIndex *ix = &g_index->trigram;
+    // the files of `base` that are still alive were cached. Ids of files
+    // that changed since, there or later, are dead and hold nullptr.
+    int nfiles = 0, ncached = 0;
+    for (int i = 0; i < (int)ix->files.size(); ++i) {
+      nfiles += ix->files[i] != nullptr;
+      ncached += i < ix->nbase && ix->files[i] != nullptr;
+    }
+    bot->info += "#files: " + std::to_string(nfiles);
+    bot->info += " #cached: " + std::to_string(ncached);
+    bot->info += " #MB: " + std::to_string(trigram_index_memory(ix) >> 20);
+    if (trigram_index_dirty(ix) && !trigram_index_save(ix, s->index_path)) {
+      bot->info += " | unable to save: " + s->index_path;
+    }
+  } else if (g_index->kind == IndexKind::FmIndex) {
+    suffix_array_sort(&g_index->sa);
+    fm_index_build(&g_index->fm, &g_index->sa);
+    bot->info += "#bytes: " + std::to_string(g_index->fm.n);
+    bot->info += " #MB: " + std::to_string(fm_index_memory(&g_index->fm) >> 20);
+  } else {
+    long long nsuffixes = 0, nbytes = 0;
+    for (const ArtTrie *t : g_index->trie_shards) {
+      nsuffixes += t->nsuffixes;
+      nbytes += art_memory(t);
+    }
+    bot->info += "#suffixes: " + std::to_string(nsuffixes);
+    bot->info += " #shards: " + std::to_string(g_index->trie_shards.size());
+    bot->info += " #MB: " + std::to_string(nbytes >> 20);
+  }
+  long long nsymbols = 0;
+  for (const std::vector<Symbol> &run : g_index->symbols) {
+    nsymbols += run.size();
+  }
+  if (nsymbols) {
+    bot->info += " #symbols: " + std::to_string(nsymbols);
+  }
+  task_manager_enforce_budget(s, g_index);
+  bot->info += " | " + task_manager_walk_report(s);
+  bot->info += " | " + index_policy_report(g_index, index_memory(g_index));
+  s->indexing = false;
+  s->index_version++;
+}
+
+void task_manager_explore_directory_timeslice(TaskManager *s,
+                                              BottomlineState *bot,
+                                              Index *g_index) {
+  assert(s->indexing);
+  bool done;
+  bool collected = false;
+  // a file that is open in the editor may have been read again by a job of
+  // the watcher. It is the editor's copy that counts.
+  const std::unordered_set<std::string_view> editing =
+      task_manager_editing(g_index);
+  for (IndexShard *shard : index_workers_collect(&s->workers, &done)) {
+    s->nbinary += shard->nbinary;
+    std::unordered_set<File *> gone;
+    for (File *f : shard->files) {
+      if (editing.count(f->path)) {
+        gone.insert(f);
+      } else {
+        s->files.push_back(f);
+      }
+    }
+    index_shard_collect(g_index, shard);
+    task_manager_retire(s, g_index, gone);
+    s->index_version++;
+    collected = true;
+  }
+  if (collected) {
+    task_manager_enforce_budget(s, g_index);
+  }
+  if (done) {
+    task_manager_finish_indexing(s, bot, g_index);
+    return;
+  }
+  if (!s->walker.threads.empty() && !walker_done(&s->walker)) {
+    bot->info = "walking: " + task_manager_walk_report(s) + " | " +
+                index_policy_report(g_index, s->workers.memory);
+    return;
+  }
+  index_workers_close(&s->workers);
+  bot->info = "indexing: " + task_manager_walk_report(s) + " | " +
+              index_policy_report(g_index, s->workers.memory);
+}
+
+// whether `path` is one of `paths`, or is below one of `dirs`.
+bool path_changed(const std::string &path,
+                  const std::unordered_set<std::string_view> &paths,
+                  const std::unordered_set<std::string_view> &dirs) {
+  if (paths.count(path)) {
+    return true;
+  }
+  const std::string_view p(path);
+  for (size_t i = p.rfind('/'); i != std::string_view::npos && i > 0 &&
+                                !dirs.empty();
+       i = p.rfind('/', i - 1)) {
+    if (dirs.count(p.substr(0, i))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// take the indexed files under the paths that changed out of `s->files`,
+// and retire them, but for those that are open in the editor.
+void task_manager_forget(TaskManager *s, Index *index,
+                         const std::unordered_set<std::string_view> &paths,
+                         const std::unordered_set<std::string_view> &dirs) {
+  const std::unordered_set<std::string_view> editing =
+      task_manager_editing(index);
+  std::unordered_set<File *> gone;
+  int out = 0;
+  int nmasks = 0;
+  for (int i = 0; i < (int)s->files.size(); ++i) {
+    File *f = s->files[i];
+    if (!editing.count(f->path) && path_changed(f->path, paths, dirs)) {
+      gone.insert(f);
+      continue;
+    }
+    // the masks of the paths are kept in step with the files.
+    if (i < (int)s->fuzzy_masks.size()) {
+      s->fuzzy_masks[nmasks++] = s->fuzzy_masks[i];
+    }
+    s->files[out++] = f;
+  }
+  if (gone.empty()) {
+    return;
+  }
+  s->files.resize(out);
+  s->fuzzy_masks.resize(nmasks);
+  task_manager_retire(s, index, gone);
+}
+
+// reindex what changed in the workspace once it is due, and the last job is
+// done: what is gone is forgotten, what is there is forgotten and read again.
+void task_manager_watch_timeslice(TaskManager *s, BottomlineState *bot,
+                                  Index *index) {
+  const auto now = std::chrono::steady_clock::now();
+  watcher_read(&s->watcher, now);
+  if (s->indexing) {
+    return;
+  }
+  const std::vector<std::pair<std::string, WatchChange>> due =
+      watcher_take(&s->watcher, now);
+  if (due.empty()) {
+    return;
+  }
+  std::unordered_set<std::string_view> paths;
+  std::unordered_set<std::string_view> dirs;
+  for (const auto &[path, c] : due) {
+    paths.insert(path);
+    if (c.is_dir) {
+      dirs.insert(path);
+    }
+  }
+  task_manager_forget(s, index, paths, dirs);
+
+  std::vector<WalkDir> walk;
+  std::vector<std::string> files;
+  std::unordered_set<std::string_view> walked; // the paths of `walk`.
+  for (const auto &[path, c] : due) {
+    // symlinks are followed to files but not to directories, as by the walk.
+    struct stat st;
+    if (lstat(path.c_str(), &st) < 0 ||
+        (S_ISLNK(st.st_mode) && (stat(path.c_str(), &st) < 0 ||
+                                 !S_ISREG(st.st_mode)))) {
+      continue;
+    }
+    const bool is_dir = S_ISDIR(st.st_mode);
+    const size_t slash = c.rel.rfind('/');
+    if (c.rel.substr(slash == std::string::npos ? 0 : slash + 1) == ".git") {
+      continue;
+    }
+    const IgnoreFile *ignore = nullptr;
+    if (c.wd != -1) {
+      std::lock_guard<std::mutex> lock(s->watcher.mu);
+      auto it = s->watcher.dirs.find(c.wd);
+      if (it == s->watcher.dirs.end()) {
+        continue; // its directory went away since.
+      }
+      ignore = it->second.ignore;
+      if (c.self && ignore && ignore->dir == it->second.rel) {
+        ignore = ignore->parent;
+      }
+    }
+    if (ignore && !c.rel.empty() && ignore_match(ignore, c.rel, is_dir)) {
+      continue;
+    }
+    if (is_dir) {
+      walk.push_back({path, c.rel.empty() ? "" : c.rel + "/", ignore});
+      walked.insert(path);
+    } else if (S_ISREG(st.st_mode)) {
+      files.push_back(path);
+    }
+  }
+  // what is under a directory that is walked is left to the walk, which
+  // reads its ignore files anew.
+  walk.erase(std::remove_if(walk.begin(), walk.end(),
+                            [&](const WalkDir &d) {
+                              return path_changed(d.path, {}, walked);
+                            }),
+             walk.end());
+  files.erase(std::remove_if(files.begin(), files.end(),
+                             [&](const std::string &path) {
+                               return path_changed(path, {}, walked);
+                             }),
+              files.end());
+  bot->info = "changed: " + std::to_string(due.size()) + " paths";
+  if (!walk.empty() || !files.empty()) {
+    task_manager_start_job(s, index, std::move(walk), std::move(files));
+  }
+}
+
+// TODO: I need some way to express that TaskManager is only alowed to
+// insert into pal->matches. must be monotonic.
+// matches reported per timeslice from the suffix array.
+static const int QUERY_SA_MATCHES_PER_TIMESLICE = 64;
+// bytes of candidate files scanned per timeslice for the trigram index.
+static const int QUERY_SCAN_BYTES_PER_TIMESLICE = 1 << 20;
+// suffixes reported per timeslice from the trie.
+static const int QUERY_TRIE_MATCHES_PER_TIMESLICE = 4096;
+// paths checked per timeslice by a fuzzy query.
+static const int QUERY_FUZZY_PATHS_PER_TIMESLICE = 8192;
+// symbols reported per timeslice by a query of the symbols.
+static const int QUERY_SYMBOLS_PER_TIMESLICE = 4096;
+
+// where the path of `f` below the root of the workspace begins.
+int task_manager_path_begin(const TaskManager *s, const File *f) {
+  const std::string &p = f->path;
+  if (s->root.empty() || p.compare(0, s->root.size(), s->root) != 0) {
+    return 0;
+  }
+  int b = s->root.size();
+  while (b < (int)p.size() && p[b] == '/') {
+    b++;
+  }
+  return b;
+}
+
+// start the fuzzy query `q` of the paths of the workspace. If `s->query` is
+// a fuzzy query that `q` extends, carry on from what it matched.
+void task_manager_fuzzy_start(TaskManager *s, const std::string &q) {
+  QueryCursor *c = &s->query;
+  std::vector<int> pool;
+  if (c->fuzzy && q.compare(0, c->fuzzy_query.size(), c->fuzzy_query) == 0) {
+    pool = std::move(c->fuzzy_kept);
+    pool.insert(pool.end(), c->fuzzy_pool.begin() + c->fuzzy_next,
+                c->fuzzy_pool.end());
+  } else {
+    c->fuzzy_nfiles = 0;
+  }
+  for (int i = c->fuzzy_nfiles; i < (int)s->files.size(); ++i) {
+    pool.push_back(i);
+  }
+  c->fuzzy = true;
+  c->fuzzy_query = q;
+  c->fuzzy_pool = std::move(pool);
+  c->fuzzy_next = 0;
+  c->fuzzy_kept.clear();
+  c->fuzzy_nfiles = s->files.size();
+}
+
+// check the next paths of the pool of the fuzzy query, scoring those that
+// match.
+void task_manager_fuzzy_timeslice(TaskManager *s, CommandPaletteState *pal) {
+  QueryCursor *c = &s->query;
+  const std::string &q = c->fuzzy_query;
+  const bool fold = fuzzy_folds(q.c_str(), q.size());
+  const uint64_t qmask = fuzzy_mask(q.c_str(), q.size());
+  const int end =
+      std::min<int>(c->fuzzy_pool.size(),
+                    c->fuzzy_next + QUERY_FUZZY_PATHS_PER_TIMESLICE);
+  for (; c->fuzzy_next < end; ++c->fuzzy_next) {
+    const int id = c->fuzzy_pool[c->fuzzy_next];
+    File *f = s->files[id];
+    const int b = task_manager_path_begin(s, f);
+    const char *p = f->path.c_str() + b;
+    const int n = f->path.size() - b;
+    if (id == (int)s->fuzzy_masks.size()) {
+      // files are pooled in order, so masks are made as they are reached.
+      s->fuzzy_masks.push_back(fuzzy_mask(p, n));
+    }
+    assert(id < (int)s->fuzzy_masks.size());
+    if ((s->fuzzy_masks[id] & qmask) != qmask) {
+      continue;
+    }
+    if (!fuzzy_subsequence(p, n, q.c_str(), q.size(), fold)) {
+      continue;
+    }
+    c->fuzzy_kept.push_back(id);
+    PaletteMatch m;
+    m.loc = Loc(f, 0, 0, 0);
+    m.fuzzy = true;
+    m.score = fuzzy_score(p, n, q.c_str(), q.size(), fold, nullptr);
+    if (!palette_keeps(pal, m.score)) {
+      pal->num_matches++;
+      continue;
+    }
+    // only walk the alignment back for the matches that are shown.
+    fuzzy_score(p, n, q.c_str(), q.size(), fold, &m.path);
+    for (int &j : m.path) {
+      j += b;
+    }
+    palette_keep_match(pal, std::move(m));
+  }
+}
+
+// start the query of the symbols whose names start with `q`: a binary search
+// of each run.
+void task_manager_symbol_start(TaskManager *s, const Index *index,
+                               const std::string &q) {
+  QueryCursor *c = &s->query;
+  c->symbol = true;
+  c->symbol_query = q;
+  for (const std::vector<Symbol> &run : index->symbols) {
+    int begin, end;
+    symbol_range(run, q.c_str(), q.size(), &begin, &end);
+    c->symbol_ranges.push_back({begin, end});
+  }
+}
+
+// report the next symbols of the query of the symbols. Only those that are
+// kept are located in their files.
+void task_manager_symbol_timeslice(TaskManager *s, CommandPaletteState *pal,
+                                   const Index *index) {
+  QueryCursor *c = &s->query;
+  const std::string &q = c->symbol_query;
+  int reported = 0;
+  while (c->symbol_run < (int)c->symbol_ranges.size() &&
+         reported < QUERY_SYMBOLS_PER_TIMESLICE) {
+    auto &[next, end] = c->symbol_ranges[c->symbol_run];
+    const std::vector<Symbol> &run = index->symbols[c->symbol_run];
+    for (; next < end && reported < QUERY_SYMBOLS_PER_TIMESLICE;
+         ++next, ++reported) {
+      const Symbol &sym = run[next];
+      PaletteMatch m;
+      m.score = symbol_score(sym, q.c_str(), q.size());
+      if (!palette_keeps(pal, m.score)) {
+        pal->num_matches++;
+        continue;
+      }
+      if (!sym.file->rope.root) {
+        file_build_rope(sym.file);
+      }
+      m.loc = Loc::at(sym.file, sym.name);
+      m.len = sym.len;
+      palette_keep_match(pal, std::move(m));
+    }
+    if (next == end) {
+      c->symbol_run++;
+    }
+  }
+}
+
+// switch from the current query to `pal->input`. The current query goes into
+// the cache. The new one is taken from the cache if it is there, narrowed
+// from a cached query that it extends if it can be, or else started afresh.
+void task_manager_start_query(TaskManager *s, CommandPaletteState *pal,
+                              const Index *index) {
+  query_cache_sync(&s->query_cache, s->index_version);
+  if (!s->query_input.empty() && s->query_version == s->index_version) {
+    QueryCacheEntry e;
+    e.input = std::move(s->query_input);
+    e.cursor = std::move(s->query);
+    e.matches = std::move(pal->matches);
+    e.num_matches = pal->num_matches;
+    query_cache_put(&s->query_cache, std::move(e));
+  }
+  s->query = QueryCursor();
+  s->query_input = pal->input;
+  s->query_version = s->index_version;
+  pal->matches.clear();
+  pal->num_matches = 0;
+  if (pal->input.size() == 0) {
+    return;
+  }
+
+  QueryCacheEntry cached;
+  if (query_cache_take(&s->query_cache, pal->input, &cached)) {
+    s->query = std::move(cached.cursor);
+    pal->matches = std::move(cached.matches);
+    pal->num_matches = cached.num_matches;
+    return;
+  }
+
+  if (pal->input[0] == PALETTE_SYMBOL_PREFIX) {
+    task_manager_symbol_start(s, index, pal->input.substr(1));
+    return;
+  }
+  const QueryCacheEntry *prefix =
+      query_cache_prefix(&s->query_cache, pal->input);
+  if (pal->input[0] == PALETTE_FUZZY_PREFIX) {
+    if (prefix) {
+      s->query = prefix->cursor;
+    }
+    task_manager_fuzzy_start(s, pal->input.substr(1));
+    return;
+  }
+  if (prefix && query_cursor_done(&prefix->cursor) &&
+      prefix->num_matches <= NUM_ANSWERS) {
+    // the prefix kept every one of its matches, and those of the input are
+    // among them. Offer them in the order they first arrived.
+    std::vector<PaletteMatch> ms = prefix->matches;
+    std::sort(ms.begin(), ms.end(),
+              [](const PaletteMatch &a, const PaletteMatch &b) {
+                return a.seq < b.seq;
+              });
+    const int64_t now = time(nullptr);
+    const std::string &q = pal->input;
+    for (const PaletteMatch &m : ms) {
+      const File *f = m.loc.file;
+      if (m.loc.ix + (int)q.size() <= f->len &&
+          !memcmp(f->buf + m.loc.ix, q.data(), q.size())) {
+        palette_add_match(pal, m.loc, now);
+      }
+    }
+    return;
   }
-  return 0;
-}
 
-static int text_width(mu_Font font, const char *text, int len) {
-  if (len == -1) {
-    len = strlen(text);
+  if (index->kind == IndexKind::SuffixArray) {
+    if (!index->sa.sa.empty()) {
+      suffix_array_range(&index->sa, pal->input.c_str(), pal->input.size(),
+                         &s->query.sa_next, &s->query.sa_end);
+    }
+  } else if (index->kind == IndexKind::FmIndex) {
+    if (index->fm.n) {
+      fm_index_range(&index->fm, pal->input.c_str(), pal->input.size(),
+                     &s->query.sa_next, &s->query.sa_end);
+    }
+  } else if (index->kind == IndexKind::Trigram) {
+    s->query.files = trigram_index_candidates(
+        &index->trigram, pal->input.c_str(), pal->input.size());
+  } else {
+    // we need to explore the full subtree under the key in every trie.
+    std::vector<const ArtTrie *> tries = {&index->trie};
+    tries.insert(tries.end(), index->trie_shards.begin(),
+                 index->trie_shards.end());
+    for (const ArtTrie *t : tries) {
+      const ArtRef cur = art_lookup(t, pal->input.c_str(), pal->input.size());
+      if (cur != ART_NULL) {
+        s->query.walk_stack.push({t, cur});
+      }
+    }
+    // and scan the files that were indexed into trigrams to save memory.
+    if (!index->trigram.files.empty()) {
+      s->query.files = trigram_index_candidates(
+          &index->trigram, pal->input.c_str(), pal->input.size());
+    }
   }
-  return r_get_text_width(text, len);
 }
 
-static int text_height(mu_Font font) { return r_get_text_height(); }
-
-struct TaskManager {
-  int query_sequence_number = 0;
-  // pairs of trie nodes, and how much of the query length they match.
-  std::stack<const TrieNode *> query_walk_stack;
-};
-
-// void task_manager_explore_directory_timeslice(TaskManager* s,
-//                                               BottomlineState* bot) {
-//     assert(s->indexing);
-//     if (s->ix_it == std::filesystem::end(s->ix_it)) {
-//         bot->info = "DONE indexing;";
-//         bot->info += "#nodes: " +
-//         std::to_string(TrieNode::NUM_TRIE_NODES); bot->info += " #edges:
-//         " + std::to_string(TrieEdge::NUM_TRIE_EDGES); s->indexing =
-//         false; return;
-//     };
-//
-//     const std::filesystem::path curp = *s->ix_it;
-//     if ((curp.string().find(".git") != std::string::npos) ||
-//         (curp.string().find("test") != std::string::npos)) {
-//         s->ix_it++;
-//         return;
-//     }
-//
-//     s->ix_it++;  // next file.
-//     bot->info = "walking: " + curp.string();
-//     if (!std::filesystem::is_regular_file(curp)) {
-//         return;
-//     }
-//
-//     assert(std::filesystem::is_regular_file(curp));
-//     FILE* fp = fopen(curp.c_str(), "rb");
-//     assert(fp && "unable to open file");
-//
-//     fseek(fp, 0, SEEK_END);
-//     const int total_size = ftell(fp);
-//
-//     s->index_loc = Loc();
-//     s->index_loc->file = new File(curp.string(), total_size);
-//     s->index_loc->file->buf = new char[total_size];
-//     s->index_loc->ix = 0;
-//     s->index_loc->line = 0;
-//     s->index_loc->col = 0;
-//
-//     fseek(fp, 0, SEEK_SET);
-//     const int nread = fread(s->index_loc->file->buf, 1, total_size, fp);
-//     fclose(fp);
-//     assert(nread == total_size && "unable to read file");
-//     bot->info = "ix: " + curp.string() + " | 0%";
-// }
-//
-// void task_manager_index_file_timeslice(TaskManager* s, BottomlineState*
-// bot,
-//                                        TrieNode* g_index) {
-//     assert(s->index_loc);
-//     assert(s->index_loc->valid());
-//
-//     while (!s->index_loc->eof() && is_whitespace(s->index_loc->get())) {
-//         s->index_loc = s->index_loc->advance();
-//     }
-//
-//     assert(s->index_loc->valid());
-//     if (s->index_loc->eof()) {
-//         bot->info = "DONE indexing " + s->index_loc->file->path;
-//         s->index_loc = {};
-//         return;
-//     }
-//     assert(!is_whitespace(s->index_loc->get()));
-//
-//     Loc eol = *s->index_loc;
-//     static const int MAX_SUFFIX_LEN = 80;
-//     static const int MAX_NGRAMS = 3;
-//     int ngrams = 0;
-//     while (!eol.eof() && !is_newline(eol.get()) && ngrams < MAX_NGRAMS &&
-//            (eol.ix - s->index_loc->ix) <= MAX_SUFFIX_LEN) {
-//         if (is_whitespace(eol.get())) {
-//             ngrams++;
-//         }
-//         eol = eol.advance();
-//     }
-//
-//     for (Loc sufloc = *s->index_loc; sufloc.ix < eol.ix;
-//          sufloc = sufloc.advance()) {
-//         const int len = eol.ix - sufloc.ix;
-//         // TODO: this seems stupid, what additional data does sufloc even
-//         // provide? (line, col) info? the edge seems to contain most of
-//         the
-//         // info?
-//         index_add(g_index, sufloc.file, sufloc.ix, len, sufloc);
-//         assert(!sufloc.eof());
-//     }
-//
-//     const float percent =
-//         100.0 * ((float)s->index_loc->ix / s->index_loc->file->len);
-//     bot->info = "ix: ";
-//     bot->info += s->index_loc->file->path;
-//     bot->info += " | ";
-//     bot->info += std::to_string(percent);
-//     bot->info += " | ";
-//     for (int i = s->index_loc->ix; i < eol.ix; ++i) {
-//         bot->info += s->index_loc->file->buf[i];
-//     }
-//
-//     s->index_loc = eol;
-// }
-
-// TODO: I need some way to express that TaskManager is only alowed to
-// insert into pal->matches. must be monotonic.
+// offer matches of `pal->input` to the palette, a timeslice at a time. The
+// palette only keeps the best NUM_ANSWERS, so a query holds O(NUM_ANSWERS)
+// matches however many it finds.
 void task_manager_query_timeslice(TaskManager *s, CommandPaletteState *pal,
-                                  TrieNode *g_index) {
+                                  const Index *index) {
   assert(s->query_sequence_number <= pal->sequence_number);
   if (s->query_sequence_number < pal->sequence_number) {
     s->query_sequence_number = pal->sequence_number;
-    s->query_walk_stack = std::stack<const TrieNode *>();
+    pal->matches_sequence_number = pal->sequence_number;
+    // then fall through to report the first matches in this same timeslice.
+    task_manager_start_query(s, pal, index);
+  }
 
-    if (pal->input.size() == 0) {
-      return;
+  if (s->query.fuzzy) {
+    task_manager_fuzzy_timeslice(s, pal);
+    return;
+  }
+  if (s->query.symbol) {
+    task_manager_symbol_timeslice(s, pal, index);
+    return;
+  }
+
+  const int64_t now = time(nullptr);
+  if (s->query.sa_next < s->query.sa_end) {
+    const int end = std::min<int>(
+        s->query.sa_end, s->query.sa_next + QUERY_SA_MATCHES_PER_TIMESLICE);
+    for (; s->query.sa_next < end; ++s->query.sa_next) {
+      palette_add_match(pal,
+                        index->kind == IndexKind::FmIndex
+                            ? fm_index_loc(&index->fm, s->query.sa_next)
+                            : suffix_array_loc(&index->sa, s->query.sa_next),
+                        now);
     }
+    return;
+  }
 
-    const TrieNode *cur =
-        index_lookup(g_index, pal->input.c_str(), pal->input.size());
-    if (!cur) {
-      return;
+  if (s->query.file_next < (int)s->query.files.size()) {
+    const std::string &q = pal->input;
+    int scanned = 0;
+    while (s->query.file_next < (int)s->query.files.size() &&
+           scanned < QUERY_SCAN_BYTES_PER_TIMESLICE) {
+      File *f = index->trigram.files[s->query.files[s->query.file_next++]];
+      if (!f->rope.root) {
+        file_build_rope(f);
+      }
+      const char *end = f->buf + f->len;
+      for (const char *p = f->buf;
+           (p = simd_memmem(p, end - p, q.data(), q.size())); ++p) {
+        palette_add_match(pal, Loc::at(f, p - f->buf), now);
+      }
+      scanned += f->len;
+    }
+    return;
+  }
+
+  int reported = 0;
+  while (!s->query.walk_stack.empty() &&
+         reported < QUERY_TRIE_MATCHES_PER_TIMESLICE) {
+    const auto [t, top] = s->query.walk_stack.top();
+    s->query.walk_stack.pop();
+    s->shard_used[t] = s->query_sequence_number;
+    art_for_each_suffix(t, top, [&](int file, int ix) {
+      Loc l;
+      if (live_index_loc(&index->live, t->files[file], ix, &l)) {
+        palette_add_match(pal, l, now);
+      }
+      reported++;
+    });
+    art_for_each_child(t, top, [&](uint8_t c, ArtRef child) {
+      s->query.walk_stack.push({t, child});
+    });
+  }
+}
+
+// stream the rest of the file being edited into the editor.
+void task_manager_load_timeslice(TaskManager *s, EditorState *editor,
+                                 BottomlineState *bot) {
+  assert(editor_loading(editor));
+  editor_load_chunk(editor, EDITOR_LOAD_CHUNK_LEN);
+  const File *f = editor->file;
+  const float percent = 100.0 * ((float)editor->text.origlen / f->len);
+  bot->info = "loading: " + f->path + " | " + std::to_string(percent) + "%";
+  if (!editor_loading(editor)) {
+    bot->info = "loaded: " + f->path + " | " +
+                std::to_string(editor_num_lines(editor)) + " lines";
+    if (!editor->utf8_valid) {
+      bot->info += " | not valid UTF-8";
     }
-    // we need to explore the full subtree under `cur`.
-    s->query_walk_stack.push(cur);
+    file_advise(editor->file, MADV_RANDOM);
   }
+}
 
-  if (s->query_walk_stack.empty()) {
+// bring the trie up to date with the lines edited in the editor. Waits while
+// the file being edited is yet to be indexed. The other indexes are built
+// once, and do not follow edits.
+void task_manager_reindex_timeslice(TaskManager *s, EditorState *editor,
+                                    Index *g_index) {
+  assert(editor->index_edit);
+  if (g_index->kind != IndexKind::Trie || editor->path.empty()) {
+    editor->index_edit.reset();
+    return;
+  }
+  LiveIndex *live = &g_index->live;
+  const int doc =
+      live_index_doc(live, s->files, editor->path, !s->indexing);
+  if (doc == -1) {
     return;
   }
+  if (live->docs[doc].file) {
+    live_index_edit(live, &g_index->trie, &g_index->policy, doc,
+                    *editor->index_edit,
+                    [&](int begin, int end) {
+                      std::string text;
+                      for (int i = begin; i < end; ++i) {
+                        text += editor_line(editor, i);
+                        text += i + 1 < end ? "\n" : "";
+                      }
+                      return text;
+                    });
+    s->index_version++;
+  }
+  editor->index_edit.reset();
+}
+
+// saves at most once every SAVE_COALESCE_MS. Requests in between are
+// coalesced into a single save at the end of the interval.
+static const int SAVE_COALESCE_MS = 500;
 
-  const TrieNode *top = s->query_walk_stack.top();
-  s->query_walk_stack.pop();
-  pal->matches.insert(pal->matches.end(), top->data.begin(), top->data.end());
-  for (auto it : top->adj) {
-    s->query_walk_stack.push(it.second.node);
+void task_manager_save_timeslice(TaskManager *s, EditorState *editor,
+                                 BottomlineState *bot) {
+  assert(editor->save_requested);
+  const auto now = std::chrono::steady_clock::now();
+  if (now - s->last_save < std::chrono::milliseconds(SAVE_COALESCE_MS)) {
+    return;
   }
+  editor->save_requested = false;
+  s->last_save = now;
+  editor_save(editor, &bot->info);
 }
 
-void task_manager_run_timeslice(TaskManager *s, CommandPaletteState *pal,
-                                BottomlineState *bot, TrieNode *g_index) {
-  // if (s->indexing) {
-  //     if (!s->index_loc) {
-  //         task_manager_explore_directory_timeslice(s, bot);
-  //     } else {
-  //         task_manager_index_file_timeslice(s, bot, g_index);
-  //     }
-  // }
-  // task_manager_query_timeslice(s, pal, g_index);
+void task_manager_run_timeslice(TaskManager *s, EditorState *editor,
+                                CommandPaletteState *pal, BottomlineState *bot,
+                                Index *g_index) {
+  if (editor->save_requested) {
+    task_manager_save_timeslice(s, editor, bot);
+  }
+  if (editor_loading(editor)) {
+    task_manager_load_timeslice(s, editor, bot);
+  }
+  if (editor->index_edit) {
+    task_manager_reindex_timeslice(s, editor, g_index);
+  }
+  if (s->watcher.fd >= 0) {
+    task_manager_watch_timeslice(s, bot, g_index);
+  }
+  if (s->indexing) {
+    task_manager_explore_directory_timeslice(s, bot, g_index);
+  }
+  task_manager_query_timeslice(s, pal, g_index);
 }
 
 // ===RENDERER===
@@ -1330,15 +7711,19 @@ void r_draw_rect(mu_Rect rect, mu_Color color) {
   push_quad(rect, atlas[ATLAS_WHITE], color);
 }
 
+// the atlas only has ASCII. Other characters are drawn as the glyph at 127,
+// as wide as the columns they take; marks that combine are not drawn.
 void r_draw_text(const char *text, mu_Vec2 pos, mu_Color color) {
   mu_Rect dst = {pos.x, pos.y, 0, 0};
-  for (const char *p = text; *p; p++) {
-    if ((*p & 0xc0) == 0x80) {
+  const int len = strlen(text);
+  for (int i = 0, n, cp; i < len; i += n) {
+    n = utf8_decode(text + i, len - i, &cp);
+    const int width = cp < 128 ? 1 : utf8_width(cp);
+    if (width == 0) {
       continue;
     }
-    int chr = mu_min((unsigned char)*p, 127);
-    mu_Rect src = atlas[ATLAS_FONT + chr];
-    dst.w = src.w;
+    mu_Rect src = atlas[ATLAS_FONT + mu_min(cp, 127)];
+    dst.w = src.w * width;
     dst.h = src.h;
     push_quad(dst, src, color);
     dst.x += dst.w;
@@ -1354,12 +7739,10 @@ void r_draw_icon(int id, mu_Rect rect, mu_Color color) {
 
 int r_get_text_width(const char *text, int len) {
   int res = 0;
-  for (const char *p = text; *p && len--; p++) {
-    if ((*p & 0xc0) == 0x80) {
-      continue;
-    }
-    int chr = mu_min((unsigned char)*p, 127);
-    res += atlas[ATLAS_FONT + chr].w;
+  for (int i = 0, n, cp; i < len && text[i]; i += n) {
+    n = utf8_decode(text + i, len - i, &cp);
+    const int width = cp < 128 ? 1 : utf8_width(cp);
+    res += atlas[ATLAS_FONT + mu_min(cp, 127)].w * width;
   }
   return res;
 }
@@ -1382,24 +7765,1119 @@ void r_present(void) {
   SDL_GL_SwapWindow(window);
 }
 
+// ===BENCHMARKS===
+// run with `smol --bench`. Prints timings to stdout and exits.
+
+double bench_seconds(clock_t begin) {
+  return (double)(clock() - begin) / CLOCKS_PER_SEC;
+}
+
+// Loc navigation before `File::rope` existed: walk byte by byte.
+Loc bench_loc_down_linear(Loc l) {
+  while (!l.eof() && !is_newline(l.get())) {
+    l = l.advance();
+  }
+  return l.advance();
+}
+
+Loc bench_loc_at_linear(File *f, int ix) {
+  Loc l(f, 0, 0, 0);
+  while (l.ix < ix) {
+    l = l.advance();
+  }
+  return l;
+}
+
+void bench_loc(int nbytes) {
+  printf("===loc navigation: %d MB file===\n", nbytes >> 20);
+  File f("<bench>", 0);
+  f.buf = new char[nbytes];
+  for (int i = 0; i < nbytes; ++i) {
+    // lines of 1..80 characters.
+    f.buf[i] = (i * 2654435761u) % 81 == 0 ? '\n' : 'a' + i % 26;
+  }
+  f.len = nbytes;
+
+  clock_t begin = clock();
+  file_build_rope(&f);
+  printf("build rope: %.3fs (%d lines)\n", bench_seconds(begin),
+         f.rope.nlines + 1);
+
+  static const int NSEEKS = 4;
+  begin = clock();
+  for (int i = 1; i <= NSEEKS; ++i) {
+    const Loc l = bench_loc_at_linear(&f, nbytes / NSEEKS * i - 1);
+    assert(l.valid());
+  }
+  printf("byte -> line/col, linear: %.3fus/op\n",
+         bench_seconds(begin) * 1e6 / NSEEKS);
+  begin = clock();
+  for (int i = 1; i <= NSEEKS; ++i) {
+    const Loc l = Loc::at(&f, nbytes / NSEEKS * i - 1);
+    assert(l.valid());
+  }
+  printf("byte -> line/col, rope: %.3fus/op\n",
+         bench_seconds(begin) * 1e6 / NSEEKS);
+
+  static const int NDOWNS = 1000000;
+  Loc l = Loc::at(&f, nbytes / 2);
+  begin = clock();
+  for (int i = 0; i < NDOWNS && !l.eof(); ++i) {
+    l = bench_loc_down_linear(l);
+  }
+  printf("down(), linear: %.3fus/op\n", bench_seconds(begin) * 1e6 / NDOWNS);
+  const Loc linear_end = l;
+  l = Loc::at(&f, nbytes / 2);
+  begin = clock();
+  for (int i = 0; i < NDOWNS && !l.eof(); ++i) {
+    l = l.down();
+  }
+  printf("down(), rope: %.3fus/op\n", bench_seconds(begin) * 1e6 / NDOWNS);
+  assert(l == linear_end);
+
+  piece_tree_decref(f.rope.root);
+  delete[] f.buf;
+}
+
+// a file of `nbytes` of code-like text: lines of a few words drawn from a
+// vocabulary of identifiers, indented.
+File *bench_corpus(int nbytes) {
+  static const char *WORDS[] = {
+      "int",    "return",   "const",  "struct", "void",  "if",    "for",
+      "while",  "editor",   "cursor", "line",   "col",   "file",  "index",
+      "buf",    "len",      "node",   "piece",  "table", "query", "match",
+      "assert", "std::vector", "=",   "+=",     "{",     "}",     "(",
+      ")",      ";",        "0",      "1",      "nullptr"};
+  static const int NWORDS = sizeof(WORDS) / sizeof(WORDS[0]);
+  File *f = new File("<bench>", 0);
+  std::string s;
+  s.reserve(nbytes);
+  unsigned state = 2463534242u;
+  auto next = [&]() {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+  };
+  while ((int)s.size() < nbytes) {
+    s.append(2 * (next() % 4), ' ');
+    const int nwords = 1 + next() % 8;
+    for (int i = 0; i < nwords; ++i) {
+      s += WORDS[next() % NWORDS];
+      // identifiers with numeric suffixes, so not every word is common.
+      if (next() % 4 == 0) {
+        s += std::to_string(next() % 1000);
+      }
+      s += i + 1 < nwords ? ' ' : '\n';
+    }
+  }
+  s.resize(nbytes);
+  f->buf = new char[nbytes];
+  memcpy(f->buf, s.data(), nbytes);
+  f->len = nbytes;
+  file_build_rope(f);
+  return f;
+}
+
+// bytes of the heap in use, counting large blocks that malloc maps.
+long long bench_heap_bytes() {
+  const struct mallinfo2 mi = mallinfo2();
+  return mi.uordblks + mi.hblkhd;
+}
+
+// queries: substrings of `f` of 3 to 10 bytes, within a line.
+std::vector<std::string> bench_queries(File *f, int n) {
+  std::vector<std::string> qs;
+  unsigned state = 88172645u;
+  while ((int)qs.size() < n) {
+    state = state * 1103515245u + 12345u;
+    const int ix = state % f->len;
+    const int len = 3 + (state >> 16) % 8;
+    if (ix + len > f->len || memchr(f->buf + ix, '\n', len) ||
+        is_whitespace(f->buf[ix])) {
+      continue;
+    }
+    qs.push_back(std::string(f->buf + ix, len));
+  }
+  return qs;
+}
+
+// `TrieNode` against `ArtTrie`: the memory each takes per indexed suffix,
+// and how long a lookup takes.
+void bench_trie(int nbytes) {
+  printf("===suffix trie: %d MB corpus===\n", nbytes >> 20);
+  File *f = bench_corpus(nbytes);
+  const IndexPolicy policy;
+  long long nsuffixes = 0;
+  index_for_each_suffix(f, &policy, [&](Loc l, int len) { nsuffixes++; });
+  printf("%lld suffixes\n", nsuffixes);
+
+  long long heap = bench_heap_bytes();
+  clock_t begin = clock();
+  TrieNode *trie = new TrieNode();
+  index_for_each_suffix(f, &policy, [&](Loc l, int len) {
+    index_add(trie, l.file, l.ix, len, l);
+  });
+  printf("TrieNode: build %.3fs, %.1f bytes/suffix\n", bench_seconds(begin),
+         (double)(bench_heap_bytes() - heap) / nsuffixes);
+
+  heap = bench_heap_bytes();
+  begin = clock();
+  ArtTrie *art = new ArtTrie();
+  index_for_each_suffix(
+      f, &policy, [&](Loc l, int len) { art_add(art, l.file, l.ix, len); });
+  printf("ArtTrie: build %.3fs, %.1f bytes/suffix (%.1f counted)\n",
+         bench_seconds(begin),
+         (double)(bench_heap_bytes() - heap) / nsuffixes,
+         (double)art_memory(art) / nsuffixes);
+  begin = clock();
+  art_freeze(art);
+  printf("ArtTrie: freeze %.3fs, %.1f bytes/suffix counted\n",
+         bench_seconds(begin), (double)art_memory(art) / nsuffixes);
+
+  static const int NQUERIES = 1000000;
+  const std::vector<std::string> qs = bench_queries(f, 1000);
+  int found = 0;
+  begin = clock();
+  for (int i = 0; i < NQUERIES; ++i) {
+    const std::string &q = qs[i % qs.size()];
+    found += index_lookup(trie, q.data(), q.size()) != nullptr;
+  }
+  printf("TrieNode: lookup %.3fus/op\n", bench_seconds(begin) * 1e6 / NQUERIES);
+  int art_found = 0;
+  begin = clock();
+  for (int i = 0; i < NQUERIES; ++i) {
+    const std::string &q = qs[i % qs.size()];
+    art_found += art_lookup(art, q.data(), q.size()) != ART_NULL;
+  }
+  printf("ArtTrie: lookup %.3fus/op\n", bench_seconds(begin) * 1e6 / NQUERIES);
+  assert(found == art_found);
+  delete art;
+  piece_tree_decref(f->rope.root);
+  delete[] f->buf;
+  delete f;
+}
+
+// `SuffixArray` over the same corpus: build time, bytes per byte of input,
+// and how long finding the range of a query takes.
+void bench_suffix_array(int nbytes) {
+  printf("===suffix array: %d MB corpus===\n", nbytes >> 20);
+  File *f = bench_corpus(nbytes);
+  SuffixArray *sa = new SuffixArray();
+  clock_t begin = clock();
+  suffix_array_add_file(sa, f);
+  suffix_array_build(sa);
+  printf("build %.3fs, %.1f bytes/byte\n", bench_seconds(begin),
+         (double)suffix_array_memory(sa) / nbytes);
+
+  static const int NQUERIES = 1000000;
+  const std::vector<std::string> qs = bench_queries(f, 1000);
+  long long nmatches = 0;
+  begin = clock();
+  for (int i = 0; i < NQUERIES; ++i) {
+    const std::string &q = qs[i % qs.size()];
+    int lo, hi;
+    suffix_array_range(sa, q.data(), q.size(), &lo, &hi);
+    nmatches += hi - lo;
+  }
+  printf("range %.3fus/op (%.0f matches/op)\n",
+         bench_seconds(begin) * 1e6 / NQUERIES, (double)nmatches / NQUERIES);
+  delete sa;
+  piece_tree_decref(f->rope.root);
+  delete[] f->buf;
+  delete f;
+}
+
+// `FmIndex` over the same corpus: its size against the text, and how long
+// counting and locating take.
+void bench_fm_index(int nbytes) {
+  printf("===FM-index: %d MB corpus===\n", nbytes >> 20);
+  File *f = bench_corpus(nbytes);
+  SuffixArray *sa = new SuffixArray();
+  FmIndex *fm = new FmIndex();
+  clock_t begin = clock();
+  suffix_array_add_file(sa, f);
+  suffix_array_sort(sa);
+  fm_index_build(fm, sa);
+  printf("build %.3fs, %.2f bytes/byte\n", bench_seconds(begin),
+         (double)fm_index_memory(fm) / nbytes);
+
+  static const int NQUERIES = 100000;
+  const std::vector<std::string> qs = bench_queries(f, 1000);
+  long long nmatches = 0;
+  begin = clock();
+  for (int i = 0; i < NQUERIES; ++i) {
+    const std::string &q = qs[i % qs.size()];
+    int lo, hi;
+    fm_index_range(fm, q.data(), q.size(), &lo, &hi);
+    nmatches += hi - lo;
+  }
+  printf("count %.3fus/op (%.0f matches/op)\n",
+         bench_seconds(begin) * 1e6 / NQUERIES, (double)nmatches / NQUERIES);
+  begin = clock();
+  for (int i = 0; i < NQUERIES; ++i) {
+    const int loc = fm_index_locate(fm, i * 7919 % fm->n);
+    assert(loc >= 0 && loc < fm->n);
+  }
+  printf("locate %.3fus/op\n", bench_seconds(begin) * 1e6 / NQUERIES);
+  delete fm;
+  delete sa;
+  piece_tree_decref(f->rope.root);
+  delete[] f->buf;
+  delete f;
+}
+
+// `TrigramIndex` over `nfiles` files: the time to the first match of a query,
+// which is the intersection plus scanning candidates until one matches, and
+// to all of them.
+void bench_trigram(int nfiles, int filelen) {
+  printf("===trigram index: %d files of %d bytes===\n", nfiles, filelen);
+  File *corpus = bench_corpus(nfiles * filelen);
+  std::vector<File> files(nfiles, File("<bench>", filelen));
+  TrigramIndex *ix = new TrigramIndex();
+  clock_t begin = clock();
+  for (int i = 0; i < nfiles; ++i) {
+    files[i].buf = corpus->buf + i * filelen;
+    trigram_index_add_file(ix, &files[i]);
+  }
+  printf("build %.3fs, %.2f bytes/byte\n", bench_seconds(begin),
+         (double)trigram_index_memory(ix) / (nfiles * filelen));
+
+  static const int NQUERIES = 100;
+  const std::vector<std::string> qs = bench_queries(corpus, NQUERIES);
+  double first = 0, all = 0;
+  long long ncandidates = 0;
+  for (const std::string &q : qs) {
+    begin = clock();
+    const std::vector<int> cands =
+        trigram_index_candidates(ix, q.data(), q.size());
+    ncandidates += cands.size();
+    bool found = false;
+    for (int id : cands) {
+      const File *f = ix->files[id];
+      for (const char *p = f->buf;
+           (p = simd_memmem(p, f->buf + f->len - p, q.data(), q.size()));
+           ++p) {
+        if (!found) {
+          first += bench_seconds(begin);
+          found = true;
+        }
+      }
+    }
+    assert(found);
+    all += bench_seconds(begin);
+  }
+  printf("first match %.3fms, all matches %.3fms, %.0f candidate files\n",
+         first * 1e3 / NQUERIES, all * 1e3 / NQUERIES,
+         (double)ncandidates / NQUERIES);
+  delete ix;
+  piece_tree_decref(corpus->rope.root);
+  delete[] corpus->buf;
+  delete corpus;
+}
+
+// a directory of `nfiles` files, each `filelen` bytes of `bench_corpus`, or
+// empty if it can't be made.
+std::string bench_workspace(int nfiles, int filelen) {
+  char dir[] = "/tmp/smol-bench-XXXXXX";
+  if (!mkdtemp(dir)) {
+    printf("unable to create a directory\n");
+    return "";
+  }
+  File *corpus = bench_corpus(nfiles * filelen);
+  for (int i = 0; i < nfiles; ++i) {
+    const std::string path = std::string(dir) + "/" + std::to_string(i);
+    const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    save_write_all(fd, corpus->buf + i * filelen, filelen);
+    close(fd);
+  }
+  piece_tree_decref(corpus->rope.root);
+  delete[] corpus->buf;
+  delete corpus;
+  return dir;
+}
+
+// index the workspace at `dir` as the editor does, with `nworkers` workers,
+// and print how long it took on the wall clock.
+void bench_index_workspace(const char *name, const std::string &dir,
+                           IndexKind kind, int nworkers,
+                           const std::string &index_path) {
+  TaskManager *s = new TaskManager();
+  Index *index = new Index();
+  index->kind = kind;
+  EditorState editor;
+  CommandPaletteState pal;
+  BottomlineState bot;
+  const auto begin = std::chrono::steady_clock::now();
+  s->nworkers = nworkers;
+  s->index_path = index_path;
+  task_manager_start_indexing(s, index, dir);
+  while (s->indexing) {
+    task_manager_run_timeslice(s, &editor, &pal, &bot, index);
+  }
+  const std::chrono::duration<double> took =
+      std::chrono::steady_clock::now() - begin;
+  printf("%s %.3fs: %s\n", name, took.count(), bot.info.c_str());
+  for (File *f : s->files) {
+    file_unmap(f);
+  }
+  if (s->watcher.fd >= 0) {
+    close(s->watcher.fd);
+  }
+  for (IgnoreFile *ig : s->walker.ignores) {
+    delete ig;
+  }
+  for (ArtTrie *t : index->trie_shards) {
+    delete t;
+  }
+  delete index;
+  delete s;
+}
+
+// indexing a workspace of `nfiles` files with the trigram index, first with
+// nothing saved, then again with the index the first run saved.
+void bench_warm_start(int nfiles, int filelen) {
+  printf("===warm start: %d files of %d bytes===\n", nfiles, filelen);
+  const std::string dir = bench_workspace(nfiles, filelen);
+  if (dir.empty()) {
+    return;
+  }
+  const std::string index_path = dir + ".trigrams";
+  bench_index_workspace("cold", dir, IndexKind::Trigram, 0, index_path);
+  bench_index_workspace("warm", dir, IndexKind::Trigram, 0, index_path);
+  std::error_code ec;
+  std::filesystem::remove_all(dir, ec);
+  unlink(index_path.c_str());
+}
+
+// indexing a workspace into the trie with one worker, and with one per core.
+void bench_index_workers(int nfiles, int filelen) {
+  printf("===index workers: %d files of %d bytes, %d cores===\n", nfiles,
+         filelen, std::thread::hardware_concurrency());
+  const std::string dir = bench_workspace(nfiles, filelen);
+  if (dir.empty()) {
+    return;
+  }
+  bench_index_workspace("1 worker", dir, IndexKind::Trie, 1, "");
+  bench_index_workspace("1 per core", dir, IndexKind::Trie, 0, "");
+  std::error_code ec;
+  std::filesystem::remove_all(dir, ec);
+}
+
+// walking a workspace of `nfiles` small files, 100 to a directory, with one
+// thread and with one per core, against std::filesystem.
+void bench_walk(int nfiles) {
+  printf("===walk: %d files===\n", nfiles);
+  char dir[] = "/tmp/smol-bench-XXXXXX";
+  if (!mkdtemp(dir)) {
+    printf("unable to create a directory\n");
+    return;
+  }
+  for (int i = 0; i < nfiles; ++i) {
+    const std::string sub = std::string(dir) + "/" + std::to_string(i / 10000) +
+                            "/" + std::to_string(i / 100 % 100);
+    if (i % 100 == 0) {
+      std::filesystem::create_directories(sub);
+    }
+    const std::string path = sub + "/" + std::to_string(i) + ".txt";
+    close(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644));
+  }
+
+  auto begin = std::chrono::steady_clock::now();
+  int nfound = 0;
+  for (const auto &e : std::filesystem::recursive_directory_iterator(dir)) {
+    nfound += e.is_regular_file();
+  }
+  std::chrono::duration<double> took = std::chrono::steady_clock::now() - begin;
+  printf("std::filesystem %.3fs: %d files\n", took.count(), nfound);
+
+  for (int n : {1, 0}) {
+    begin = std::chrono::steady_clock::now();
+    IndexWorkers workers;
+    Walker walker;
+    // take the paths off the queue as the index would.
+    std::thread drain([&] {
+      std::unique_lock<std::mutex> lock(workers.mu);
+      while (true) {
+        workers.cv.wait(
+            lock, [&] { return !workers.paths.empty() || workers.closed; });
+        if (workers.paths.empty()) {
+          break;
+        }
+        workers.paths.clear();
+        workers.space.notify_all();
+      }
+    });
+    walker_start(&walker, {{dir, "", nullptr}}, {}, &workers, n);
+    while (!walker_done(&walker)) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    index_workers_close(&workers);
+    drain.join();
+    took = std::chrono::steady_clock::now() - begin;
+    printf("walker, %s %.3fs: %d files in %d dirs\n",
+           n == 1 ? "1 thread" : "1 per core", took.count(),
+           walker.nfiles.load(), walker.ndirs.load());
+  }
+  std::error_code ec;
+  std::filesystem::remove_all(dir, ec);
+}
+
+// fuzzy-match `npaths` made up paths, typing the query a byte at a time.
+// Reports the longest timeslice, which should stay well within a frame.
+void bench_fuzzy(int npaths) {
+  printf("===fuzzy paths: %d paths===\n", npaths);
+  static const char *PARTS[] = {"src",   "lib",    "docs",  "util",
+                                "editor", "index", "fuzzy", "piece_table",
+                                "gapBuffer", "main"};
+  TaskManager *s = new TaskManager();
+  uint64_t state = 42;
+  for (int i = 0; i < npaths; ++i) {
+    std::string p;
+    for (int k = 0; k < 4; ++k) {
+      state = state * 6364136223846793005ull + 1442695040888963407ull;
+      p += std::string(PARTS[(state >> 33) % 10]) + "/";
+    }
+    s->files.push_back(new File(p + std::to_string(i) + ".cpp", 0));
+  }
+  Index index;
+  CommandPaletteState pal;
+  const std::string q = "@edidxmain";
+  for (int k = 2; k <= (int)q.size(); ++k) {
+    pal.input = q.substr(0, k);
+    pal.sequence_number++;
+    double total = 0, longest = 0;
+    do {
+      const clock_t begin = clock();
+      task_manager_query_timeslice(s, &pal, &index);
+      const double took = bench_seconds(begin);
+      total += took;
+      longest = std::max(longest, took);
+    } while (s->query.fuzzy_next < (int)s->query.fuzzy_pool.size());
+    printf("%-12s %7.2fms, longest timeslice %5.2fms, %ld matches\n",
+           pal.input.c_str(), total * 1e3, longest * 1e3, pal.num_matches);
+  }
+  for (File *f : s->files) {
+    delete f;
+  }
+  delete s;
+}
+
+// extract the symbols of `nfiles` made up C++ files, a shard of 1000 files
+// to a run, then look some up through the palette.
+void bench_symbols(int nfiles) {
+  printf("===symbols: %d files===\n", nfiles);
+  std::vector<File *> files;
+  long long nbytes = 0;
+  for (int i = 0; i < nfiles; ++i) {
+    std::string text = "#include \"common.h\"\n";
+    for (int k = 0; k < 8; ++k) {
+      const std::string id = std::to_string(i) + "_" + std::to_string(k);
+      text += "// see widget_update" + id + ".\n";
+      text += "struct Widget" + id + " {\n  int x, y;\n";
+      text += "  int area() const { return x * y; }\n};\n";
+      text += "enum Mode" + id + " { MODE_A" + id + ", MODE_B" + id + " };\n";
+      text += "static int widget_update" + id + "(Widget" + id +
+              " *w, int dx) {\n  if (dx) { w->x += dx; }\n  return w->x;\n}\n";
+    }
+    File *f = new File("bench/" + std::to_string(i) + ".cpp", text.size());
+    f->buf = new char[text.size()];
+    memcpy(f->buf, text.data(), text.size());
+    nbytes += f->len;
+    files.push_back(f);
+  }
+
+  Index index;
+  auto begin = std::chrono::steady_clock::now();
+  SymbolParser parser;
+  symbol_parser_init(&parser);
+  for (int i = 0; i < nfiles; ++i) {
+    if (i % 1000 == 0) {
+      index.symbols.emplace_back();
+    }
+    symbols_extract(&parser, files[i], &index.symbols.back());
+  }
+  symbol_parser_free(&parser);
+  long long nsymbols = 0;
+  for (std::vector<Symbol> &run : index.symbols) {
+    std::sort(run.begin(), run.end(), symbol_less);
+    nsymbols += run.size();
+  }
+  std::chrono::duration<double> took =
+      std::chrono::steady_clock::now() - begin;
+  printf("extract and sort %.3fs, %.0f MB/s: %lld symbols in %d runs\n",
+         took.count(), nbytes / took.count() / (1 << 20), nsymbols,
+         (int)index.symbols.size());
+
+  TaskManager *s = new TaskManager();
+  CommandPaletteState pal;
+  for (const std::string q :
+       {"#Widget123_4", "#widget_update9", "#mode_a", "#w"}) {
+    pal.input = q;
+    pal.sequence_number++;
+    double longest = 0;
+    begin = std::chrono::steady_clock::now();
+    do {
+      const auto slice = std::chrono::steady_clock::now();
+      task_manager_query_timeslice(s, &pal, &index);
+      took = std::chrono::steady_clock::now() - slice;
+      longest = std::max(longest, took.count());
+    } while (!query_cursor_done(&s->query));
+    took = std::chrono::steady_clock::now() - begin;
+    printf("%-16s %7.3fms, longest timeslice %6.3fms, %ld matches\n",
+           q.c_str(), took.count() * 1e3, longest * 1e3, pal.num_matches);
+  }
+  delete s;
+  for (File *f : files) {
+    piece_tree_decref(f->rope.root);
+    delete[] f->buf;
+    delete f;
+  }
+}
+
+// ===TESTS===
+// run with `smol --test`. Each test checks behaviour that is easy to break
+// and hard to notice by hand, and the first to fail aborts with its name.
+
+// like assert, but also in builds without asserts.
+void test_check(bool ok, const char *what) {
+  if (!ok) {
+    fprintf(stderr, "test failed: %s\n", what);
+    abort();
+  }
+}
+
+// a fresh file under /tmp holding `text`.
+std::string test_file(const std::string &text) {
+  char path[] = "/tmp/smol-test-XXXXXX";
+  const int fd = mkstemp(path);
+  test_check(fd >= 0, "mkstemp");
+  test_check(write(fd, text.data(), text.size()) == (ssize_t)text.size(),
+             "write test file");
+  close(fd);
+  return path;
+}
+
+std::string test_editor_text(const EditorState *editor) {
+  std::string s(editor->text.len, 0);
+  piece_table_copy(&editor->text, 0, s.size(), &s[0]);
+  return s;
+}
+
+// numbered lines, more than `nbytes` of them.
+std::string test_lines(int nbytes) {
+  std::string s;
+  for (int i = 0; (int)s.size() < nbytes; ++i) {
+    s += "line " + std::to_string(i) + "\n";
+  }
+  return s;
+}
+
+// give back what an editor of a test holds: its history, text and file.
+void test_editor_close(EditorState *editor) {
+  while (!editor->history.entries.empty()) {
+    editor_history_drop(editor, editor->history.entries.begin()->first);
+  }
+  piece_tree_decref(editor->text.root);
+  editor->text.root = nullptr;
+  file_unmap(editor->file);
+  editor->file = nullptr;
+}
+
+// a file truncated by someone else while it streams in ends early, rather
+// than faulting on the pages that are gone.
+void test_editor_truncated() {
+  const std::string text = test_lines(3 * EDITOR_LOAD_CHUNK_LEN);
+  const std::string path = test_file(text);
+  EditorState editor;
+  editor_open(&editor, file_map(path));
+  const std::string loaded = test_editor_text(&editor);
+  test_check(editor_loading(&editor), "truncated: streams in");
+  test_check(truncate(path.c_str(), 0) == 0, "truncate");
+  while (editor_loading(&editor)) {
+    editor_load_chunk(&editor, EDITOR_LOAD_CHUNK_LEN);
+  }
+  test_check(editor.file->len < (int)text.size(), "truncated: ends early");
+  // what was read before the truncation is kept, and nothing more.
+  const std::string got = test_editor_text(&editor);
+  test_check(got.size() >= loaded.size() && !text.compare(0, got.size(), got),
+             "truncated: keeps what was read");
+  test_editor_close(&editor);
+  unlink(path.c_str());
+}
+
+// typing on the last loaded line while the file streams in comes before the
+// rest of that line, once it is loaded.
+void test_editor_edit_streaming() {
+  const std::string text = test_lines(3 * EDITOR_LOAD_CHUNK_LEN);
+  const std::string path = test_file(text);
+  EditorState editor;
+  editor_open(&editor, file_map(path));
+  const int loaded = editor.text.len;
+  Cursor c;
+  c.line = editor_num_lines(&editor) - 1;
+  cursor_insert_str(&editor, c, "abc", 3);
+  while (editor_loading(&editor)) {
+    editor_load_chunk(&editor, EDITOR_LOAD_CHUNK_LEN);
+  }
+  editor_flush_active_line(&editor);
+  test_check(test_editor_text(&editor) ==
+                 text.substr(0, loaded) + "abc" + text.substr(loaded),
+             "edit while streaming");
+  test_editor_close(&editor);
+  unlink(path.c_str());
+}
+
+// a failed in-place save leaves its journal behind; the rewrite that saves
+// the file next removes it, so it is not replayed over the new text.
+void test_save_rewrite_drops_journal() {
+  const std::string path = test_file("hello\nworld\n");
+  EditorState editor;
+  editor_open(&editor, file_map(path));
+  // the journal of an in-place save that never got to write the file.
+  std::string stale = "HELLO";
+  SaveRegion r{0, 5, {iovec{&stale[0], stale.size()}}};
+  test_check(save_journal_write(path, 12, {r}), "journal written");
+  cursor_insert_str(&editor, Cursor(), "x", 1);
+  std::string status;
+  test_check(editor_save(&editor, &status), "rewrite");
+  test_check(status.find("rewrote") != std::string::npos, "rewrite: rewrote");
+  test_check(access(save_journal_path(path).c_str(), F_OK) != 0,
+             "rewrite: journal removed");
+  save_journal_replay(path);
+  File *f = file_map(path);
+  test_check(f && std::string(f->buf, f->len) == "xhello\nworld\n",
+             "rewrite: text kept");
+  file_unmap(f);
+  test_editor_close(&editor);
+  unlink(path.c_str());
+}
+
+// a command that changes nothing, like deleting to the end of the line at
+// its end, is not an undo step: undo right after it undoes the edit before.
+void test_undo_skips_empty_edit() {
+  const std::string path = test_file("hello\nworld\n");
+  EditorState editor;
+  editor_open(&editor, file_map(path));
+  Cursor c = cursor_insert_str(&editor, Cursor(), "x", 1);
+  editor_history_commit(&editor, c);
+  c.col = editor_line_len(&editor, 0);
+  c = cursor_delete_till_end_of_line(&editor, c);
+  editor_history_commit(&editor, c);
+  editor_undo(&editor, c);
+  test_check(test_editor_text(&editor) == "hello\nworld\n",
+             "undo after empty edit");
+  test_editor_close(&editor);
+  unlink(path.c_str());
+}
+
+// an undo step is charged for the nodes of the editor's text that it holds
+// on its own, not for ropes built meanwhile for other files.
+void test_history_bytes() {
+  const std::string path = test_file("hello\nworld\n");
+  EditorState editor;
+  editor_open(&editor, file_map(path));
+  const long long before = editor.history.bytes;
+  Cursor c = cursor_insert_str(&editor, Cursor(), "x", 1);
+  const std::string text = test_lines(1 << 20);
+  File other("<other>", text.size());
+  other.buf = (char *)text.data();
+  file_build_rope(&other);
+  editor_history_commit(&editor, c);
+  const long long step = editor.history.bytes - before;
+  test_check(step > 0 && step < 16 * (long long)sizeof(PieceNode),
+             "history bytes: only the editor's nodes");
+  piece_tree_decref(other.rope.root);
+  // and the step still costs what it did once the rope is gone.
+  c = cursor_insert_str(&editor, c, "y", 1);
+  editor_history_commit(&editor, c);
+  const long long next = editor.history.bytes - before - step;
+  test_check(next >= (long long)sizeof(PieceNode),
+             "history bytes: edits after a rope is freed");
+  test_editor_close(&editor);
+  unlink(path.c_str());
+}
+
+// random edits, commits, undos and redos, against a model of the undo tree
+// that keeps the text of each entry: undo goes to the parent, redo to the
+// child that was last undone from, and an edit after an undo branches off.
+void test_undo_redo() {
+  const std::string path = test_file("hello\nworld\n");
+  EditorState editor;
+  editor_open(&editor, file_map(path));
+  struct Step {
+    std::string text;
+    int parent = -1;
+    int redo = -1;
+  };
+  std::vector<Step> steps = {{test_editor_text(&editor)}};
+  int cur = 0;
+  bool edited = false; // since the last commit or restore.
+  Cursor c;
+  auto commit = [&]() {
+    editor_history_commit(&editor, c);
+    if (edited) {
+      steps.push_back({test_editor_text(&editor), cur});
+      cur = steps.size() - 1;
+      edited = false;
+    }
+  };
+  static const char *INSERTS[] = {"a", "bc", "\n", "x\ny"};
+  uint64_t state = 42;
+  for (int i = 0; i < 4000; ++i) {
+    state = state * 6364136223846793005ull + 1442695040888963407ull;
+    const int r = state >> 33;
+    const int what = r % 10;
+    if (what < 5) {
+      c.line = (r >> 4) % editor_num_lines(&editor);
+      c.col = (r >> 12) % (editor_line_len(&editor, c.line) + 1);
+      if (what == 0 && c.col < editor_line_len(&editor, c.line)) {
+        c = cursor_delete_till_end_of_line(&editor, c);
+      } else {
+        const char *s = INSERTS[(r >> 20) % 4];
+        c = cursor_insert_str(&editor, c, s, strlen(s));
+      }
+      edited = true;
+    } else if (what < 7) {
+      commit();
+    } else if (what < 9) {
+      commit();
+      c = editor_undo(&editor, c);
+      if (steps[cur].parent != -1) {
+        steps[steps[cur].parent].redo = cur;
+        cur = steps[cur].parent;
+      }
+      test_check(test_editor_text(&editor) == steps[cur].text, "undo");
+    } else {
+      commit();
+      c = editor_redo(&editor, c);
+      if (steps[cur].redo != -1) {
+        cur = steps[cur].redo;
+      }
+      test_check(test_editor_text(&editor) == steps[cur].text, "redo");
+    }
+  }
+  test_editor_close(&editor);
+  unlink(path.c_str());
+}
+
+// files that repeat a lot, in a small alphabet, and one long run of a byte
+// whose matches share more than the LCP array holds.
+std::vector<File *> test_corpus() {
+  std::vector<File *> files;
+  uint64_t state = 7;
+  for (int i = 0; i < 8; ++i) {
+    std::string text;
+    for (int j = 0; j < (i == 0 ? 600 : 50 + 97 * i); ++j) {
+      state = state * 6364136223846793005ull + 1442695040888963407ull;
+      text += i == 0 ? 'a' : "ab\nc"[(state >> 33) % 4];
+    }
+    File *f = new File("<corpus " + std::to_string(i) + ">", text.size());
+    f->buf = new char[f->len];
+    memcpy(f->buf, text.data(), f->len);
+    f->owned = true;
+    files.push_back(f);
+  }
+  return files;
+}
+
+// substrings of `text` short and long, some across files, and a few that
+// are not in it.
+std::vector<std::string> test_queries(const std::string &text) {
+  std::vector<std::string> qs = {"d", "abcd", "aaab\nd"};
+  uint64_t state = 11;
+  for (int i = 0; i < 300; ++i) {
+    state = state * 6364136223846793005ull + 1442695040888963407ull;
+    const int begin = (state >> 33) % text.size();
+    const int len = 1 + (state >> 13) % (i % 2 ? 8 : 300);
+    qs.push_back(text.substr(begin, len));
+  }
+  return qs;
+}
+
+// where `key` occurs in `text`, in order, by brute force.
+std::vector<int> test_occurrences(const std::string &text,
+                                  const std::string &key) {
+  std::vector<int> out;
+  const char *p = text.data();
+  const char *end = text.data() + text.size();
+  while ((p = (const char *)memmem(p, end - p, key.data(), key.size()))) {
+    out.push_back(p - text.data());
+    p++;
+  }
+  return out;
+}
+
+// the suffix array finds every occurrence of a query and nothing else, for
+// runs of matches read off the LCP array and for those searched for.
+void test_suffix_array() {
+  std::vector<File *> files = test_corpus();
+  SuffixArray sa;
+  for (File *f : files) {
+    suffix_array_add_file(&sa, f);
+  }
+  suffix_array_build(&sa);
+  // the text without the '\0' that ends it.
+  const std::string text = sa.text.substr(0, sa.text.size() - 1);
+  for (const std::string &q : test_queries(text)) {
+    int lo, hi;
+    suffix_array_range(&sa, q.data(), q.size(), &lo, &hi);
+    std::vector<int> got(sa.sa.begin() + lo, sa.sa.begin() + hi);
+    std::sort(got.begin(), got.end());
+    test_check(got == test_occurrences(text, q), "suffix array matches");
+  }
+  for (File *f : files) {
+    file_unmap(f);
+  }
+}
+
+// the FM-index counts and locates every occurrence of a query, through the
+// ranks of its wavelet tree and the samples it steps back to.
+void test_fm_index() {
+  std::vector<File *> files = test_corpus();
+  SuffixArray sa;
+  for (File *f : files) {
+    suffix_array_add_file(&sa, f);
+  }
+  suffix_array_sort(&sa);
+  const std::string text = sa.text.substr(0, sa.text.size() - 1);
+  FmIndex fm;
+  fm_index_build(&fm, &sa);
+  for (const std::string &q : test_queries(text)) {
+    int lo, hi;
+    fm_index_range(&fm, q.data(), q.size(), &lo, &hi);
+    std::vector<int> got;
+    for (int i = lo; i < hi; ++i) {
+      got.push_back(fm_index_locate(&fm, i));
+    }
+    std::sort(got.begin(), got.end());
+    test_check(got == test_occurrences(text, q), "FM-index matches");
+  }
+  for (File *f : files) {
+    file_unmap(f);
+  }
+}
+
+// what .gitignore rules ignore, as git has it. `sub` are the rules of the
+// directory src/, below the root that has `rules`.
+void test_ignore_rules() {
+  struct Case {
+    const char *rules;
+    const char *sub;
+    const char *rel;
+    bool is_dir;
+    bool ignored;
+  };
+  static const Case CASES[] = {
+      // a name matches at any depth, a path only below the ignore file.
+      {"*.o", nullptr, "a.o", false, true},
+      {"*.o", nullptr, "src/x/a.o", false, true},
+      {"*.o", nullptr, "a.c", false, false},
+      {"/build", nullptr, "build", true, true},
+      {"/build", nullptr, "src/build", true, false},
+      {"doc/*.txt", nullptr, "doc/a.txt", false, true},
+      {"doc/*.txt", nullptr, "doc/x/a.txt", false, false},
+      {"doc/*.txt", nullptr, "src/doc/a.txt", false, false},
+      // `**/` also matches nothing.
+      {"**/logs", nullptr, "logs", true, true},
+      {"**/logs", nullptr, "a/b/logs", true, true},
+      {"a/**/b", nullptr, "a/b", false, true},
+      {"a/**/b", nullptr, "a/x/y/b", false, true},
+      {"a/**", nullptr, "a/x/y", false, true},
+      {"a/**", nullptr, "b/a/x", false, false},
+      {"[a-c]?.txt", nullptr, "bx.txt", false, true},
+      {"[a-c]?.txt", nullptr, "dx.txt", false, false},
+      {"[!a-c]*", nullptr, "dx", false, true},
+      // the last rule that matches decides.
+      {"*.log\n!keep.log", nullptr, "keep.log", false, false},
+      {"*.log\n!keep.log", nullptr, "other.log", false, true},
+      {"!keep.log\n*.log", nullptr, "keep.log", false, true},
+      {"tmp/", nullptr, "tmp", true, true},
+      {"tmp/", nullptr, "tmp", false, false},
+      {"# tmp\n\\#tmp", nullptr, "#tmp", false, true},
+      {"# tmp\n\\#tmp", nullptr, "tmp", false, false},
+      {"tmp  \r\n", nullptr, "tmp", false, true},
+      // the rules of a deeper directory come first.
+      {"*.gen", "!*.gen", "src/a.gen", false, false},
+      {"!x.gen", "x.gen", "src/x.gen", false, true},
+      {"*.gen", "!*.gen", "a.gen", false, true},
+      {"", "/gen", "src/gen", true, true},
+      {"", "/gen", "src/x/gen", true, false},
+  };
+  for (const Case &c : CASES) {
+    IgnoreFile root, sub;
+    ignore_file_parse(&root, c.rules);
+    sub.dir = "src/";
+    sub.parent = &root;
+    ignore_file_parse(&sub, c.sub ? c.sub : "");
+    const bool below = !strncmp(c.rel, "src/", 4);
+    const std::string what =
+        std::string("ignore rules: ") + c.rules + " | " + (c.sub ? c.sub : "") +
+        " on " + c.rel;
+    test_check(ignore_match(below ? &sub : &root, c.rel, c.is_dir) ==
+                   c.ignored,
+               what.c_str());
+  }
+}
+
+// whether a trigram index saved as `bytes` loads.
+bool test_trigram_load(const std::string &bytes) {
+  const std::string path = test_file(bytes);
+  TrigramIndex ix;
+  const bool ok = trigram_index_load(&ix, path);
+  if (ok) {
+    munmap((void *)ix.base, ix.base_len);
+  }
+  unlink(path.c_str());
+  return ok;
+}
+
+// a saved trigram index that is torn or corrupt is ignored, rather than
+// read past its end or trusted with ids of files it doesn't have.
+void test_trigram_index_corrupt() {
+  TrigramIndex ix;
+  for (const std::string text : {"hello world", "world peace"}) {
+    File *f = new File("/tmp/" + text.substr(0, 5), text.size());
+    f->buf = new char[f->len];
+    memcpy(f->buf, text.data(), f->len);
+    f->owned = true;
+    trigram_index_add_file(&ix, f);
+  }
+  const std::string path = test_file("");
+  test_check(trigram_index_save(&ix, path), "trigram index saved");
+  File *saved = file_map(path);
+  const std::string good(saved->buf, saved->len);
+  file_unmap(saved);
+  unlink(path.c_str());
+  test_check(test_trigram_load(good), "trigram index loads");
+
+  test_check(!test_trigram_load(good.substr(0, good.size() - 1)),
+             "trigram index: torn");
+  std::string b = good;
+  TrigramFileHeader *h = (TrigramFileHeader *)&b[0];
+  h->paths_len = UINT64_MAX - 8;
+  test_check(!test_trigram_load(b), "trigram index: lengths wrap around");
+  b = good;
+  h = (TrigramFileHeader *)&b[0];
+  ((TrigramFileEntry *)trigram_file_entries(h))[1].path = h->paths_len;
+  test_check(!test_trigram_load(b), "trigram index: path out of range");
+  b = good;
+  h = (TrigramFileHeader *)&b[0];
+  ((TrigramEntry *)trigram_file_trigrams(h))[0].postings = h->postings_len;
+  test_check(!test_trigram_load(b), "trigram index: postings out of range");
+  b = good;
+  h = (TrigramFileHeader *)&b[0];
+  *(uint8_t *)trigram_file_postings(h) = 0x7f;
+  test_check(!test_trigram_load(b), "trigram index: id out of range");
+  for (File *f : ix.files) {
+    file_unmap(f);
+  }
+}
+
+void test_all() {
+  test_editor_truncated();
+  test_editor_edit_streaming();
+  test_save_rewrite_drops_journal();
+  test_undo_skips_empty_edit();
+  test_history_bytes();
+  test_undo_redo();
+  test_suffix_array();
+  test_fm_index();
+  test_ignore_rules();
+  test_trigram_index_corrupt();
+  printf("tests passed\n");
+}
+
 // === MAIN====
-// TODO: add open/save/load.
+
+static const char SMOL_USAGE[] =
+    "usage: smol [--index=sa|fm|trigram] [--index-budget=<MB>] [<dir>] "
+    "[<file>]\n"
+    "       smol --bench\n"
+    "       smol --test\n";
 
 int main(int argc, char **argv) {
   setlocale(LC_ALL, "");
 
-  // TODO: figure out the grammar.
-  TSParser *parser = ts_parser_new();
+  if (argc >= 2 && !strcmp(argv[1], "--bench")) {
+    bench_loc(256 << 20);
+    bench_trie(16 << 20);
+    bench_suffix_array(16 << 20);
+    bench_fm_index(16 << 20);
+    bench_trigram(100000, 1024);
+    bench_warm_start(20000, 4096);
+    bench_index_workers(4000, 4096);
+    bench_walk(500000);
+    bench_fuzzy(100000);
+    bench_symbols(100000);
+    return 0;
+  }
+  if (argc >= 2 && !strcmp(argv[1], "--test")) {
+    test_all();
+    return 0;
+  }
 
-  TaskManager g_task_manager;
+  // `smol --index=sa <dir>` searches with a suffix array rather than a trie,
+  // `--index=fm` with an FM-index, `--index=trigram` with a trigram index.
+  // `--index-budget=<MB>` caps the memory the index takes, by default a
+  // quarter of the machine's. The flags come before the paths, in any order.
+  Index g_index;
+  g_index.policy.budget =
+      (long long)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGE_SIZE) / 4;
+  for (; argc >= 2 && !strncmp(argv[1], "--index", 7); argc--, argv++) {
+    const char *arg = argv[1];
+    if (!strcmp(arg, "--index=sa")) {
+      g_index.kind = IndexKind::SuffixArray;
+    } else if (!strcmp(arg, "--index=fm")) {
+      g_index.kind = IndexKind::FmIndex;
+    } else if (!strcmp(arg, "--index=trigram")) {
+      g_index.kind = IndexKind::Trigram;
+    } else if (!strncmp(arg, "--index-budget=", 15)) {
+      const char *mb = arg + 15;
+      char *end;
+      errno = 0;
+      const long long n = strtoll(mb, &end, 10);
+      if (end == mb || *end || errno == ERANGE || n <= 0 ||
+          n > (LLONG_MAX >> 20)) {
+        fprintf(stderr, "invalid budget: %s\n", arg);
+        fputs(SMOL_USAGE, stderr);
+        return 1;
+      }
+      g_index.policy.budget = n << 20;
+    } else {
+      fprintf(stderr, "unknown flag: %s\n", arg);
+      fputs(SMOL_USAGE, stderr);
+      return 1;
+    }
+  }
 
-  TrieNode g_index;
+  // `smol <dir> <file>` edits a file of the workspace.
+  TaskManager g_task_manager;
+  if (argc >= 2 && std::filesystem::is_directory(argv[1])) {
+    task_manager_start_indexing(&g_task_manager, &g_index, argv[1]);
+    argc--;
+    argv++;
+  }
 
   BottomlineState g_bottom_line_state;
   g_bottom_line_state.info = "WELCOME";
 
   CommandPaletteState g_command_palette_state;
   EditorState *g_editor_state = new EditorState();
+  editor_history_reset(g_editor_state, Cursor());
+  if (argc >= 2 && std::filesystem::is_regular_file(argv[1])) {
+    save_journal_replay(argv[1]);
+    File *f = file_map(argv[1]);
+    if (!f) {
+      fprintf(stderr, "unable to open %s\n", argv[1]);
+      return 1;
+    }
+    editor_open(g_editor_state, f);
+    g_bottom_line_state.info = "opened: " + f->path;
+  } else if (argc >= 2 && !std::filesystem::exists(argv[1])) {
+    // a new file, created on the first save.
+    g_editor_state->path = argv[1];
+  }
 
   FocusState g_focus_state = FocusState::FSK_Palette;
 
@@ -1457,7 +8935,8 @@ int main(int argc, char **argv) {
     // Handle tasks.
     const clock_t clock_begin = clock();
     do {
-      task_manager_run_timeslice(&g_task_manager, &g_command_palette_state,
+      task_manager_run_timeslice(&g_task_manager, g_editor_state,
+                                 &g_command_palette_state,
                                  &g_bottom_line_state, &g_index);
     } while (clock() - clock_begin < TARGET_CLOCKS_PER_FRAME * 0.1);
 